@@ -28,7 +28,7 @@ actor* actor_near_iterator::operator*() const
 {
     if (i == -1)
         return &you;
-    else if (i < MAX_MONSTERS)
+    else if (i < env.mons_used)
         return &menv[i];
     else
         return nullptr;
@@ -64,7 +64,7 @@ bool actor_near_iterator::valid(const actor* a) const
 void actor_near_iterator::advance()
 {
     do
-         if (++i >= MAX_MONSTERS)
+         if (++i >= env.mons_used)
              return;
     while (!valid(**this));
 }
@@ -92,7 +92,7 @@ monster_near_iterator::operator bool() const
 
 monster* monster_near_iterator::operator*() const
 {
-    if (i < MAX_MONSTERS)
+    if (i < env.mons_used)
         return &menv[i];
     else
         return nullptr;
@@ -128,7 +128,7 @@ bool monster_near_iterator::valid(const monster* a) const
 void monster_near_iterator::advance()
 {
     do
-         if (++i >= MAX_MONSTERS)
+         if (++i >= env.mons_used)
              return;
     while (!valid(**this));
 }
@@ -138,18 +138,18 @@ void monster_near_iterator::advance()
 monster_iterator::monster_iterator()
     : i(0)
 {
-    while (i < MAX_MONSTERS && !menv[i].alive())
+    while (i < env.mons_used && !menv[i].alive())
         i++;
 }
 
 monster_iterator::operator bool() const
 {
-    return i < MAX_MONSTERS && (*this)->alive();
+    return i < env.mons_used && (*this)->alive();
 }
 
 monster* monster_iterator::operator*() const
 {
-    if (i < MAX_MONSTERS)
+    if (i < env.mons_used)
         return &menv[i];
     else
         return nullptr;
@@ -162,7 +162,7 @@ monster* monster_iterator::operator->() const
 
 monster_iterator& monster_iterator::operator++()
 {
-    while (++i < MAX_MONSTERS)
+    while (++i < env.mons_used)
         if (menv[i].alive())
             break;
     return *this;
@@ -178,7 +178,7 @@ monster_iterator monster_iterator::operator++(int)
 void monster_iterator::advance()
 {
     do
-         if (++i >= MAX_MONSTERS)
+         if (++i >= env.mons_used)
              return;
     while (!(*this)->alive());
 }
@@ -63,6 +63,10 @@ static propgrid_t _agrid;
 static bool _agrid_valid = false;
 static bool no_areas = false;
 
+// APROP_SILENCE on its own, for noise propagation.
+static FixedBitArray<GXM, GYM> _silence_grid;
+static bool _any_silence = false;
+
 static void _set_agrid_flag(const coord_def& p, areaprop_flag f)
 {
     _agrid(p) |= f;
@@ -105,7 +109,11 @@ static void _actor_areas(actor *a)
         _agrid_centres.emplace_back(AREA_SILENCE, a->pos(), r);
 
         for (radius_iterator ri(a->pos(), r, C_CIRCLE); ri; ++ri)
+        {
             _set_agrid_flag(*ri, APROP_SILENCE);
+            _silence_grid.set(*ri);
+        }
+        _any_silence = true;
         no_areas = false;
     }
 
@@ -183,6 +191,11 @@ static void _update_agrid()
 
     _agrid.init(0);
     _agrid_centres.clear();
+    if (_any_silence)
+    {
+        _silence_grid.reset();
+        _any_silence = false;
+    }
 
     no_areas = true;
 
@@ -567,6 +580,20 @@ bool silenced(const coord_def& p)
     return _check_agrid_flag(p, APROP_SILENCE);
 }
 
+/**
+ * All the silenced grids at once, for code that checks a great many of
+ * them.
+ *
+ * @return A bitmap of the grids silenced() is true for, or nullptr if
+ *         there are none. It is good until the areas next change.
+ */
+const FixedBitArray<GXM, GYM> *silenced_grids()
+{
+    if (!_agrid_valid)
+        _update_agrid();
+    return _any_silence ? &_silence_grid : nullptr;
+}
+
 /////////////
 // Halos
 
@@ -30,6 +30,7 @@ void decrease_sanctuary_radius();
 coord_def find_centre_for (const coord_def& f, area_centre_type at = AREA_NONE);
 
 bool silenced(const coord_def& p);
+const FixedBitArray<GXM, GYM> *silenced_grids();
 
 // Does the given point lie within a halo?
 bool haloed(const coord_def& p);
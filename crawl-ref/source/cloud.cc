@@ -31,6 +31,7 @@
 #include "stringutil.h"
 #include "terrain.h"
 #include "tiledef-main.h"
+#include "turnprof.h"
 #include "unwind.h"
 
 /// A portrait of a cloud_type.
@@ -250,6 +251,29 @@ static bool _killer_whose_match(kill_category whose, killer_type killer)
 }
 #endif
 
+static void _add_active_cloud(int cloud)
+{
+    env.active_cloud_pos[cloud] = env.active_clouds.size();
+    env.active_clouds.push_back(cloud);
+}
+
+static void _remove_active_cloud(int cloud)
+{
+    const int last = env.active_clouds.back();
+    env.active_clouds[env.active_cloud_pos[cloud]] = last;
+    env.active_cloud_pos[last] = env.active_cloud_pos[cloud];
+    env.active_clouds.pop_back();
+}
+
+// For when env.cloud has been filled in or cleared wholesale.
+void reset_active_clouds()
+{
+    env.active_clouds.clear();
+    for (int i = 0; i < MAX_CLOUDS; ++i)
+        if (env.cloud[i].type != CLOUD_NONE)
+            _add_active_cloud(i);
+}
+
 static void _los_cloud_changed(const coord_def& p, cloud_type t)
 {
     if (is_opaque_cloud_type(t))
@@ -291,6 +315,7 @@ static void _new_cloud(int cloud, cloud_type type, const coord_def& p,
     c.tile        = tile;
     env.cgrid(p)  = cloud;
     env.cloud_no++;
+    _add_active_cloud(cloud);
 
     _los_cloud_changed(p, type);
 }
@@ -420,11 +445,10 @@ static void _cloud_interacts_with_terrain(const cloud_struct &cloud)
     }
 }
 
-static void _dissipate_cloud(int cloudidx, int dissipate)
+// Spreads a cloud whose decay has been applied for this turn.
+static void _dissipate_cloud(int cloudidx)
 {
     cloud_struct &cloud = env.cloud[cloudidx];
-    // Apply calculated rate to the actual cloud.
-    cloud.decay -= dissipate;
 
     if (cloud.type == CLOUD_FOREST_FIRE)
         _spread_fire(cloud);
@@ -488,7 +512,13 @@ static void _handle_ghostly_flame(const cloud_struct& cloud)
 
 void manage_clouds()
 {
-    for (int i = 0; i < MAX_CLOUDS; ++i)
+    turn_phase_timer timer(TPHASE_CLOUDS);
+
+    // Deleting clouds reorders the list, and clouds that spread this turn
+    // wait until the next to decay, so go over a copy.
+    const vector<int> active = env.active_clouds;
+
+    for (int i : active)
     {
         cloud_struct& cloud = env.cloud[i];
 
@@ -539,8 +569,14 @@ void manage_clouds()
 
         _cloud_interacts_with_terrain(cloud);
 
-        _dissipate_cloud(i, dissipate);
+        // Apply calculated rate to the actual cloud.
+        cloud.decay -= dissipate;
     }
+
+    // Then spread all of them, now that the decays are known.
+    for (int i : active)
+        if (env.cloud[i].type != CLOUD_NONE)
+            _dissipate_cloud(i);
 }
 
 static void _maybe_leave_water(const cloud_struct& c)
@@ -608,6 +644,7 @@ void delete_cloud(int cloud)
     _los_cloud_changed(c.pos, t);
     c.pos.reset();
     env.cloud_no--;
+    _remove_active_cloud(cloud);
 }
 
 void move_cloud_to(coord_def src, coord_def dst)
@@ -28,6 +28,7 @@ void place_cloud(cloud_type cl_type, const coord_def& ctarget,
                  string tile = "", int excl_rad = -1);
 
 void manage_clouds();
+void reset_active_clouds();
 
 bool is_opaque_cloud_type(cloud_type ctype);
 bool is_opaque_cloud(int cloud_idx);
@@ -15,6 +15,7 @@
 #include "state.h"
 #include "stringutil.h"
 #include "syscalls.h"
+#include "turnprof.h"
 #include "unicode.h"
 #include "version.h"
 
@@ -539,6 +540,7 @@ bool CLua::calltopfn(lua_State *ls, const char *params, va_list args,
     if (retc == -1)
         retc = return_count(ls, params);
     lua_call_throttle strangler(this);
+    turn_phase_timer timer(TPHASE_LUA);
     int err = lua_pcall(ls, argc, retc, 0);
     set_error(err, ls);
     return !err;
@@ -732,6 +734,7 @@ bool CLua::callfn(const char *fn, int nargs, int nret)
     }
 
     lua_call_throttle strangler(this);
+    turn_phase_timer timer(TPHASE_LUA);
     int err = lua_pcall(ls, nargs, nret, 0);
     set_error(err, ls);
     return !err;
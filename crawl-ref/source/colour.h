@@ -106,6 +106,7 @@ bool is_low_colour(colour_t colour) IMMUTABLE;
 bool is_high_colour(colour_t colour) IMMUTABLE;
 colour_t make_low_colour(colour_t colour) IMMUTABLE;
 colour_t make_high_colour(colour_t colour) IMMUTABLE;
+bool is_element_colour(int col) IMMUTABLE;
 int  element_colour(int element, bool no_random = false,
                     const coord_def& loc = coord_def());
 int get_disjunct_phase(const coord_def& loc);
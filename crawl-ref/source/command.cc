@@ -1444,6 +1444,7 @@ int list_wizard_commands(bool do_redraw_screen)
                        jtransln("<w>Ctrl-F</w> double scale fsim\n") +
                        jtransln("<w>Ctrl-I</w> item generation stats\n") +
                        jtransln("<w>O</w>      measure exploration time\n") +
+                       jtransln("<w>E</w>      profile turn phases\n") +
                        jtransln("<w>Ctrl-T</w> dungeon (D)Lua interpreter\n") +
                        jtransln("<w>Ctrl-U</w> client (C)Lua interpreter\n") +
                        jtransln("<w>Ctrl-X</w> Xom effect stats\n") +
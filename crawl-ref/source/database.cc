@@ -9,6 +9,7 @@
 
 #include <cstdlib>
 #include <fcntl.h>
+#include <numeric>
 #include <sys/stat.h>
 #include <sys/types.h>
 #ifndef TARGET_COMPILER_VC
@@ -16,6 +17,8 @@
 #endif
 
 #include "clua.h"
+#include "dbimage.h"
+#include "dbsearch.h"
 #include "end.h"
 #include "files.h"
 #include "libutil.h"
@@ -38,11 +41,8 @@ public:
     ~TextDB() { shutdown(true); delete translation; }
     void init();
     void shutdown(bool recursive = false);
-    DBM* get() { return _db; }
-
-    // Make it easier to migrate from raw DBM* to TextDB
-    operator bool() const { return _db != 0; }
-    operator DBM*() const { return _db; }
+    const db_image* get() const { return _db; }
+    const db_image* search_index() const { return _index; }
 
  private:
     bool _needs_update() const;
@@ -53,21 +53,24 @@ public:
     const char* const _db_name;
     string _directory;
     vector<string> _input_files;
-    DBM* _db;
+    db_image* _db;
+    db_image* _index;
     string timestamp;
     TextDB *_parent;
     const char* lang() { return _parent ? Options.lang_name : 0; }
 public:
     TextDB *translation;
+    // Whether to keep a search index for regex searches.
+    bool indexed;
 };
 
 // Convenience functions for (read-only) access to generic
 // berkeley DB databases.
-static void _store_text_db(const string &in, DBM *db);
+static void _store_text_db(const string &in, db_image_writer &db);
 
 static string _query_database(TextDB &db, string key, bool canonicalise_key,
                               bool run_lua, bool untranslated = false);
-static void _add_entry(DBM *db, const string &k, string &v);
+static void _add_entry(db_image_writer &db, const string &k, string &v);
 
 static TextDB AllDBs[] =
 {
@@ -224,13 +227,24 @@ static string _db_cache_path(string db, const char *lang)
     return savedir_versioned_path("db/" + db);
 }
 
+static string _db_image_path(const string &db_path)
+{
+    return db_path + ".img";
+}
+
+static string _db_index_path(const string &db_path)
+{
+    return db_path + ".search.img";
+}
+
 // ----------------------------------------------------------------------
 // TextDB
 // ----------------------------------------------------------------------
 
 TextDB::TextDB(const char* db_name, const char* dir, ...)
     : _db_name(db_name), _directory(dir),
-      _db(nullptr), timestamp(""), _parent(0), translation(0)
+      _db(nullptr), _index(nullptr), timestamp(""), _parent(0),
+      translation(0), indexed(false)
 {
     va_list args;
     va_start(args, dir);
@@ -250,7 +264,8 @@ TextDB::TextDB(const char* db_name, const char* dir, ...)
 
 TextDB::TextDB(TextDB *parent)
     : _db_name(parent->_db_name),
-      _db(nullptr), timestamp(""), _parent(parent), translation(0)
+      _db(nullptr), _index(nullptr), timestamp(""), _parent(parent),
+      translation(0), indexed(parent->indexed)
 {
     _directory = parent->_directory + Options.lang_name + "/";
     _input_files = parent->_input_files; // FIXME: pointless copy
@@ -261,15 +276,32 @@ bool TextDB::open_db()
     if (_db)
         return true;
 
-    const string full_db_path = _db_cache_path(_db_name, lang());
-    _db = dbm_open(full_db_path.c_str(), O_RDONLY, 0660);
-    if (!_db)
+    const string db_path = _db_cache_path(_db_name, lang());
+    _db = new db_image;
+    if (!_db->open(_db_image_path(db_path)))
+    {
+        shutdown();
         return false;
+    }
 
     timestamp = _query_database(*this, "TIMESTAMP", false, false, true);
     if (timestamp.empty())
         return false;
 
+    if (indexed)
+    {
+        // An index left over from another build would be missing entries
+        // or point at the wrong ones, so rebuild both.
+        _index = new db_image;
+        if (!_index->open(_db_index_path(db_path))
+            || !db_search_index_current(*_index, *_db, timestamp))
+        {
+            shutdown();
+            timestamp.clear();
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -296,11 +328,10 @@ void TextDB::init()
 
 void TextDB::shutdown(bool recursive)
 {
-    if (_db)
-    {
-        dbm_close(_db);
-        _db = nullptr;
-    }
+    delete _db;
+    _db = nullptr;
+    delete _index;
+    _index = nullptr;
     if (recursive && translation)
         translation->shutdown(recursive);
 }
@@ -351,7 +382,7 @@ void TextDB::_regenerate_db()
 #endif
 
     string db_path = _db_cache_path(_db_name, lang());
-    string full_db_path = db_path + ".db";
+    string full_db_path = _db_image_path(db_path);
 
     {
         string output_dir = get_parent_directory(db_path);
@@ -360,13 +391,16 @@ void TextDB::_regenerate_db()
     }
 
     file_lock lock(db_path + ".lk", "wb");
-#ifndef DGL_REWRITE_PROTECT_DB_FILES
-    unlink_u(full_db_path.c_str());
-#endif
 
+    // Someone else may have rebuilt the image while we waited for the lock.
+    if (open_db() && !_needs_update())
+        return;
+    shutdown();
+
+    // The new image is renamed over the old one, so processes that have
+    // the old one open keep reading it undisturbed.
+    db_image_writer db;
     string ts;
-    if (!(_db = dbm_open(db_path.c_str(), O_RDWR | O_CREAT, 0660)))
-        end(1, true, "Unable to open DB: %s", db_path.c_str());
     for (const string &file : _input_files)
     {
         string full_input_path = _directory + file;
@@ -383,13 +417,24 @@ void TextDB::_regenerate_db()
 #endif
             || !_parent) // english is mandatory
         {
-            _store_text_db(full_input_path, _db);
+            _store_text_db(full_input_path, db);
         }
     }
-    _add_entry(_db, "TIMESTAMP", ts);
+    _add_entry(db, "TIMESTAMP", ts);
+
+    if (!db.write(full_db_path))
+        end(1, true, "Unable to write DB: %s", full_db_path.c_str());
 
-    dbm_close(_db);
-    _db = 0;
+    if (indexed)
+    {
+        const string index_path = _db_index_path(db_path);
+        db_image image;
+        if (!image.open(full_db_path)
+            || !write_db_search_index(image, ts, index_path))
+        {
+            end(1, true, "Unable to write DB index: %s", index_path.c_str());
+        }
+    }
 }
 
 // ----------------------------------------------------------------------
@@ -408,10 +453,8 @@ static void* init_db(void *arg)
 
 void databaseSystemInit()
 {
-    // Note: if you're building contrib libraries initially checked out
-    // before 2011-12-28 and this assertion fails, please make sure you have
-    // the current version ("git submodule sync;git submodule update --init").
-    ASSERT(sqlite3_threadsafe());
+    // ?/ searches the descriptions by regex.
+    DescriptionDB.indexed = true;
 
     thread_t th[NUM_DB];
     for (unsigned int i = 0; i < NUM_DB; i++)
@@ -440,24 +483,39 @@ void databaseSystemShutdown()
 ////////////////////////////////////////////////////////////////////////////
 // Main DB functions
 
-static datum _database_fetch(DBM *database, const string &key)
+static string _database_fetch(const db_image *database, const string &key)
 {
-    datum result;
-    result.dptr = nullptr;
-    result.dsize = 0;
-    datum dbKey;
-
-    dbKey.dptr = (DPTR_COERCE) key.c_str();
-    dbKey.dsize = key.length();
+    const char *value;
+    size_t size;
 
     // Don't use the database if called from "monster".
-    if (database)
-        result = dbm_fetch(database, dbKey);
+    if (database && database->fetch(key, value, size))
+        return string(value, size);
+
+    return "";
+}
+
+// The entries of database which might match regex.
+static vector<uint32_t> _database_search(const db_image *database,
+                                         const db_image *index,
+                                         const string &regex,
+                                         bool ignore_case,
+                                         db_search_field field)
+{
+    vector<uint32_t> entries;
+    if (index
+        && db_search_candidates(*index, regex, ignore_case, field, entries))
+    {
+        return entries;
+    }
 
-    return result;
+    entries.resize(database->size());
+    iota(entries.begin(), entries.end(), 0);
+    return entries;
 }
 
-static vector<string> _database_find_keys(DBM *database,
+static vector<string> _database_find_keys(const db_image *database,
+                                          const db_image *index,
                                           const string &regex,
                                           bool ignore_case,
                                           db_find_filter filter = nullptr)
@@ -465,11 +523,10 @@ static vector<string> _database_find_keys(DBM *database,
     text_pattern             tpat(regex, ignore_case);
     vector<string> matches;
 
-    datum dbKey = dbm_firstkey(database);
-
-    while (dbKey.dptr != nullptr)
+    for (uint32_t i : _database_search(database, index, regex, ignore_case,
+                                       DB_SEARCH_KEYS))
     {
-        string key((const char *)dbKey.dptr, dbKey.dsize);
+        string key = database->key(i);
 
         if (tpat.matches(key)
             && key.find("__") == string::npos
@@ -477,14 +534,13 @@ static vector<string> _database_find_keys(DBM *database,
         {
             matches.push_back(key);
         }
-
-        dbKey = dbm_nextkey(database);
     }
 
     return matches;
 }
 
-static vector<string> _database_find_bodies(DBM *database,
+static vector<string> _database_find_bodies(const db_image *database,
+                                            const db_image *index,
                                             const string &regex,
                                             bool ignore_case,
                                             db_find_filter filter = nullptr)
@@ -492,14 +548,11 @@ static vector<string> _database_find_bodies(DBM *database,
     text_pattern             tpat(regex, ignore_case);
     vector<string> matches;
 
-    datum dbKey = dbm_firstkey(database);
-
-    while (dbKey.dptr != nullptr)
+    for (uint32_t i : _database_search(database, index, regex, ignore_case,
+                                       DB_SEARCH_BODIES))
     {
-        string key((const char *)dbKey.dptr, dbKey.dsize);
-
-        datum dbBody = dbm_fetch(database, dbKey);
-        string body((const char *)dbBody.dptr, dbBody.dsize);
+        string key = database->key(i);
+        string body = database->value(i);
 
         if (tpat.matches(body)
             && key.find("__") == string::npos
@@ -507,8 +560,6 @@ static vector<string> _database_find_bodies(DBM *database,
         {
             matches.push_back(key);
         }
-
-        dbKey = dbm_nextkey(database);
     }
 
     return matches;
@@ -555,21 +606,13 @@ static void _trim_leading_newlines(string &s)
     s.erase(0, s.find_first_not_of("\n"));
 }
 
-static void _add_entry(DBM *db, const string &k, string &v)
+static void _add_entry(db_image_writer &db, const string &k, string &v)
 {
     _trim_leading_newlines(v);
-    datum key, value;
-    key.dptr = (char *) k.c_str();
-    key.dsize = k.length();
-
-    value.dptr = (char *) v.c_str();
-    value.dsize = v.length();
-
-    if (dbm_store(db, key, value, DBM_REPLACE))
-        end(1, true, "Error storing %s", k.c_str());
+    db.add(k, v);
 }
 
-static void _parse_text_db(LineInput &inf, DBM *db)
+static void _parse_text_db(LineInput &inf, db_image_writer &db)
 {
     string key;
     string value;
@@ -612,7 +655,7 @@ static void _parse_text_db(LineInput &inf, DBM *db)
         _add_entry(db, key, value);
 }
 
-static void _store_text_db(const string &in, DBM *db)
+static void _store_text_db(const string &in, db_image_writer &db)
 {
     UTF8FileLineInput inf(in.c_str());
     if (inf.error())
@@ -692,14 +735,14 @@ static string _getWeightedString(TextDB &db, const string &key,
     lowercase(canonical_key);
 
     // Query the DB.
-    datum result;
+    string str;
 
     if (db.translation)
-        result = _database_fetch(db.translation->get(), canonical_key);
-    if (result.dsize <= 0)
-        result = _database_fetch(db.get(), canonical_key);
+        str = _database_fetch(db.translation->get(), canonical_key);
+    if (str.empty())
+        str = _database_fetch(db.get(), canonical_key);
 
-    if (result.dsize <= 0)
+    if (str.empty())
     {
         // Try ignoring the suffix.
         canonical_key = key;
@@ -707,17 +750,14 @@ static string _getWeightedString(TextDB &db, const string &key,
 
         // Query the DB.
         if (db.translation)
-            result = _database_fetch(db.translation->get(), canonical_key);
-        if (result.dsize <= 0)
-            result = _database_fetch(db.get(), canonical_key);
+            str = _database_fetch(db.translation->get(), canonical_key);
+        if (str.empty())
+            str = _database_fetch(db.get(), canonical_key);
 
-        if (result.dsize <= 0)
+        if (str.empty())
             return "";
     }
 
-    // Cons up a (C++) string to return.  The caller must release it.
-    string str = string((const char *)result.dptr, result.dsize);
-
     return _chooseStrByWeight(str, fixed_weight);
 }
 
@@ -806,18 +846,16 @@ static string _query_database(TextDB &db, string key, bool canonicalise_key,
     }
 
     // Query the DB.
-    datum result;
+    string str;
 
     if (db.translation && !untranslated)
-        result = _database_fetch(db.translation->get(), key);
-    if (result.dsize <= 0)
-        result = _database_fetch(db.get(), key);
+        str = _database_fetch(db.translation->get(), key);
+    if (str.empty())
+        str = _database_fetch(db.get(), key);
 
-    if (result.dsize <= 0)
+    if (str.empty())
         return "";
 
-    string str((const char *)result.dptr, result.dsize);
-
     // <foo> is an alias to key foo
     if (str[0] == '<' && str[str.size() - 2] == '>'
         && str.find('<', 1) == str.npos
@@ -860,7 +898,9 @@ vector<string> getLongDescKeysByRegex(const string &regex,
 
     // FIXME: need to match regex against translated keys, which can't
     // be done by db only.
-    return _database_find_keys(DescriptionDB.get(), regex, true, filter);
+    return _database_find_keys(DescriptionDB.get(),
+                               DescriptionDB.search_index(), regex, true,
+                               filter);
 }
 
 vector<string> getLongDescBodiesByRegex(const string &regex,
@@ -875,10 +915,31 @@ vector<string> getLongDescBodiesByRegex(const string &regex,
     // On partial translations, this will match only translated descriptions.
     // Not good, but otherwise we'd have to check hundreds of keys, with
     // two queries for each.
-    // SQL can do this in one go, DBM can't.
-    DBM *database = DescriptionDB.translation ?
-        DescriptionDB.translation->get() : DescriptionDB.get();
-    return _database_find_bodies(database, regex, true, filter);
+    const TextDB &db = DescriptionDB.translation ? *DescriptionDB.translation
+                                                 : DescriptionDB;
+    return _database_find_bodies(db.get(), db.search_index(), regex, true,
+                                 filter);
+}
+
+// Does searching the descriptions through their index find the same as
+// scanning them all? For the tests.
+bool checkLongDescSearch(const string &regex)
+{
+    for (const TextDB *db : { &DescriptionDB, DescriptionDB.translation })
+    {
+        if (!db || !db->get())
+            continue;
+
+        if (_database_find_keys(db->get(), db->search_index(), regex, true)
+                != _database_find_keys(db->get(), nullptr, regex, true)
+            || _database_find_bodies(db->get(), db->search_index(), regex,
+                                     true)
+               != _database_find_bodies(db->get(), nullptr, regex, true))
+        {
+            return false;
+        }
+    }
+    return true;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -951,7 +1012,8 @@ vector<string> getAllFAQKeys()
         return empty;
     }
 
-    return _database_find_keys(FAQDB.get(), "^q.+", false);
+    return _database_find_keys(FAQDB.get(), FAQDB.search_index(), "^q.+",
+                               false);
 }
 
 string getFAQ_Question(const string &key)
@@ -0,0 +1,545 @@
+/**
+ * @file
+ * @brief Micro-benchmarks of game internals.
+ *
+ * Each benchmark runs on levels generated as by mapstat, so that its
+ * results are repeatable with -seed; -iters sets the number of levels.
+**/
+
+#include "AppHdr.h"
+
+#include "dbg-bench.h"
+
+#include <chrono>
+#include <cstring>
+#if defined(USE_CURSES) && !defined(USE_TILE)
+#include <sys/stat.h>
+#endif
+
+#include "branch.h"
+#include "cloud.h"
+#include "colour.h"
+#include "coord.h"
+#include "coordit.h"
+#include "dungeon.h"
+#include "end.h"
+#include "initfile.h"
+#include "items.h"
+#include "libutil.h"
+#include "los.h"
+#include "losglobal.h"
+#include "maps.h"
+#include "message.h"
+#include "ng-init.h"
+#include "player.h"
+#include "random.h"
+#include "showsymb.h"
+#include "shout.h"
+#include "stringutil.h"
+#include "terrain.h"
+#include "unwind.h"
+#include "view.h"
+
+#ifdef DEBUG_STATISTICS
+
+uint64_t bench_now_ns()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void bench_init()
+{
+    // Same setup as mapstat.
+    you.wizard = true;
+    you.species = SP_HUMAN;
+
+    initialise_item_descriptions();
+    initialise_branch_depths();
+    run_map_global_preludes();
+    run_map_local_preludes();
+}
+
+// Build the i-th level of the run, cycling through the main Dungeon. The
+// per-game state is reset at the start of every cycle, as mapstat does.
+bool bench_build_level(int i)
+{
+    const int depth = i % brdepth[BRANCH_DUNGEON] + 1;
+    if (depth == 1)
+    {
+        dlua.callfn("dgn_clear_data", "");
+        you.uniq_map_tags.clear();
+        you.uniq_map_names.clear();
+        you.unique_creatures.reset();
+        initialise_branch_depths();
+        init_level_connectivity();
+    }
+
+    you.where_are_you = BRANCH_DUNGEON;
+    you.depth = depth;
+
+    clear_messages();
+    if (!builder())
+        return false;
+
+    // Leave map knowledge as a player who has seen the whole level would.
+    unwind_bool wiz(you.wizard, true);
+    magic_mapping(1000, 100, true, true, false, coord_def(GXM/2, GYM/2));
+    return true;
+}
+
+// How often losight() is run from each cell, to get measurable times.
+#define LOS_BENCH_REPS 5
+
+/**
+ * Time losight() with each kernel this CPU supports.
+ *
+ * Runs losight() from every non-solid cell of each level, and checks
+ * that all kernels agree with the scalar one.
+ */
+static void _bench_los()
+{
+    const los_kernel_type default_kernel = get_los_kernel();
+    uint64_t ns[NUM_LOS_KERNELS] = { 0 };
+    uint64_t calls = 0;
+
+    for (int i = 0; i < SysEnv.map_gen_iters; ++i)
+    {
+        if (!bench_build_level(i))
+            continue;
+
+        vector<coord_def> centres;
+        for (rectangle_iterator ri(0); ri; ++ri)
+            if (!cell_is_solid(*ri))
+                centres.push_back(*ri);
+
+        vector<los_grid> reference(centres.size());
+        for (int k = 0; k < NUM_LOS_KERNELS; ++k)
+        {
+            const los_kernel_type kernel = static_cast<los_kernel_type>(k);
+            if (!los_kernel_supported(kernel))
+                continue;
+            set_los_kernel(kernel);
+
+            los_grid sh;
+            const uint64_t start = bench_now_ns();
+            for (int rep = 0; rep < LOS_BENCH_REPS; ++rep)
+                for (unsigned int c = 0; c < centres.size(); ++c)
+                {
+                    losight(sh, centres[c]);
+                    if (rep)
+                        continue;
+                    if (kernel == LOS_KERNEL_SCALAR)
+                        reference[c] = sh;
+                    else if (memcmp(&sh, &reference[c], sizeof(sh)))
+                    {
+                        die("LOS kernel %s disagrees with %s at %d,%d",
+                            los_kernel_name(kernel),
+                            los_kernel_name(LOS_KERNEL_SCALAR),
+                            centres[c].x, centres[c].y);
+                    }
+                }
+            ns[k] += bench_now_ns() - start;
+        }
+        calls += centres.size() * LOS_BENCH_REPS;
+    }
+    set_los_kernel(default_kernel);
+
+    printf("%-8s %10s %8s\n", "kernel", "ns/call", "speedup");
+    for (int k = 0; k < NUM_LOS_KERNELS; ++k)
+    {
+        const los_kernel_type kernel = static_cast<los_kernel_type>(k);
+        if (!los_kernel_supported(kernel) || !calls)
+            continue;
+        printf("%-8s %10.0f %7.2fx%s\n", los_kernel_name(kernel),
+               (double)ns[k] / calls, (double)ns[LOS_KERNEL_SCALAR] / ns[k],
+               kernel == default_kernel ? " (default)" : "");
+    }
+}
+
+// Monster positions sampled per level, and door toggles per level.
+#define GLOBALLOS_BENCH_CELLS 200
+#define GLOBALLOS_BENCH_TOGGLES 500
+
+/**
+ * Time cell_see_cell() queries with doors opening and closing.
+ *
+ * Between door toggles, every pair of sampled cells within LOS range is
+ * queried, as monsters looking for foes would. Debug builds also report
+ * the global LOS table's hit and miss counts.
+ */
+static void _bench_globallos()
+{
+    uint64_t ns = 0, queries = 0;
+#ifdef DEBUG_DIAGNOSTICS
+    reset_globallos_stats();
+#endif
+
+    for (int i = 0; i < SysEnv.map_gen_iters; ++i)
+    {
+        if (!bench_build_level(i))
+            continue;
+
+        vector<coord_def> cells, doors;
+        for (rectangle_iterator ri(0); ri; ++ri)
+        {
+            if (feat_is_door(grd(*ri)))
+                doors.push_back(*ri);
+            else if (!cell_is_solid(*ri))
+                cells.push_back(*ri);
+        }
+        if (doors.empty() || cells.empty())
+            continue;
+        shuffle_array(cells);
+        if (cells.size() > GLOBALLOS_BENCH_CELLS)
+            cells.resize(GLOBALLOS_BENCH_CELLS);
+
+        los_changed();
+        const uint64_t start = bench_now_ns();
+        for (int t = 0; t < GLOBALLOS_BENCH_TOGGLES; ++t)
+        {
+            for (const coord_def &a : cells)
+                for (const coord_def &b : cells)
+                {
+                    if ((a - b).abs() > LOS_RADIUS_SQ)
+                        continue;
+                    cell_see_cell(a, b, LOS_DEFAULT);
+                    ++queries;
+                }
+
+            const coord_def door = doors[random2(doors.size())];
+            grd(door) = feat_is_closed_door(grd(door)) ? DNGN_OPEN_DOOR
+                                                       : DNGN_CLOSED_DOOR;
+            los_terrain_changed(door);
+        }
+        ns += bench_now_ns() - start;
+    }
+
+    printf("%" PRIu64 " queries, %.0f ns/query\n", queries,
+           queries ? (double)ns / queries : 0.0);
+#ifdef DEBUG_DIAGNOSTICS
+    const globallos_stats &stats = get_globallos_stats();
+    printf("hits %" PRIu64 ", misses %" PRIu64 ", invalidations %" PRIu64
+           ", entries forgotten %" PRIu64 "\n",
+           stats.hits, stats.misses, stats.invalidations, stats.forgotten);
+#endif
+}
+
+// Noisy cells per level, and turns of noise per level.
+#define NOISE_BENCH_SOURCES 30
+#define NOISE_BENCH_TURNS 200
+
+/**
+ * Time apply_noises() with many noises each turn.
+ *
+ * Noises of random loudness are made at a fixed set of cells on each
+ * level, as in a fight with a crowd of shouting monsters. The monsters
+ * on the level hear them as usual.
+ */
+static void _bench_noise()
+{
+    uint64_t ns = 0, turns = 0;
+
+    for (int i = 0; i < SysEnv.map_gen_iters; ++i)
+    {
+        if (!bench_build_level(i))
+            continue;
+
+        vector<coord_def> cells;
+        for (rectangle_iterator ri(0); ri; ++ri)
+            if (!cell_is_solid(*ri))
+                cells.push_back(*ri);
+        if (cells.empty())
+            continue;
+        shuffle_array(cells);
+        if (cells.size() > NOISE_BENCH_SOURCES)
+            cells.resize(NOISE_BENCH_SOURCES);
+
+        for (int t = 0; t < NOISE_BENCH_TURNS; ++t)
+        {
+            for (const coord_def &c : cells)
+                noisy(random_range(4, 20), c);
+
+            const uint64_t start = bench_now_ns();
+            apply_noises();
+            ns += bench_now_ns() - start;
+            ++turns;
+        }
+        clear_messages();
+    }
+
+    printf("%" PRIu64 " turns of %d noises, %.0f ns/turn\n", turns,
+           NOISE_BENCH_SOURCES, turns ? (double)ns / turns : 0.0);
+}
+
+struct cloud_bench_scenario
+{
+    const char *name;
+    cloud_type type;
+    int lifetime;
+    int spread_rate;
+};
+
+static const cloud_bench_scenario cloud_scenarios[] =
+{
+    // Steam comes off fire near water.
+    { "fire", CLOUD_FIRE, 10, -1 },
+    { "mephitic", CLOUD_MEPHITIC, 15, 33 },
+    { "storm", CLOUD_STORM, 20, -1 },
+    // Tornado refreshes a great many short-lived clouds every turn.
+    { "tornado", CLOUD_TORNADO, 1, -1 },
+};
+
+// Clouds made per turn, and turns per scenario and level.
+#define CLOUD_BENCH_PER_TURN 40
+#define CLOUD_BENCH_TURNS 100
+
+/**
+ * Time manage_clouds() in heavy cloud fights.
+ *
+ * For each scenario, clouds of one type are made at random cells of each
+ * level every turn, and left to decay and spread.
+ */
+static void _bench_clouds()
+{
+    const int nscen = ARRAYSZ(cloud_scenarios);
+    vector<uint64_t> ns(nscen), clouds(nscen), turns(nscen);
+    unwind_var<int> time_taken(you.time_taken, BASELINE_DELAY);
+
+    for (int i = 0; i < SysEnv.map_gen_iters; ++i)
+    {
+        if (!bench_build_level(i))
+            continue;
+
+        vector<coord_def> cells;
+        for (rectangle_iterator ri(1); ri; ++ri)
+            if (!cell_is_solid(*ri))
+                cells.push_back(*ri);
+        if (cells.empty())
+            continue;
+
+        for (int s = 0; s < nscen; ++s)
+        {
+            const cloud_bench_scenario &scen = cloud_scenarios[s];
+            for (int t = 0; t < CLOUD_BENCH_TURNS; ++t)
+            {
+                for (int c = 0; c < CLOUD_BENCH_PER_TURN; ++c)
+                {
+                    check_place_cloud(scen.type,
+                                      cells[random2(cells.size())],
+                                      scen.lifetime, nullptr,
+                                      scen.spread_rate);
+                }
+
+                const uint64_t start = bench_now_ns();
+                manage_clouds();
+                ns[s] += bench_now_ns() - start;
+                clouds[s] += env.cloud_no;
+                ++turns[s];
+
+                // Storms make noise; don't let it pile up.
+                apply_noises();
+            }
+
+            const vector<int> left = env.active_clouds;
+            for (int cl : left)
+                delete_cloud(cl);
+            clear_messages();
+        }
+    }
+
+    printf("%-10s %10s %8s\n", "scenario", "ns/turn", "clouds");
+    for (int s = 0; s < nscen; ++s)
+    {
+        if (!turns[s])
+            continue;
+        printf("%-10s %10.0f %8.0f\n", cloud_scenarios[s].name,
+               (double)ns[s] / turns[s], (double)clouds[s] / turns[s]);
+    }
+}
+
+#if defined(USE_CURSES) && !defined(USE_TILE)
+// Frames of the view per level. The player moves every few frames, and a
+// few monsters around them every frame.
+#define PUTTEXT_BENCH_FRAMES 300
+#define PUTTEXT_BENCH_MOVE_EVERY 4
+#define PUTTEXT_BENCH_MONSTERS 4
+
+struct trace_cell
+{
+    ucs_t glyph;
+    unsigned short colour;
+};
+
+typedef vector<trace_cell> view_frame;
+
+// Roughly what viewwindow() draws with the player at pos: the remembered
+// map around them, and some monsters nearby.
+static view_frame _view_frame_at(const coord_def &pos)
+{
+    const coord_def sz = crawl_view.viewsz;
+    const coord_def half(sz.x / 2, sz.y / 2);
+    view_frame frame(sz.x * sz.y);
+
+    for (int y = 0; y < sz.y; ++y)
+        for (int x = 0; x < sz.x; ++x)
+        {
+            const coord_def gc = pos + coord_def(x, y) - half;
+            trace_cell &tc = frame[y * sz.x + x];
+            if (!map_bounds(gc))
+            {
+                tc.glyph = ' ';
+                tc.colour = DARKGREY;
+                continue;
+            }
+            const cglyph_t g = get_cell_glyph(gc);
+            tc.glyph = g.ch;
+            tc.colour = g.col;
+        }
+
+    for (int m = 0; m < PUTTEXT_BENCH_MONSTERS; ++m)
+    {
+        const coord_def v = half + coord_def(random_range(-7, 7),
+                                             random_range(-7, 7));
+        trace_cell &tc = frame[v.y * sz.x + v.x];
+        tc.glyph = 'a' + random2(26);
+        tc.colour = random_colour();
+    }
+
+    trace_cell &player = frame[half.y * sz.x + half.x];
+    player.glyph = '@';
+    player.colour = WHITE;
+    return frame;
+}
+
+static off_t _file_size(FILE *file)
+{
+    struct stat st;
+    fflush(file);
+    return fstat(fileno(file), &st) ? 0 : st.st_size;
+}
+
+/**
+ * Time writing the view to the terminal, with and without puttext()'s
+ * shadow screen.
+ *
+ * A trace of views is made by walking the player about each level, then
+ * written through curses to a temporary file, which gives the bytes that
+ * would have gone to the terminal.
+ */
+static void _bench_puttext()
+{
+    FILE *out = tmpfile();
+    if (!console_startup_headless(out, 80, 24))
+        end(1, true, "Can't start curses for the benchmark");
+
+    vector<view_frame> trace;
+    for (int i = 0; i < SysEnv.map_gen_iters; ++i)
+    {
+        if (!bench_build_level(i))
+            continue;
+
+        vector<coord_def> cells;
+        for (rectangle_iterator ri(1); ri; ++ri)
+            if (!cell_is_solid(*ri))
+                cells.push_back(*ri);
+        if (cells.empty())
+            continue;
+
+        coord_def pos = cells[random2(cells.size())];
+        for (int f = 0; f < PUTTEXT_BENCH_FRAMES; ++f)
+        {
+            if (f % PUTTEXT_BENCH_MOVE_EVERY == 0)
+            {
+                const coord_def next = pos + coord_def(random_range(-1, 1),
+                                                       random_range(-1, 1));
+                if (in_bounds(next) && !cell_is_solid(next))
+                    pos = next;
+            }
+            trace.push_back(_view_frame_at(pos));
+        }
+    }
+    if (trace.empty())
+        return;
+
+    crawl_view_buffer vbuf;
+    vbuf.resize(crawl_view.viewsz);
+
+    printf("%-8s %10s %10s %10s %10s %10s\n", "output", "ns/frame",
+           "bytes", "cells", "moves", "colours");
+    for (int shadow = 0; shadow < 2; ++shadow)
+    {
+        puttext_set_shadow(shadow);
+        puttext_stats &stats = get_puttext_stats();
+        stats = puttext_stats();
+        const off_t start_bytes = _file_size(out);
+
+        uint64_t ns = 0;
+        for (const view_frame &frame : trace)
+        {
+            screen_cell_t *cell = vbuf;
+            for (const trace_cell &tc : frame)
+            {
+                cell->glyph = tc.glyph;
+                cell->colour = tc.colour;
+                cell->flash_colour = BLACK;
+                cell++;
+            }
+
+            const uint64_t start = bench_now_ns();
+            puttext(crawl_view.viewp.x, crawl_view.viewp.y, vbuf);
+            ns += bench_now_ns() - start;
+        }
+
+        const double frames = trace.size();
+        printf("%-8s %10.0f %10.1f %10.1f %10.1f %10.1f\n",
+               shadow ? "shadow" : "full", ns / frames,
+               (_file_size(out) - start_bytes) / frames,
+               stats.cells / frames, stats.moves / frames,
+               stats.colours / frames);
+    }
+    puttext_set_shadow(true);
+}
+#endif
+
+struct benchmark
+{
+    const char *name;
+    const char *description;
+    void (*run)();
+};
+
+static const benchmark benchmarks[] =
+{
+    { "los", "losight() with each LOS kernel", _bench_los },
+    { "globallos", "cell_see_cell() with changing doors", _bench_globallos },
+    { "noise", "apply_noises() with many noises each turn", _bench_noise },
+    { "clouds", "manage_clouds() in heavy cloud fights", _bench_clouds },
+#if defined(USE_CURSES) && !defined(USE_TILE)
+    { "puttext", "terminal output of the view", _bench_puttext },
+#endif
+};
+
+void bench_run(const string &name)
+{
+    for (const benchmark &bench : benchmarks)
+    {
+        if (name != bench.name)
+            continue;
+
+        bench_init();
+        printf("Benchmarking %s over %d level(s).\n", bench.description,
+               SysEnv.map_gen_iters);
+        fflush(stdout);
+        bench.run();
+        return;
+    }
+
+    vector<string> names;
+    for (const benchmark &bench : benchmarks)
+        names.push_back(bench.name);
+    end(1, false, "Unknown benchmark '%s'; choose from: %s", name.c_str(),
+        comma_separated_line(names.begin(), names.end(), ", ").c_str());
+}
+
+#endif // DEBUG_STATISTICS
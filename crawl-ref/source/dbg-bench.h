@@ -0,0 +1,16 @@
+/**
+ * @file
+ * @brief Micro-benchmarks of game internals.
+**/
+
+#ifndef DBGBENCH_H
+#define DBGBENCH_H
+
+#ifdef DEBUG_STATISTICS
+void bench_init();
+bool bench_build_level(int i);
+uint64_t bench_now_ns();
+void bench_run(const string &name);
+#endif
+
+#endif
@@ -7,18 +7,27 @@
 
 #include "dbg-maps.h"
 
+#ifndef TARGET_OS_WINDOWS
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+
 #include "branch.h"
 #include "chardump.h"
 #include "crash.h"
+#include "dbg-bench.h"
 #include "dbg-objstat.h"
 #include "dungeon.h"
+#include "end.h"
 #include "env.h"
 #include "initfile.h"
 #include "libutil.h"
 #include "maps.h"
 #include "message.h"
 #include "ng-init.h"
+#include "options.h"
 #include "player.h"
+#include "random.h"
 #include "shopping.h"
 #include "state.h"
 #include "stringutil.h"
@@ -45,6 +54,27 @@ static int build_attempts = 0, level_vetoes = 0;
 // Map from message to counts.
 static map<string, int> veto_messages;
 
+// Wall time spent in some part of level generation.
+struct gen_timing
+{
+    int count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+
+    void add(int n, uint64_t total, uint64_t longest)
+    {
+        count += n;
+        total_ns += total;
+        max_ns = max(max_ns, longest);
+    }
+};
+
+// For -levelgen: builder() calls and failures by level, and vault_main()
+// by map.
+static map<level_id, gen_timing> level_times;
+static map<level_id, int> level_failures;
+static map<string, gen_timing> map_times;
+
 void mapstat_report_map_build_start()
 {
     build_attempts++;
@@ -204,28 +234,43 @@ static void _dungeon_places()
     }
 }
 
-static bool _build_dungeon()
+static void _go_to_level(const level_id &lid)
 {
-    for (int i = 0, size = generated_levels.size(); i < size; ++i)
-    {
-        const level_id &lid = generated_levels[i];
-        you.where_are_you = lid.branch;
-        you.depth = lid.depth;
+    you.where_are_you = lid.branch;
+    you.depth = lid.depth;
 
 #if TAG_MAJOR_VERSION == 34
-        // An unholy hack, FIXME!
-        if (!brentry[BRANCH_FOREST].is_valid()
-            && lid.branch == BRANCH_FOREST && lid.depth == 5)
-        {
-            you.unique_creatures.set(MONS_THE_ENCHANTRESS, false);
-        }
+    // An unholy hack, FIXME!
+    if (!brentry[BRANCH_FOREST].is_valid()
+        && lid.branch == BRANCH_FOREST && lid.depth == 5)
+    {
+        you.unique_creatures.set(MONS_THE_ENCHANTRESS, false);
+    }
 #endif
+}
+
+static bool _build_dungeon()
+{
+    for (int i = 0, size = generated_levels.size(); i < size; ++i)
+    {
+        _go_to_level(generated_levels[i]);
         if (!_do_build_level())
             return false;
     }
     return true;
 }
 
+// Forget the previous dungeon's uniques and branch layout.
+static void _reset_dungeon()
+{
+    dlua.callfn("dgn_clear_data", "");
+    you.uniq_map_tags.clear();
+    you.uniq_map_names.clear();
+    you.unique_creatures.reset();
+    initialise_branch_depths();
+    init_level_connectivity();
+}
+
 /**
  * Build dungeon levels for mapstat or objstat.
  *
@@ -257,12 +302,7 @@ bool mapstat_build_levels()
              build_attempts ? level_vetoes * 100.0 / build_attempts : 0.0);
         printf("%d..", i + 1);
         fflush(stdout);
-        dlua.callfn("dgn_clear_data", "");
-        you.uniq_map_tags.clear();
-        you.uniq_map_names.clear();
-        you.unique_creatures.reset();
-        initialise_branch_depths();
-        init_level_connectivity();
+        _reset_dungeon();
         if (!_build_dungeon())
             return false;
         if (crawl_state.obj_stat_gen)
@@ -278,6 +318,11 @@ void mapstat_report_map_try(const map_def &map)
     try_count[map.name]++;
 }
 
+void mapstat_report_map_time(const map_def &map, uint64_t ns)
+{
+    map_times[map.name].add(1, ns, ns);
+}
+
 void mapstat_report_map_use(const map_def &map)
 {
     use_count[map.name]++;
@@ -478,7 +523,7 @@ static void _write_map_stats()
     printf("\n");
 }
 
-void mapstat_generate_stats()
+static void _prepare_levelgen()
 {
     // Warn assertions about possible oddities like the artefact list being
     // cleared.
@@ -493,6 +538,11 @@ void mapstat_generate_stats()
     run_map_local_preludes();
 
     _dungeon_places();
+}
+
+void mapstat_generate_stats()
+{
+    _prepare_levelgen();
     clear_messages();
     mpr("Generating dungeon map stats");
     printf("Generating map stats for %d iteration(s) of %d level(s) over "
@@ -506,4 +556,249 @@ void mapstat_generate_stats()
     printf("Map stats complete.\n");
 }
 
+// Level generation throughput: -levelgen.
+
+// Build dungeons first..last-1, seeding dungeon i with seed + i so that
+// the results don't depend on how the dungeons are split between jobs.
+static void _levelgen_worker(int first, int last, uint32_t seed)
+{
+    for (int i = first; i < last; ++i)
+    {
+        seed_rng(seed + i);
+        _reset_dungeon();
+        for (const level_id &lid : generated_levels)
+        {
+            _go_to_level(lid);
+            watchdog();
+
+            const uint64_t start = bench_now_ns();
+            const bool built = builder();
+            const uint64_t ns = bench_now_ns() - start;
+
+            level_times[lid].add(1, ns, ns);
+            if (!built)
+                level_failures[lid]++;
+        }
+    }
+}
+
+static void _write_levelgen_stats(FILE *out)
+{
+    for (const auto &entry : level_times)
+    {
+        const level_id &lid = entry.first;
+        const gen_timing &t = entry.second;
+        const pair<int, int> builds = lookup(map_builds, lid,
+                                             make_pair(0, 0));
+        fprintf(out, "level %d %d %d %d %d %d %llu %llu\n", lid.branch,
+                lid.depth, t.count, lookup(level_failures, lid, 0),
+                builds.first, builds.second,
+                (unsigned long long) t.total_ns,
+                (unsigned long long) t.max_ns);
+    }
+    for (const auto &entry : veto_messages)
+        fprintf(out, "veto %d %s\n", entry.second, entry.first.c_str());
+    for (const auto &entry : map_times)
+    {
+        fprintf(out, "map %d %llu %llu %s\n", entry.second.count,
+                (unsigned long long) entry.second.total_ns,
+                (unsigned long long) entry.second.max_ns,
+                entry.first.c_str());
+    }
+}
+
+static void _read_levelgen_stats(FILE *in)
+{
+    char line[1024];
+    char name[1000];
+    while (fgets(line, sizeof(line), in))
+    {
+        int branch, depth, count, failures, attempts, vetoes;
+        unsigned long long total, longest;
+
+        if (sscanf(line, "level %d %d %d %d %d %d %llu %llu", &branch, &depth,
+                   &count, &failures, &attempts, &vetoes, &total,
+                   &longest) == 8)
+        {
+            const level_id lid(static_cast<branch_type>(branch), depth);
+            level_times[lid].add(count, total, longest);
+            if (failures)
+                level_failures[lid] += failures;
+            map_builds[lid].first += attempts;
+            map_builds[lid].second += vetoes;
+        }
+        else if (sscanf(line, "veto %d %999[^\n]", &count, name) == 2)
+            veto_messages[name] += count;
+        else if (sscanf(line, "map %d %llu %llu %999[^\n]", &count, &total,
+                        &longest, name) == 4)
+        {
+            map_times[name].add(count, total, longest);
+        }
+    }
+}
+
+#ifndef TARGET_OS_WINDOWS
+// Fork a worker for each job, and gather what they found. Returns the
+// number of jobs that failed.
+static int _levelgen_fork(int jobs, int dungeons, uint32_t seed)
+{
+    vector<pair<pid_t, FILE *>> workers;
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int job = 0; job < jobs; ++job)
+    {
+        int fds[2];
+        if (pipe(fds))
+            end(1, true, "Can't make a pipe for a levelgen job");
+
+        const pid_t pid = fork();
+        if (pid == -1)
+            end(1, true, "Can't fork a levelgen job");
+
+        if (!pid)
+        {
+            crawl_state.forked_worker = true;
+            close(fds[0]);
+            for (const auto &worker : workers)
+                fclose(worker.second);
+
+            _levelgen_worker(dungeons * job / jobs,
+                             dungeons * (job + 1) / jobs, seed);
+
+            FILE *out = fdopen(fds[1], "w");
+            _write_levelgen_stats(out);
+            fclose(out);
+            // Skip the exit handlers: they belong to the parent.
+            _exit(0);
+        }
+
+        close(fds[1]);
+        workers.emplace_back(pid, fdopen(fds[0], "r"));
+    }
+
+    int failed = 0;
+    for (const auto &worker : workers)
+    {
+        _read_levelgen_stats(worker.second);
+        fclose(worker.second);
+
+        int status;
+        if (waitpid(worker.first, &status, 0) == -1
+            || !WIFEXITED(status) || WEXITSTATUS(status))
+        {
+            failed++;
+        }
+    }
+    return failed;
+}
+#endif
+
+static void _report_levelgen(int jobs, int dungeons, double secs)
+{
+    int levels = 0;
+    map<branch_type, gen_timing> branch_times;
+    map<branch_type, int> branch_failures;
+    map<branch_type, pair<int, int>> branch_builds;
+    for (const auto &entry : level_times)
+    {
+        const branch_type br = entry.first.branch;
+        const gen_timing &t = entry.second;
+        levels += t.count;
+        branch_times[br].add(t.count, t.total_ns, t.max_ns);
+        branch_failures[br] += lookup(level_failures, entry.first, 0);
+        const pair<int, int> builds = lookup(map_builds, entry.first,
+                                             make_pair(0, 0));
+        branch_builds[br].first += builds.first;
+        branch_builds[br].second += builds.second;
+    }
+
+    printf("Generated %d dungeon(s), %d level(s), in %.2f s with %d job(s): "
+           "%.1f levels/s\n\n", dungeons, levels, secs, jobs,
+           secs > 0 ? levels / secs : 0.0);
+
+    // Every attempt but the one that succeeded was a retry.
+    printf("%-12s %7s %6s %8s %7s %9s %9s\n", "Branch", "levels", "fails",
+           "retries", "vetoes", "ms/level", "max ms");
+    for (const auto &entry : branch_times)
+    {
+        const branch_type br = entry.first;
+        const gen_timing &t = entry.second;
+        const int fails = branch_failures[br];
+        printf("%-12s %7d %6d %8d %7d %9.2f %9.2f\n",
+               branches[br].abbrevname, t.count, fails,
+               branch_builds[br].first - (t.count - fails),
+               branch_builds[br].second,
+               t.count ? t.total_ns / 1e6 / t.count : 0.0, t.max_ns / 1e6);
+    }
+
+    if (!veto_messages.empty())
+    {
+        printf("\nVeto reasons:\n");
+        multimap<int, string> sortedreasons;
+        for (const auto &entry : veto_messages)
+            sortedreasons.insert(make_pair(entry.second, entry.first));
+
+        int count = 0;
+        for (auto i = sortedreasons.rbegin();
+             i != sortedreasons.rend() && count < 20; ++i, ++count)
+        {
+            printf("%6d %s\n", i->first, i->second.c_str());
+        }
+    }
+
+    if (!map_times.empty())
+    {
+        printf("\nSlowest maps to place:\n%9s %9s %9s %6s  %s\n", "max ms",
+               "avg ms", "total ms", "tries", "map");
+        multimap<uint64_t, string> slowest;
+        for (const auto &entry : map_times)
+            slowest.insert(make_pair(entry.second.max_ns, entry.first));
+
+        int count = 0;
+        for (auto i = slowest.rbegin(); i != slowest.rend() && count < 30;
+             ++i, ++count)
+        {
+            const gen_timing &t = map_times[i->second];
+            printf("%9.2f %9.2f %9.1f %6d  %s\n", t.max_ns / 1e6,
+                   t.total_ns / 1e6 / t.count, t.total_ns / 1e6, t.count,
+                   i->second.c_str());
+        }
+    }
+}
+
+/**
+ * Time the generation of -iters dungeons, split between the given number
+ * of processes, and report the slow branches, vetoes and maps.
+ */
+void levelgen_generate_stats(int jobs)
+{
+    crawl_state.map_stat_gen = true;
+    _prepare_levelgen();
+
+    const int dungeons = SysEnv.map_gen_iters;
+    jobs = min(jobs, dungeons);
+    const uint32_t seed = Options.seed ? Options.seed : 1;
+    printf("Generating %d dungeon(s) of %d level(s) in %d job(s), seeds "
+           "%x to %x.\n", dungeons, (int) generated_levels.size(), jobs,
+           seed, seed + dungeons - 1);
+
+    const uint64_t start = bench_now_ns();
+    int failed = 0;
+#ifndef TARGET_OS_WINDOWS
+    if (jobs > 1)
+        failed = _levelgen_fork(jobs, dungeons, seed);
+    else
+#endif
+    {
+        jobs = 1;
+        _levelgen_worker(0, dungeons, seed);
+    }
+    const double secs = (bench_now_ns() - start) / 1e9;
+
+    if (failed)
+        printf("%d job(s) failed; their levels are missing.\n", failed);
+    _report_levelgen(jobs, dungeons, secs);
+}
+
 #endif // DEBUG_STATISTICS
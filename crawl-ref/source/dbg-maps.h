@@ -10,12 +10,14 @@
 
 class map_def;
 void mapstat_report_map_try(const map_def &map);
+void mapstat_report_map_time(const map_def &map, uint64_t ns);
 void mapstat_report_map_use(const map_def &map);
 void mapstat_report_error(const map_def &map, const string &err);
 void mapstat_report_map_build_start();
 void mapstat_report_map_veto(const string &message);
 void mapstat_generate_stats();
 bool mapstat_build_levels();
+void levelgen_generate_stats(int jobs);
 #endif
 
 #endif
@@ -0,0 +1,372 @@
+/**
+ * @file
+ * @brief Save marshalling benchmarks and fuzzing.
+**/
+
+#include "AppHdr.h"
+
+#include "dbg-save.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "act-iter.h"
+#include "branch.h"
+#include "dbg-bench.h"
+#include "env.h"
+#include "errors.h"
+#include "files.h"
+#include "initfile.h"
+#include "items.h"
+#include "libutil.h"
+#include "mon-util.h"
+#include "player.h"
+#include "random.h"
+#include "state.h"
+#include "stringutil.h"
+#include "syscalls.h"
+#include "tags.h"
+
+#ifdef DEBUG_STATISTICS
+
+#ifdef BENCH_ALLOCS
+// Allocations made through operator new while the benchmark is running.
+// This replaces the global operators, so it's only built on request
+// ("make profile bench-save BENCH_ALLOCS=y"); other threads (the background
+// save writer, say) may allocate at the same time.
+static atomic<bool> counting_allocs(false);
+static atomic<uint64_t> alloc_count(0);
+
+void *operator new(size_t size)
+{
+    if (counting_allocs.load(memory_order_relaxed))
+        alloc_count.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+static void _count_allocs(bool count)
+{
+    counting_allocs.store(count, memory_order_relaxed);
+}
+
+static uint64_t _allocs()
+{
+    return alloc_count.load(memory_order_relaxed);
+}
+#else
+static void _count_allocs(bool /*count*/)
+{
+}
+
+static uint64_t _allocs()
+{
+    return 0;
+}
+#endif
+
+struct savebench_stat
+{
+    const char *name;
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t write_ns, read_ns;
+    uint64_t write_allocs, read_allocs;
+};
+
+static savebench_stat section_stats[NUM_LEVEL_SECTIONS] =
+{
+    { "level" }, { "level_items" }, { "level_monsters" }, { "level_tiles" },
+};
+static savebench_stat item_stats = { "item" };
+static savebench_stat monster_stats = { "monster" };
+
+static void _time_sections(vector<unsigned char> (&bufs)[NUM_LEVEL_SECTIONS])
+{
+    for (int i = 0; i < NUM_LEVEL_SECTIONS; ++i)
+    {
+        savebench_stat &st = section_stats[i];
+        bufs[i].clear();
+        const uint64_t allocs = _allocs();
+        const uint64_t start = bench_now_ns();
+        {
+            writer th(&bufs[i]);
+            tag_write_level_section(static_cast<level_section>(i), th);
+        }
+        st.write_ns += bench_now_ns() - start;
+        st.write_allocs += _allocs() - allocs;
+        st.bytes += bufs[i].size();
+        st.ops++;
+    }
+
+    for (int i = 0; i < NUM_LEVEL_SECTIONS; ++i)
+    {
+        savebench_stat &st = section_stats[i];
+        const uint64_t allocs = _allocs();
+        const uint64_t start = bench_now_ns();
+        {
+            reader th(bufs[i], TAG_MINOR_VERSION);
+            tag_read_level_section(static_cast<level_section>(i), th);
+        }
+        st.read_ns += bench_now_ns() - start;
+        st.read_allocs += _allocs() - allocs;
+    }
+}
+
+static void _time_items()
+{
+    vector<unsigned char> buf;
+    item_def copy;
+    for (int i = 0; i < MAX_ITEMS; ++i)
+    {
+        if (!mitm[i].defined())
+            continue;
+
+        buf.clear();
+        uint64_t allocs = _allocs();
+        uint64_t start = bench_now_ns();
+        {
+            writer th(&buf);
+            marshallItem(th, mitm[i]);
+        }
+        item_stats.write_ns += bench_now_ns() - start;
+        item_stats.write_allocs += _allocs() - allocs;
+        item_stats.bytes += buf.size();
+        item_stats.ops++;
+
+        allocs = _allocs();
+        start = bench_now_ns();
+        {
+            reader th(buf, TAG_MINOR_VERSION);
+            unmarshallItem(th, copy);
+        }
+        item_stats.read_ns += bench_now_ns() - start;
+        item_stats.read_allocs += _allocs() - allocs;
+    }
+}
+
+static void _time_monsters()
+{
+    vector<unsigned char> buf;
+    monster copy;
+    for (monster_iterator mi; mi; ++mi)
+    {
+        buf.clear();
+        uint64_t allocs = _allocs();
+        uint64_t start = bench_now_ns();
+        {
+            writer th(&buf);
+            marshallMonster(th, **mi);
+        }
+        monster_stats.write_ns += bench_now_ns() - start;
+        monster_stats.write_allocs += _allocs() - allocs;
+        monster_stats.bytes += buf.size();
+        monster_stats.ops++;
+
+        // The copy isn't in menv; don't let reset() touch the monster grid.
+        copy.position.reset();
+        allocs = _allocs();
+        start = bench_now_ns();
+        {
+            reader th(buf, TAG_MINOR_VERSION);
+            unmarshallMonster(th, copy);
+        }
+        monster_stats.read_ns += bench_now_ns() - start;
+        monster_stats.read_allocs += _allocs() - allocs;
+    }
+    copy.position.reset();
+}
+
+static void _report_stat(const savebench_stat &st)
+{
+    const double ops = st.ops ? st.ops : 1;
+    printf("%-16s %8" PRIu64 " %10.1f %10.0f %10.0f", st.name, st.ops,
+           st.bytes / ops, st.write_ns / ops, st.read_ns / ops);
+#ifdef BENCH_ALLOCS
+    printf(" %8.1f %8.1f\n", st.write_allocs / ops, st.read_allocs / ops);
+#else
+    printf(" %8s %8s\n", "-", "-");
+#endif
+}
+
+/**
+ * Benchmark level marshalling.
+ *
+ * Builds -iters levels (default 100) and round-trips each through an
+ * in-memory writer and reader, one TAG_LEVEL section at a time, then each
+ * floor item and monster individually. Prints bytes, nanoseconds and
+ * (in builds with BENCH_ALLOCS) allocations per operation to stdout. Use
+ * -seed for repeatable runs.
+ */
+void savebench_generate_stats()
+{
+    bench_init();
+
+    const int levels = SysEnv.map_gen_iters;
+    printf("Benchmarking save marshalling over %d level(s).\n", levels);
+    fflush(stdout);
+
+    vector<unsigned char> bufs[NUM_LEVEL_SECTIONS];
+    int built = 0;
+    for (int i = 0; i < levels; ++i)
+    {
+        if (!bench_build_level(i))
+            continue;
+        ++built;
+        _count_allocs(true);
+        _time_sections(bufs);
+        _time_items();
+        _time_monsters();
+        _count_allocs(false);
+    }
+
+    printf("Built %d of %d level(s).\n\n", built, levels);
+    printf("%-16s %8s %10s %10s %10s %8s %8s\n", "tag", "ops", "bytes/op",
+           "write ns", "read ns", "w alloc", "r alloc");
+    for (const savebench_stat &st : section_stats)
+        _report_stat(st);
+    _report_stat(item_stats);
+    _report_stat(monster_stats);
+}
+
+static bool _read_file(const string &file, vector<unsigned char> &buf)
+{
+    FILE *f = fopen_u(file.c_str(), "rb");
+    if (!f)
+        return false;
+    buf.clear();
+    unsigned char block[4096];
+    size_t len;
+    while ((len = fread(block, 1, sizeof(block), f)) > 0)
+        buf.insert(buf.end(), block, block + len);
+    fclose(f);
+    return true;
+}
+
+static void _write_file(const string &file, const vector<unsigned char> &buf)
+{
+    FILE *f = fopen_u(file.c_str(), "wb");
+    if (!f)
+        sysfail("can't write %s", file.c_str());
+    if (!buf.empty() && fwrite(&buf[0], buf.size(), 1, f) != 1)
+        sysfail("can't write %s", file.c_str());
+    fclose(f);
+}
+
+// Seed an empty corpus with freshly built levels.
+static void _seed_corpus(const string &corpus)
+{
+    printf("Seeding %s with generated levels.\n", corpus.c_str());
+    for (int i = 0; i < brdepth[BRANCH_DUNGEON]; ++i)
+    {
+        if (!bench_build_level(i))
+            continue;
+        vector<unsigned char> buf;
+        writer th(&buf);
+        for (int s = 0; s < NUM_LEVEL_SECTIONS; ++s)
+            tag_write_level_section(static_cast<level_section>(s), th);
+        _write_file(catpath(corpus, make_stringf("level-%02d.tag", i + 1)),
+                    buf);
+    }
+}
+
+static void _mutate(vector<unsigned char> &buf)
+{
+    for (int n = 1 + random2(4); n > 0 && !buf.empty(); --n)
+    {
+        const int pos = random2(buf.size());
+        switch (random2(4))
+        {
+        case 0:
+            buf[pos] ^= 1 << random2(8);
+            break;
+        case 1:
+            buf[pos] = random2(256);
+            break;
+        case 2:
+            buf.resize(pos);
+            break;
+        default:
+            buf.insert(buf.begin() + pos, random2(256));
+            break;
+        }
+    }
+}
+
+// Returns false if the input was rejected as truncated.
+static bool _fuzz_one(const vector<unsigned char> &buf)
+{
+    reader th(buf, TAG_MINOR_VERSION);
+    th.set_safe_read(true);
+    try
+    {
+        for (int s = 0; s < NUM_LEVEL_SECTIONS; ++s)
+            tag_read_level_section(static_cast<level_section>(s), th);
+    }
+    catch (short_read_exception &E)
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Fuzz the level reader.
+ *
+ * Corpus files hold the sections of a TAG_LEVEL chunk back to back, as
+ * written by tag_write_level_section(); an empty corpus directory is seeded
+ * with generated levels. Each corpus file gets -iters (default 100) random
+ * mutations. Every input is written to fuzz-save-crash.tag before it is
+ * read, so if the reader dies that file reproduces the crash; pass it instead
+ * of a directory to replay it.
+ */
+void savebench_fuzz(const string &corpus)
+{
+    bench_init();
+
+    const string crash_file = "fuzz-save-crash.tag";
+    vector<unsigned char> buf;
+    if (!dir_exists(corpus))
+    {
+        if (!_read_file(corpus, buf))
+            fail("Can't read fuzz input '%s'", corpus.c_str());
+        printf("%s: %s\n", corpus.c_str(),
+               _fuzz_one(buf) ? "read ok" : "short read");
+        return;
+    }
+
+    if (get_dir_files(corpus).empty())
+        _seed_corpus(corpus);
+
+    int runs = 0, short_reads = 0;
+    for (const string &name : get_dir_files(corpus))
+    {
+        vector<unsigned char> orig;
+        if (!_read_file(catpath(corpus, name), orig))
+            continue;
+        printf("%s..", name.c_str());
+        fflush(stdout);
+        for (int i = 0; i < SysEnv.map_gen_iters; ++i)
+        {
+            buf = orig;
+            _mutate(buf);
+            _write_file(crash_file, buf);
+            if (!_fuzz_one(buf))
+                ++short_reads;
+            ++runs;
+        }
+    }
+    unlink_u(crash_file.c_str());
+
+    printf("\nFuzzed %d input(s); %d short read(s), no crashes.\n", runs,
+           short_reads);
+}
+
+#endif // DEBUG_STATISTICS
@@ -0,0 +1,14 @@
+/**
+ * @file
+ * @brief Save marshalling benchmarks and fuzzing.
+**/
+
+#ifndef DBGSAVE_H
+#define DBGSAVE_H
+
+#ifdef DEBUG_STATISTICS
+void savebench_generate_stats();
+void savebench_fuzz(const string &corpus);
+#endif
+
+#endif
@@ -371,6 +371,13 @@ void debug_mons_scan()
         ASSERT(m->mid > 0);
         coord_def pos = m->pos();
 
+        if (i >= env.mons_used)
+        {
+            mprf(MSGCH_ERROR, "Monster %s beyond the used slots (%d), "
+                              "midx = %d",
+                 m->full_name(DESC_PLAIN, true).c_str(), env.mons_used, i);
+        }
+
         if (invalid_monster_type(m->type))
         {
             mprf(MSGCH_ERROR, "Bogus monster type %d at (%d, %d), midx = %d",
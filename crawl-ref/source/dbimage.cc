@@ -0,0 +1,406 @@
+/**
+ * @file
+ * @brief Immutable key/value images for the text databases.
+ *
+ * An image is a header, a minimal perfect hash of its keys, its records
+ * sorted by key and a blob of the keys and values they point into:
+ *
+ *   db_image_header header;
+ *   uint32_t seeds[buckets];           seed of each hash bucket
+ *   uint32_t slots[entries];           record in each hash slot
+ *   db_image_record records[entries];  sorted by key
+ *   char blob[blob_size];
+ *
+ * A key hashes to a bucket, and with that bucket's seed to a slot, which
+ * holds the only record the key can be; so a lookup reads one seed, one
+ * slot and one record. The seeds are found when writing, by placing the
+ * fullest buckets first (the "hash, displace and compress" scheme, less
+ * the compression).
+ *
+ * Images are written in native byte order, and written to a temporary
+ * file which is then renamed over the old image, so that processes which
+ * have the old one mapped are left undisturbed.
+**/
+
+#include "AppHdr.h"
+
+#include "dbimage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <numeric>
+#include <sys/stat.h>
+#ifdef UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "syscalls.h"
+
+static const char db_image_magic[8] = { 'C','R','A','W','L','D','B','1' };
+static const uint32_t db_image_byte_order = 0x01020304;
+
+// Keys per hash bucket, on average.
+#define DB_IMAGE_BUCKET_SIZE 4
+// Give up on finding a seed for a bucket after this many.
+#define DB_IMAGE_MAX_SEED (1 << 24)
+
+struct db_image_header
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t entries;
+    uint32_t buckets;
+    uint32_t blob_size;
+};
+
+struct db_image_record
+{
+    uint32_t key_offset;
+    uint32_t key_size;
+    uint32_t value_offset;
+    uint32_t value_size;
+};
+
+COMPILE_CHECK(sizeof(db_image_header) == 24);
+COMPILE_CHECK(sizeof(db_image_record) == 16);
+
+static const db_image_header &_header(const char *data)
+{
+    return *reinterpret_cast<const db_image_header *>(data);
+}
+
+static const uint32_t *_seeds(const char *data)
+{
+    return reinterpret_cast<const uint32_t *>(data + sizeof(db_image_header));
+}
+
+static const uint32_t *_slots(const char *data)
+{
+    return _seeds(data) + _header(data).buckets;
+}
+
+static const db_image_record *_records(const char *data)
+{
+    return reinterpret_cast<const db_image_record *>(
+        _slots(data) + _header(data).entries);
+}
+
+static const char *_blob(const char *data)
+{
+    return reinterpret_cast<const char *>(
+        _records(data) + _header(data).entries);
+}
+
+// FNV-1a.
+static uint64_t _key_hash(const char *key, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= (unsigned char) key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint32_t _key_bucket(uint64_t hash, uint32_t buckets)
+{
+    return (hash >> 32) % buckets;
+}
+
+static uint32_t _key_slot(uint64_t hash, uint32_t seed, uint32_t entries)
+{
+    // splitmix64's finaliser, so that each seed scatters the keys afresh.
+    uint64_t h = hash + (seed + 1) * 0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h % entries;
+}
+
+db_image::db_image()
+    : data(nullptr), data_size(0), mapped(false)
+{
+}
+
+db_image::~db_image()
+{
+    close();
+}
+
+bool db_image::open(const string &filename)
+{
+    close();
+
+#ifdef UNIX
+    const int fd = open_u(filename.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(db_image_header))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    data = static_cast<const char *>(map);
+    data_size = st.st_size;
+    mapped = true;
+#else
+    FILE *file = fopen_u(filename.c_str(), "rb");
+    if (!file)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size < (long) sizeof(db_image_header))
+    {
+        fclose(file);
+        return false;
+    }
+
+    char *buf = new char[size];
+    const bool read = fread(buf, 1, size, file) == (size_t) size;
+    fclose(file);
+    if (!read)
+    {
+        delete[] buf;
+        return false;
+    }
+
+    data = buf;
+    data_size = size;
+    mapped = false;
+#endif
+
+    if (!validate())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void db_image::close()
+{
+    if (!data)
+        return;
+
+#ifdef UNIX
+    if (mapped)
+        munmap(const_cast<char *>(data), data_size);
+    else
+#endif
+        delete[] data;
+
+    data = nullptr;
+    data_size = 0;
+    mapped = false;
+}
+
+// Check that everything in the image is where the header says, so that
+// lookups can trust it.
+bool db_image::validate() const
+{
+    const db_image_header &header = _header(data);
+    if (memcmp(header.magic, db_image_magic, sizeof(header.magic))
+        || header.byte_order != db_image_byte_order
+        || header.entries && !header.buckets)
+    {
+        return false;
+    }
+
+    const uint64_t expected = sizeof(db_image_header)
+                              + sizeof(uint32_t) * (uint64_t) header.buckets
+                              + sizeof(uint32_t) * (uint64_t) header.entries
+                              + sizeof(db_image_record)
+                                * (uint64_t) header.entries
+                              + header.blob_size;
+    if (expected != data_size)
+        return false;
+
+    const uint32_t *slots = _slots(data);
+    const db_image_record *records = _records(data);
+    for (uint32_t i = 0; i < header.entries; ++i)
+    {
+        const db_image_record &rec = records[i];
+        if (slots[i] >= header.entries
+            || (uint64_t) rec.key_offset + rec.key_size > header.blob_size
+            || (uint64_t) rec.value_offset + rec.value_size
+               > header.blob_size)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool db_image::fetch(const string &key, const char *&value,
+                     size_t &size) const
+{
+    if (!data)
+        return false;
+
+    const db_image_header &header = _header(data);
+    if (!header.entries)
+        return false;
+
+    const uint64_t hash = _key_hash(key.data(), key.size());
+    const uint32_t seed = _seeds(data)[_key_bucket(hash, header.buckets)];
+    const uint32_t slot = _key_slot(hash, seed, header.entries);
+    const db_image_record &rec = _records(data)[_slots(data)[slot]];
+
+    // Keys that aren't in the image hash to some other key's slot.
+    const char *blob = _blob(data);
+    if (rec.key_size != key.size()
+        || memcmp(blob + rec.key_offset, key.data(), key.size()))
+    {
+        return false;
+    }
+
+    value = blob + rec.value_offset;
+    size = rec.value_size;
+    return true;
+}
+
+size_t db_image::size() const
+{
+    return data ? _header(data).entries : 0;
+}
+
+string db_image::key(size_t i) const
+{
+    ASSERT(i < size());
+    const db_image_record &rec = _records(data)[i];
+    return string(_blob(data) + rec.key_offset, rec.key_size);
+}
+
+string db_image::value(size_t i) const
+{
+    ASSERT(i < size());
+    const db_image_record &rec = _records(data)[i];
+    return string(_blob(data) + rec.value_offset, rec.value_size);
+}
+
+void db_image_writer::add(const string &key, const string &value)
+{
+    entries[key] = value;
+}
+
+bool db_image_writer::write(const string &filename) const
+{
+    const uint32_t count = entries.size();
+    const uint32_t buckets = count ? max(count / DB_IMAGE_BUCKET_SIZE, 1U)
+                                   : 0;
+
+    vector<db_image_record> records;
+    vector<uint64_t> hashes;
+    string blob;
+    records.reserve(count);
+    hashes.reserve(count);
+    for (const auto &entry : entries)
+    {
+        db_image_record rec;
+        rec.key_offset = blob.size();
+        rec.key_size = entry.first.size();
+        blob += entry.first;
+        rec.value_offset = blob.size();
+        rec.value_size = entry.second.size();
+        blob += entry.second;
+
+        records.push_back(rec);
+        hashes.push_back(_key_hash(entry.first.data(), entry.first.size()));
+    }
+    if (blob.size() > UINT32_MAX)
+        return false;
+
+    vector<vector<uint32_t>> bucket_keys(buckets);
+    for (uint32_t i = 0; i < count; ++i)
+        bucket_keys[_key_bucket(hashes[i], buckets)].push_back(i);
+
+    vector<uint32_t> order(buckets);
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(),
+                [&bucket_keys](uint32_t a, uint32_t b)
+                {
+                    return bucket_keys[a].size() > bucket_keys[b].size();
+                });
+
+    vector<uint32_t> seeds(buckets, 0);
+    vector<uint32_t> slots(count, 0);
+    vector<bool> taken(count, false);
+    vector<uint32_t> placed;
+    for (uint32_t b : order)
+    {
+        const vector<uint32_t> &keys = bucket_keys[b];
+        if (keys.empty())
+            break;
+
+        // The first seed that puts every key of the bucket in a free slot.
+        uint32_t seed = 0;
+        for (;; ++seed)
+        {
+            if (seed == DB_IMAGE_MAX_SEED)
+                return false;
+
+            placed.clear();
+            for (uint32_t k : keys)
+            {
+                const uint32_t slot = _key_slot(hashes[k], seed, count);
+                if (taken[slot]
+                    || find(placed.begin(), placed.end(), slot)
+                       != placed.end())
+                {
+                    break;
+                }
+                placed.push_back(slot);
+            }
+            if (placed.size() == keys.size())
+                break;
+        }
+
+        seeds[b] = seed;
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            taken[placed[i]] = true;
+            slots[placed[i]] = keys[i];
+        }
+    }
+
+    db_image_header header;
+    memcpy(header.magic, db_image_magic, sizeof(header.magic));
+    header.byte_order = db_image_byte_order;
+    header.entries = count;
+    header.buckets = buckets;
+    header.blob_size = blob.size();
+
+    const string tmp = filename + ".tmp";
+    FILE *file = fopen_u(tmp.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+              && fwrite(seeds.data(), sizeof(uint32_t), buckets, file)
+                 == buckets
+              && fwrite(slots.data(), sizeof(uint32_t), count, file) == count
+              && fwrite(records.data(), sizeof(db_image_record), count, file)
+                 == count
+              && fwrite(blob.data(), 1, blob.size(), file) == blob.size();
+    ok = !fclose(file) && ok;
+
+    if (!ok || rename_u(tmp.c_str(), filename.c_str()))
+    {
+        unlink_u(tmp.c_str());
+        return false;
+    }
+    return true;
+}
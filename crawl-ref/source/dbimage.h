@@ -0,0 +1,55 @@
+/**
+ * @file
+ * @brief Immutable key/value images for the text databases.
+**/
+
+#ifndef DBIMAGE_H
+#define DBIMAGE_H
+
+#include <map>
+
+// A database image, mapped read-only so that every game process on a
+// machine shares the one copy in the page cache.
+class db_image
+{
+public:
+    db_image();
+    ~db_image();
+
+    bool open(const string &filename);
+    void close();
+    bool is_open() const { return data != nullptr; }
+
+    // Point value at the value of key, which stays valid until the image
+    // is closed.
+    bool fetch(const string &key, const char *&value, size_t &size) const;
+
+    // Entries are kept sorted by key.
+    size_t size() const;
+    string key(size_t i) const;
+    string value(size_t i) const;
+
+private:
+    db_image(const db_image &) = delete;
+    db_image &operator=(const db_image &) = delete;
+
+    bool validate() const;
+
+    const char *data;
+    size_t data_size;
+    bool mapped;
+};
+
+// Collects the entries of an image and writes it out.
+class db_image_writer
+{
+public:
+    // Later values replace earlier ones for the same key.
+    void add(const string &key, const string &value);
+    bool write(const string &filename) const;
+
+private:
+    map<string, string> entries;
+};
+
+#endif
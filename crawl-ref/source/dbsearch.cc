@@ -0,0 +1,381 @@
+/**
+ * @file
+ * @brief Trigram indices for searching database images by regex.
+ *
+ * A search index is itself a database image, which maps each trigram (of
+ * bytes, with ASCII lowercased) found in the keys or bodies of another
+ * image to the entries containing it. A regex search looks for the
+ * literal strings every match must contain, and only runs the regex on
+ * the entries that contain all of their trigrams. Regexes that don't
+ * reduce to such literals (alternations, say) are run on every entry.
+ *
+ * Posting lists are stored as varint-encoded deltas between ascending
+ * entry numbers. The entry numbers are those of the image the index was
+ * built from, so an index is only used with the image whose timestamp
+ * and size it records.
+**/
+
+#include "AppHdr.h"
+
+#include "dbsearch.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cwctype>
+#include <unordered_map>
+
+#include "dbimage.h"
+#include "libutil.h"
+#include "stringutil.h"
+#include "unicode.h"
+
+static const char db_search_prefix[] = { 'k', 'b' };
+COMPILE_CHECK(ARRAYSZ(db_search_prefix) == DB_SEARCH_BODIES + 1);
+
+static string _index_source(const db_image &db, const string &timestamp)
+{
+    return make_stringf("%s/%u", timestamp.c_str(), (unsigned int) db.size());
+}
+
+static uint32_t _trigram(const string &s, size_t i)
+{
+    return (uint8_t) s[i] << 16 | (uint8_t) s[i + 1] << 8 | (uint8_t) s[i + 2];
+}
+
+static string _trigram_key(db_search_field field, uint32_t gram)
+{
+    string key(1, db_search_prefix[field]);
+    key += (char) (gram >> 16);
+    key += (char) (gram >> 8);
+    key += (char) gram;
+    return key;
+}
+
+// Lowercase ASCII only, which leaves UTF-8 sequences alone.
+static string _ascii_lowercase(string s)
+{
+    for (char &c : s)
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+    return s;
+}
+
+static void _add_trigrams(vector<vector<uint32_t>> &postings,
+                          unordered_map<uint32_t, uint32_t> &gram_lists,
+                          const string &text, uint32_t entry)
+{
+    const string lower = _ascii_lowercase(text);
+    if (lower.size() < 3)
+        return;
+
+    vector<uint32_t> grams;
+    for (size_t i = 0; i + 3 <= lower.size(); ++i)
+        grams.push_back(_trigram(lower, i));
+    sort(grams.begin(), grams.end());
+    grams.erase(unique(grams.begin(), grams.end()), grams.end());
+
+    for (uint32_t gram : grams)
+    {
+        auto it = gram_lists.find(gram);
+        if (it == gram_lists.end())
+        {
+            it = gram_lists.emplace(gram, postings.size()).first;
+            postings.emplace_back();
+        }
+        postings[it->second].push_back(entry);
+    }
+}
+
+static string _encode_postings(const vector<uint32_t> &entries)
+{
+    string out;
+    uint32_t last = 0;
+    for (uint32_t entry : entries)
+    {
+        uint32_t delta = entry - last;
+        last = entry;
+        while (delta >= 0x80)
+        {
+            out += (char) (delta & 0x7f | 0x80);
+            delta >>= 7;
+        }
+        out += (char) delta;
+    }
+    return out;
+}
+
+static void _decode_postings(const char *data, size_t size,
+                             vector<uint32_t> &entries)
+{
+    entries.clear();
+    uint32_t last = 0;
+    size_t i = 0;
+    while (i < size)
+    {
+        uint32_t delta = 0;
+        int shift = 0;
+        while (i < size && data[i] & 0x80)
+        {
+            delta |= (uint32_t) (data[i++] & 0x7f) << shift;
+            shift += 7;
+        }
+        if (i == size)
+            break;
+        delta |= (uint32_t) (uint8_t) data[i++] << shift;
+
+        last += delta;
+        entries.push_back(last);
+    }
+}
+
+/**
+ * Index the keys and bodies of an image.
+ *
+ * @param db        the image to index.
+ * @param timestamp the timestamp of the image, to tell whether the index
+ *                  is current when it is next opened.
+ * @param filename  where to write the index.
+ * @return whether the index could be written.
+ */
+bool write_db_search_index(const db_image &db, const string &timestamp,
+                           const string &filename)
+{
+    db_image_writer index;
+    for (int field = DB_SEARCH_KEYS; field <= DB_SEARCH_BODIES; ++field)
+    {
+        vector<vector<uint32_t>> postings;
+        unordered_map<uint32_t, uint32_t> gram_lists;
+        for (size_t i = 0; i < db.size(); ++i)
+        {
+            _add_trigrams(postings, gram_lists,
+                          field == DB_SEARCH_KEYS ? db.key(i) : db.value(i),
+                          i);
+        }
+
+        for (const auto &gram : gram_lists)
+        {
+            index.add(_trigram_key((db_search_field) field, gram.first),
+                      _encode_postings(postings[gram.second]));
+        }
+    }
+
+    // Trigram keys are four bytes, so can't collide with this.
+    index.add("SOURCE", _index_source(db, timestamp));
+    return index.write(filename);
+}
+
+/// Was the index built from this version of the image?
+bool db_search_index_current(const db_image &index, const db_image &db,
+                             const string &timestamp)
+{
+    const char *value;
+    size_t size;
+    return index.fetch("SOURCE", value, size)
+           && string(value, size) == _index_source(db, timestamp);
+}
+
+/**
+ * Find the literal strings which anything matching a regex must contain.
+ * This errs on the side of finding too little: what it can't understand
+ * it either skips or, if it might make some part of the regex optional,
+ * gives up on.
+ *
+ * @param regex       a POSIX extended or PCRE regex.
+ * @param ignore_case whether the regex is to be matched ignoring case.
+ * @param[out] runs   the literals, ASCII lowercased.
+ * @return false if the regex could match strings without any of runs.
+ */
+static bool _required_literals(const string &regex, bool ignore_case,
+                               vector<string> &runs)
+{
+    // Alternatives might have nothing in common, and (?...) can change
+    // the meaning of everything after it.
+    if (regex.find('|') != string::npos || regex.find("(?") != string::npos)
+        return false;
+
+    vector<size_t> groups;
+    string cur;
+    auto flush = [&]()
+    {
+        if (!cur.empty())
+            runs.push_back(cur);
+        cur.clear();
+    };
+    // Drop the last character of the current run, which a quantifier has
+    // made optional.
+    auto drop_last = [&]()
+    {
+        size_t n = cur.size();
+        while (n && ((uint8_t) cur[n - 1] & 0xc0) == 0x80)
+            --n;
+        cur.resize(n ? n - 1 : 0);
+    };
+
+    for (size_t i = 0; i < regex.size(); ++i)
+    {
+        const char c = regex[i];
+        switch (c)
+        {
+        case '\\':
+            if (++i == regex.size())
+                return false;
+            if (isaalnum(regex[i]))
+            {
+                // Classes and assertions, which take no arguments; the
+                // other escapes (\x, \p{..}, backreferences...) do.
+                if (!strchr("dDwWsSbB", regex[i]))
+                    return false;
+                flush();
+            }
+            // GNU's anchors for the start and end of words and of the text.
+            else if (strchr("<>`'", regex[i]))
+                flush();
+            else
+                cur += regex[i];
+            break;
+
+        case '.':
+        case '^':
+        case '$':
+        case '+':
+            flush();
+            break;
+
+        case '?':
+        case '*':
+            drop_last();
+            flush();
+            break;
+
+        case '{':
+            drop_last();
+            flush();
+            i = regex.find('}', i);
+            if (i == string::npos)
+                return false;
+            break;
+
+        case '[':
+        {
+            flush();
+            size_t j = i + 1;
+            if (j < regex.size() && regex[j] == '^')
+                ++j;
+            if (j < regex.size() && regex[j] == ']')
+                ++j;
+            // Escapes and [:class:] differ between POSIX and PCRE.
+            for (; j < regex.size() && regex[j] != ']'; ++j)
+                if (regex[j] == '[' || regex[j] == '\\')
+                    return false;
+            if (j == regex.size())
+                return false;
+            i = j;
+            break;
+        }
+
+        case '(':
+            flush();
+            groups.push_back(runs.size());
+            break;
+
+        case ')':
+            flush();
+            if (groups.empty())
+                return false;
+            // An optional group takes its literals with it.
+            if (i + 1 < regex.size() && strchr("?*{", regex[i + 1]))
+                runs.resize(groups.back());
+            groups.pop_back();
+            break;
+
+        default:
+            if ((uint8_t) c < 0x80)
+            {
+                cur += tolower(c);
+                break;
+            }
+
+            // A character other than ASCII: one with case might match
+            // bytes other than its own when ignoring case.
+            ucs_t wc;
+            int len = utf8towc(&wc, regex.c_str() + i);
+            if (len <= 0)
+                return false;
+            if (ignore_case && (towlower(wc) != wc || towupper(wc) != wc))
+                flush();
+            else
+                cur += regex.substr(i, len);
+            i += len - 1;
+            break;
+        }
+    }
+
+    if (!groups.empty())
+        return false;
+    flush();
+    return true;
+}
+
+/**
+ * Find the entries which might match a regex.
+ *
+ * @param index       the search index of the image to be searched.
+ * @param regex       the regex to be matched.
+ * @param ignore_case whether the regex is to be matched ignoring case.
+ * @param field       whether the regex is to be matched to keys or
+ *                    bodies.
+ * @param[out] entries the candidates, in ascending order.
+ * @return false if the index can't narrow the search, and every entry
+ *         must be tried.
+ */
+bool db_search_candidates(const db_image &index, const string &regex,
+                          bool ignore_case, db_search_field field,
+                          vector<uint32_t> &entries)
+{
+    vector<string> runs;
+    if (!_required_literals(regex, ignore_case, runs))
+        return false;
+
+    vector<uint32_t> grams;
+    for (const string &run : runs)
+        for (size_t i = 0; i + 3 <= run.size(); ++i)
+            grams.push_back(_trigram(run, i));
+    sort(grams.begin(), grams.end());
+    grams.erase(unique(grams.begin(), grams.end()), grams.end());
+    if (grams.empty())
+        return false;
+
+    vector<pair<const char *, size_t>> lists;
+    for (uint32_t gram : grams)
+    {
+        const char *value;
+        size_t size;
+        // A trigram that appears nowhere: nothing can match.
+        if (!index.fetch(_trigram_key(field, gram), value, size))
+        {
+            entries.clear();
+            return true;
+        }
+        lists.emplace_back(value, size);
+    }
+
+    // Start from the shortest list, to keep the intersections small.
+    sort(lists.begin(), lists.end(),
+         [](const pair<const char *, size_t> &a,
+            const pair<const char *, size_t> &b)
+         {
+             return a.second < b.second;
+         });
+
+    _decode_postings(lists[0].first, lists[0].second, entries);
+    vector<uint32_t> list, common;
+    for (size_t i = 1; i < lists.size() && !entries.empty(); ++i)
+    {
+        _decode_postings(lists[i].first, lists[i].second, list);
+        common.clear();
+        set_intersection(entries.begin(), entries.end(),
+                         list.begin(), list.end(), back_inserter(common));
+        entries.swap(common);
+    }
+    return true;
+}
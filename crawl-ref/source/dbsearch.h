@@ -0,0 +1,26 @@
+/**
+ * @file
+ * @brief Trigram indices for searching database images by regex.
+**/
+
+#ifndef DBSEARCH_H
+#define DBSEARCH_H
+
+class db_image;
+
+enum db_search_field
+{
+    DB_SEARCH_KEYS,
+    DB_SEARCH_BODIES,
+};
+
+bool write_db_search_index(const db_image &db, const string &timestamp,
+                           const string &filename);
+bool db_search_index_current(const db_image &index, const db_image &db,
+                             const string &timestamp);
+
+bool db_search_candidates(const db_image &index, const string &regex,
+                          bool ignore_case, db_search_field field,
+                          vector<uint32_t> &entries);
+
+#endif
@@ -352,7 +352,7 @@ bool builder(bool enable_random_maps, dungeon_feature_type dest_stairs_type)
 static bool _build_level_vetoable(bool enable_random_maps,
                                   dungeon_feature_type dest_stairs_type)
 {
-#ifdef DEBUG_DIAGNOSTICS
+#ifdef DEBUG_STATISTICS
     mapstat_report_map_build_start();
 #endif
 
@@ -369,7 +369,7 @@ static bool _build_level_vetoable(bool enable_random_maps,
     {
         dprf(DIAG_DNGN, "<white>VETO</white>: %s: %s",
              level_id::current().describe().c_str(), e.what());
-#ifdef DEBUG_DIAGNOSTICS
+#ifdef DEBUG_STATISTICS
         mapstat_report_map_veto(e.what());
 #endif
         return false;
@@ -1237,6 +1237,7 @@ void dgn_reset_level(bool enable_random_maps)
     const cloud_struct empty;
     env.cloud.init(empty);
     env.cloud_no = 0;
+    reset_active_clouds();
 
     mgrd.init(NON_MONSTER);
     igrd.init(NON_ITEM);
@@ -4264,7 +4265,7 @@ static const vault_placement *_build_vault_impl(const map_def *vault,
     // exits will not be correctly set.
     const vault_placement *saved_place = dgn_register_place(place, true);
 
-#ifdef DEBUG_DIAGNOSTICS
+#ifdef DEBUG_STATISTICS
     if (crawl_state.map_stat_gen)
         mapstat_report_map_use(place.map);
 #endif
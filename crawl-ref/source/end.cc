@@ -8,6 +8,7 @@
 #include "end.h"
 
 #include <cerrno>
+#include <cstdlib>
 
 #include "abyss.h"
 #include "chardump.h"
@@ -19,7 +20,7 @@
 #include "hints.h"
 #include "invent.h"
 #include "itemprop.h"
-#include "los.h"
+#include "keylog.h"
 #include "macro.h"
 #include "message.h"
 #include "prompt.h"
@@ -45,7 +46,6 @@ void cio_cleanup()
 // Clear some globally defined variables.
 static void _clear_globals_on_exit()
 {
-    clear_rays_on_exit();
     clear_zap_info_on_exit();
     clear_colours_on_exit();
     dgn_clear_vault_placements(env.level_vaults);
@@ -108,6 +108,11 @@ bool CrawlIsCrashing = false;
 
 NORETURN void end(int exit_code, bool print_error, const char *format, ...)
 {
+    // The console, sockets and save belong to the parent, which reports
+    // the worker's failure itself.
+    if (crawl_state.forked_worker)
+        _Exit(exit_code);
+
     bool need_pause = true;
     disable_other_crashes();
 
@@ -145,6 +150,7 @@ NORETURN void end(int exit_code, bool print_error, const char *format, ...)
 #endif
 
         cio_cleanup();
+        keylog_shutdown();
         msg::deinitialise_mpr_streams();
         _clear_globals_on_exit();
         databaseSystemShutdown();
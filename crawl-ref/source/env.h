@@ -120,6 +120,15 @@ struct crawl_environment
     // Volatile level flags, not saved.
     uint32_t level_state;
 
+    // All slots of mons in use are below this, so that going over the
+    // monsters costs as many monsters as the level has had at once.
+    int mons_used;
+
+    // The clouds in use, as indices into cloud in no particular order,
+    // and where each of them is in that list. Kept by cloud.cc.
+    vector<int> active_clouds;
+    FixedVector<int, MAX_CLOUDS> active_cloud_pos;
+
     // Mapping mid->mindex until the transition is finished.
     map<mid_t, unsigned short> mid_cache;
 
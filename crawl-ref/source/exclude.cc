@@ -218,6 +218,7 @@ void exclude_set::clear()
 {
     exclude_roots.clear();
     exclude_points.clear();
+    view_mark_all_dirty();
 }
 
 void exclude_set::erase(const coord_def &p)
@@ -249,6 +250,8 @@ void exclude_set::add_exclude(const coord_def &p, int radius,
 
 void exclude_set::add_exclude_points(travel_exclude& ex)
 {
+    view_mark_all_dirty();
+
     if (ex.radius == 0)
     {
         exclude_points.insert(ex.pos);
@@ -280,6 +283,7 @@ void exclude_set::update_excluded_points(bool recompute_los)
 
 void exclude_set::recompute_excluded_points(bool recompute_los)
 {
+    view_mark_all_dirty();
     exclude_points.clear();
     for (iterator it = exclude_roots.begin(); it != exclude_roots.end(); ++it)
     {
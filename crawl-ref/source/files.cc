@@ -74,6 +74,7 @@
 #endif
 #include "tileview.h"
 #include "timed_effects.h"
+#include "turnprof.h"
 #include "unwind.h"
 #include "version.h"
 #include "view.h"
@@ -748,15 +749,21 @@ static void _write_ghost_version(writer &outf)
         marshallInt(outf, 0);
 }
 
+// Tagged chunks are written incrementally: the package only stores the
+// parts that changed since the last full write.
 static void _write_tagged_chunk(const string &chunkname, tag_type tag)
 {
-    writer outf(you.save, chunkname);
+    vector<unsigned char> buf;
+    vector<plen_t> segments;
+    writer outf(&buf);
 
     // write version
     marshallUByte(outf, TAG_MAJOR_VERSION);
     marshallUByte(outf, TAG_MINOR_VERSION);
 
-    tag_write(tag, outf);
+    tag_write(tag, outf, &segments);
+
+    you.save->write_segmented(chunkname, buf.data(), buf.size(), segments);
 }
 
 static int _get_dest_stair_type(branch_type old_branch,
@@ -1565,11 +1572,15 @@ static void _save_level(const level_id& lid)
 # define CHUNK(short, long) long
 #endif
 
-#define SAVEFILE(short, long, savefn)           \
-    do                                          \
-    {                                           \
-        writer w(you.save, CHUNK(short, long)); \
-        savefn(w);                              \
+// These are not split into segments, but unchanged ones are not rewritten.
+#define SAVEFILE(short, long, savefn)                               \
+    do                                                              \
+    {                                                               \
+        vector<unsigned char> buf;                                  \
+        writer w(&buf);                                             \
+        savefn(w);                                                  \
+        you.save->write_segmented(CHUNK(short, long), buf.data(),   \
+                                  buf.size(), vector<plen_t>());    \
     } while (false)
 
 // Stack allocated string's go in separate function, so Valgrind doesn't
@@ -1644,6 +1655,7 @@ static void _save_game_exit()
 void save_game(bool leave_game, const char *farewellmsg)
 {
     unwind_bool saving_game(crawl_state.saving_game, true);
+    turn_phase_timer timer(TPHASE_SAVE);
 
 
     if (leave_game && Options.dump_on_save)
@@ -4249,6 +4249,10 @@ enum commandline_option_type
     CLO_MACRO,
     CLO_MAPSTAT,
     CLO_OBJSTAT,
+    CLO_BENCH_SAVE,
+    CLO_FUZZ_SAVE,
+    CLO_BENCH,
+    CLO_LEVELGEN,
     CLO_ITERATIONS,
     CLO_ARENA,
     CLO_DUMP_MAPS,
@@ -4273,6 +4277,9 @@ enum commandline_option_type
     CLO_NO_GDB, CLO_NOGDB,
     CLO_THROTTLE,
     CLO_NO_THROTTLE,
+    CLO_PROFILE_TURNS,
+    CLO_RECORD_KEYS,
+    CLO_REPLAY_KEYS,
     CLO_LIST_COMBOS, // List species, jobs, and legal combos, in that order.
 #ifdef USE_TILE_WEB
     CLO_WEBTILES_SOCKET,
@@ -4287,11 +4294,13 @@ static const char *cmd_ops[] =
 {
     "scores", "name", "species", "background", "dir", "rc",
     "rcdir", "tscores", "vscores", "scorefile", "morgue", "macro",
-    "mapstat", "objstat", "iters", "arena", "dump-maps", "test", "script",
-    "builddb", "help", "version", "seed", "save-version", "sprint",
-    "extra-opt-first", "extra-opt-last", "sprint-map", "edit-save",
-    "print-charset", "tutorial", "wizard", "explore", "no-save",
-    "gdb", "no-gdb", "nogdb", "throttle", "no-throttle", "list-combos",
+    "mapstat", "objstat", "bench-save", "fuzz-save", "bench", "levelgen",
+    "iters", "arena", "dump-maps", "test", "script", "builddb", "help",
+    "version", "seed", "save-version", "sprint", "extra-opt-first",
+    "extra-opt-last", "sprint-map", "edit-save", "print-charset", "tutorial",
+    "wizard", "explore", "no-save",
+    "gdb", "no-gdb", "nogdb", "throttle", "no-throttle", "profile-turns",
+    "record-keys", "replay-keys", "list-combos",
 #ifdef USE_TILE_WEB
     "webtiles-socket", "await-connection", "print-webtiles-options",
 #endif
@@ -4868,6 +4877,72 @@ bool parse_args(int argc, char **argv, bool rc_only)
             fprintf(stderr, "mapstat and objstat are available only in "
                     "DEBUG_STATISTICS builds.\n");
             end(1);
+#endif
+        case CLO_BENCH_SAVE:
+        case CLO_FUZZ_SAVE:
+#ifdef DEBUG_STATISTICS
+            if (o == CLO_FUZZ_SAVE)
+            {
+                if (!next_is_param)
+                {
+                    fprintf(stderr, "Corpus directory or input file required "
+                            "for -%s\n", arg);
+                    end(1);
+                }
+                SysEnv.save_fuzz_corpus = next_arg;
+                nextUsed = true;
+            }
+            crawl_state.save_bench = true;
+#ifdef USE_TILE_LOCAL
+            crawl_state.tiles_disabled = true;
+#endif
+            if (!SysEnv.map_gen_iters)
+                SysEnv.map_gen_iters = 100;
+            break;
+#else
+            fprintf(stderr, "bench-save and fuzz-save are available only in "
+                    "DEBUG_STATISTICS builds.\n");
+            end(1);
+#endif
+        case CLO_BENCH:
+#ifdef DEBUG_STATISTICS
+            if (!next_is_param)
+            {
+                fprintf(stderr, "Benchmark name required for -%s\n", arg);
+                end(1);
+            }
+            SysEnv.bench_name = next_arg;
+            nextUsed = true;
+#ifdef USE_TILE_LOCAL
+            crawl_state.tiles_disabled = true;
+#endif
+            if (!SysEnv.map_gen_iters)
+                SysEnv.map_gen_iters = 10;
+            break;
+#else
+            fprintf(stderr, "bench is available only in DEBUG_STATISTICS "
+                    "builds.\n");
+            end(1);
+#endif
+        case CLO_LEVELGEN:
+#ifdef DEBUG_STATISTICS
+            if (!next_is_param || !isadigit(*next_arg))
+            {
+                fprintf(stderr, "Number of jobs required for -%s\n", arg);
+                end(1);
+            }
+            SysEnv.levelgen_jobs = max(1, atoi(next_arg));
+            nextUsed = true;
+#ifdef USE_TILE_LOCAL
+            crawl_state.tiles_disabled = true;
+#endif
+            if (!SysEnv.map_gen_iters)
+                SysEnv.map_gen_iters = 10;
+            break;
+#else
+            fprintf(stderr, "levelgen is available only in DEBUG_STATISTICS "
+                    "builds.\n");
+            end(1);
 #endif
         case CLO_ITERATIONS:
 #ifdef DEBUG_STATISTICS
@@ -5147,6 +5222,30 @@ bool parse_args(int argc, char **argv, bool rc_only)
             crawl_state.throttle = false;
             break;
 
+        case CLO_PROFILE_TURNS:
+            if (!next_is_param)
+                return false;
+            if (!rc_only)
+                SysEnv.profile_turns_file = next_arg;
+            nextUsed = true;
+            break;
+
+        case CLO_RECORD_KEYS:
+            if (!next_is_param)
+                return false;
+            if (!rc_only)
+                SysEnv.record_keys_file = next_arg;
+            nextUsed = true;
+            break;
+
+        case CLO_REPLAY_KEYS:
+            if (!next_is_param)
+                return false;
+            if (!rc_only)
+                SysEnv.replay_keys_file = next_arg;
+            nextUsed = true;
+            break;
+
         case CLO_EXTRA_OPT_FIRST:
             if (!next_is_param)
                 return false;
@@ -57,6 +57,12 @@ public:
 
     int map_gen_iters;
     unique_ptr<depth_ranges> map_gen_range;
+    string save_fuzz_corpus;
+    string bench_name;
+    int levelgen_jobs;
+    string profile_turns_file;
+    string record_keys_file;
+    string replay_keys_file;
 
     vector<string> extra_opts_first;
     vector<string> extra_opts_last;
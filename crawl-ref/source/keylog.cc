@@ -0,0 +1,252 @@
+/**
+ * @file
+ * @brief Recording keys read from the terminal, and replaying them.
+ *
+ * -record-keys writes every key the console hands to the game to a file,
+ * along with the times kbhit() said that a key was waiting, since those
+ * interrupt runs and delays. -replay-keys feeds such a file back to the
+ * game under the same seed without drawing anything, and reports how long
+ * the game took to handle each key. Replays are only faithful if they use
+ * the same options and start from the same state (normally a new game),
+ * and if the game is deterministic given its seed.
+ *
+ * The file format is a line per event: a decimal key code, or "k" for a
+ * kbhit(). Lines starting with # are comments, "seed <hex>" gives the
+ * seed the game was played with and "size <cols> <lines>" the size of the
+ * terminal. Only the first size is used, so resizing the terminal while
+ * recording makes for a replay that differs wherever --more-- prompts do.
+**/
+
+#include "AppHdr.h"
+
+#include "keylog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <ctime>
+
+#include "end.h"
+#include "initfile.h"
+#include "options.h"
+#include "random.h"
+#include "state.h"
+#include "syscalls.h"
+#include "version.h"
+
+static const int KEYLOG_KBHIT = INT_MIN;
+
+static FILE *_record = nullptr;
+
+static bool _replaying = false;
+static vector<int> _replay;
+static size_t _replay_pos = 0;
+static int _replay_desyncs = 0;
+static int _replay_cols = 0;
+static int _replay_lines = 0;
+static vector<uint64_t> _latencies;
+static uint64_t _key_given_ns = 0;
+static uint64_t _start_ns = 0;
+static clock_t _start_cpu = 0;
+
+static uint64_t _now_ns()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void _load_replay(const string &filename)
+{
+    FILE *f = fopen_u(filename.c_str(), "r");
+    if (!f)
+        end(1, true, "Can't read the key log %s", filename.c_str());
+
+    char line[80];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        lineno++;
+        int key, cols, lines;
+        uint32_t seed;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        else if (line[0] == 'k')
+            _replay.push_back(KEYLOG_KBHIT);
+        else if (sscanf(line, "seed %x", &seed) == 1)
+            Options.seed = seed;
+        else if (sscanf(line, "size %d %d", &cols, &lines) == 2)
+        {
+            if (!_replay_cols)
+            {
+                _replay_cols = cols;
+                _replay_lines = lines;
+            }
+        }
+        else if (sscanf(line, "%d", &key) == 1)
+            _replay.push_back(key);
+        else
+        {
+            fclose(f);
+            end(1, false, "Bad line %d in the key log %s", lineno,
+                filename.c_str());
+        }
+    }
+    fclose(f);
+}
+
+/**
+ * Open the key logs given on the command line. This is called before the
+ * game is seeded, as the seed is recorded in the log.
+ */
+void keylog_init()
+{
+    if (!SysEnv.replay_keys_file.empty())
+    {
+        _load_replay(SysEnv.replay_keys_file);
+        _replaying = true;
+
+        // A save left behind would be loaded by the next replay.
+        Options.no_save = true;
+        crawl_state.disables.set(DIS_DELAY);
+
+        _start_ns = _now_ns();
+        _start_cpu = clock();
+    }
+
+    if (!SysEnv.record_keys_file.empty())
+    {
+        _record = fopen_u(SysEnv.record_keys_file.c_str(), "w");
+        if (!_record)
+        {
+            end(1, true, "Can't write the key log %s",
+                SysEnv.record_keys_file.c_str());
+        }
+
+        // The game must be seeded for the log to be replayable.
+        while (!Options.seed)
+            Options.seed = random_int();
+
+        fprintf(_record, "# crawl %s key log\nseed %x\n", Version::Long,
+                Options.seed);
+        fflush(_record);
+    }
+}
+
+static void _report_replay()
+{
+    const double wall = (_now_ns() - _start_ns) / 1e9;
+    const double cpu = (double)(clock() - _start_cpu) / CLOCKS_PER_SEC;
+
+    printf("Replayed %u of %u key log events", (unsigned int) _replay_pos,
+           (unsigned int) _replay.size());
+    if (_replay_desyncs)
+        printf(" (%d out of step: the replay diverged)", _replay_desyncs);
+    printf("\nwall %.3f s, cpu %.3f s\n", wall, cpu);
+
+    if (_latencies.empty())
+        return;
+
+    sort(_latencies.begin(), _latencies.end());
+    auto pct = [](double p) {
+        const size_t i = min(_latencies.size() - 1,
+                             (size_t) (p * _latencies.size()));
+        return _latencies[i] / 1e6;
+    };
+    printf("per key (ms): p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+           pct(0.5), pct(0.9), pct(0.99), _latencies.back() / 1e6);
+}
+
+void keylog_shutdown()
+{
+    if (_record)
+    {
+        fclose(_record);
+        _record = nullptr;
+    }
+
+    if (_replaying)
+    {
+        _replaying = false;
+        _report_replay();
+    }
+}
+
+bool keylog_replaying()
+{
+    return _replaying;
+}
+
+bool keylog_replay_size(int &width, int &height)
+{
+    if (!_replay_cols)
+        return false;
+    width = _replay_cols;
+    height = _replay_lines;
+    return true;
+}
+
+void keylog_record_size(int width, int height)
+{
+    if (!_record)
+        return;
+    fprintf(_record, "size %d %d\n", width, height);
+    fflush(_record);
+}
+
+void keylog_record_key(int key)
+{
+    if (!_record)
+        return;
+    fprintf(_record, "%d\n", key);
+    // Keys are slow enough to flush each, and then a crash loses none.
+    fflush(_record);
+}
+
+void keylog_record_kbhit()
+{
+    if (!_record)
+        return;
+    fprintf(_record, "k\n");
+    fflush(_record);
+}
+
+/**
+ * Return the next key of the replay. The time since the last key is taken
+ * to be the time the game spent handling that one.
+ */
+int keylog_replay_key()
+{
+    ASSERT(_replaying);
+
+    const uint64_t now = _now_ns();
+    if (_key_given_ns)
+        _latencies.push_back(now - _key_given_ns);
+
+    // A kbhit() that the game didn't make this time.
+    while (_replay_pos < _replay.size()
+           && _replay[_replay_pos] == KEYLOG_KBHIT)
+    {
+        _replay_desyncs++;
+        _replay_pos++;
+    }
+
+    if (_replay_pos == _replay.size())
+        end(0, false);
+
+    const int key = _replay[_replay_pos++];
+    _key_given_ns = _now_ns();
+    return key;
+}
+
+bool keylog_replay_kbhit()
+{
+    ASSERT(_replaying);
+
+    if (_replay_pos < _replay.size()
+        && _replay[_replay_pos] == KEYLOG_KBHIT)
+    {
+        _replay_pos++;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,23 @@
+/**
+ * @file
+ * @brief Recording keys read from the terminal, and replaying them.
+**/
+
+#ifndef KEYLOG_H
+#define KEYLOG_H
+
+void keylog_init();
+void keylog_shutdown();
+
+bool keylog_replaying();
+bool keylog_replay_size(int &width, int &height);
+
+void keylog_record_size(int width, int height);
+
+void keylog_record_key(int key);
+void keylog_record_kbhit();
+
+int keylog_replay_key();
+bool keylog_replay_kbhit();
+
+#endif
@@ -12,6 +12,7 @@
 #include "chardump.h"
 #include "cluautil.h"
 #include "coordit.h"
+#include "database.h"
 #include "dungeon.h"
 #include "files.h"
 #include "godwrath.h"
@@ -125,6 +126,11 @@ LUAFN(debug_dump_map)
     return 0;
 }
 
+LUAFN(debug_check_desc_search)
+{
+    PLUARET(boolean, checkLongDescSearch(luaL_checkstring(ls, 1)));
+}
+
 LUAFN(_debug_test_explore)
 {
 #ifdef WIZARD
@@ -380,6 +386,7 @@ const struct luaL_reg debug_dlib[] =
 { "los_changed", debug_los_changed },
 { "dump_map", debug_dump_map },
 { "test_explore", _debug_test_explore },
+{ "check_desc_search", debug_check_desc_search },
 { "bouncy_beam", debug_bouncy_beam },
 { "cull_monsters", debug_cull_monsters},
 { "dismiss_adjacent", debug_dismiss_adjacent},
@@ -32,6 +32,8 @@
 
 #include "cio.h"
 #include "crash.h"
+#include "end.h"
+#include "keylog.h"
 #include "state.h"
 #include "unicode.h"
 #include "view.h"
@@ -66,6 +68,41 @@ static int curs_bg_attr(int col);
 
 static bool cursor_is_enabled = true;
 
+// What puttext() last wrote, so that it need only write the cells that have
+// changed since. Anything else written over those cells makes them unknown.
+struct shadow_cell
+{
+    ucs_t glyph;
+    unsigned short colour;
+    bool known;
+};
+
+static vector<shadow_cell> shadow;
+static coord_def shadow_pos(-1, -1); // top left, in curses coordinates
+static coord_def shadow_size;
+static bool shadow_enabled = true;
+
+static puttext_stats pt_stats;
+
+static void _shadow_forget_all()
+{
+    for (shadow_cell &sc : shadow)
+        sc.known = false;
+}
+
+// Forget the cells from x1 up to x2 on row y, in curses coordinates.
+static void _shadow_forget(int y, int x1, int x2)
+{
+    y -= shadow_pos.y;
+    if (y < 0 || y >= shadow_size.y)
+        return;
+
+    x1 = max(x1 - shadow_pos.x, 0);
+    x2 = min(x2 - shadow_pos.x, shadow_size.x);
+    for (int x = x1; x < x2; ++x)
+        shadow[y * shadow_size.x + x].known = false;
+}
+
 static unsigned int convert_to_curses_attr(int chattr)
 {
     switch (chattr & CHATTR_ATTRMASK)
@@ -207,7 +244,7 @@ static int proc_mouse_event(int c, const MEVENT *me)
 
 static int pending = 0;
 
-int getchk()
+static int _getchk()
 {
 #ifdef WATCHDOG
     // If we have (or wait for) actual keyboard input, it's not an infinite
@@ -249,6 +286,16 @@ int getchk()
     return -c;
 }
 
+int getchk()
+{
+    if (keylog_replaying())
+        return keylog_replay_key();
+
+    const int c = _getchk();
+    keylog_record_key(c);
+    return c;
+}
+
 int m_getch()
 {
     int c;
@@ -398,9 +445,56 @@ int unixcurses_get_vi_key(int keyin)
 #define KPADAPP "\033[?1051l\033[?1052l\033[?1060l\033[?1061h"
 #define KPADCUR "\033[?1051l\033[?1052l\033[?1060l\033[?1061l"
 
+// Curses writing to a file rather than the terminal, at the given size if
+// there is one.
+static bool _headless_curses(FILE *out, int width, int height)
+{
+    const char *term = getenv("TERM");
+    if (!term || !*term || !strcmp(term, "dumb"))
+        term = "vt100";
+    if (!out || !newterm(term, out, stdin))
+        return false;
+    _shadow_forget_all();
+
+    if (width && height)
+        resizeterm(height, width);
+
+    start_color();
+    setup_colour_pairs();
+    scrollok(stdscr, FALSE);
+
+    refresh();
+    crawl_view.init_geometry();
+
+    set_mouse_enabled(false);
+    return true;
+}
+
+// Curses writing to nowhere, at the size of the recorded game's terminal.
+static void _headless_startup()
+{
+    int width = 0, height = 0;
+    keylog_replay_size(width, height);
+    if (!_headless_curses(fopen("/dev/null", "w"), width, height))
+        end(1, true, "Can't start curses for the replay");
+}
+
+bool console_startup_headless(FILE *out, int width, int height)
+{
+    return _headless_curses(out, width, height);
+}
+
 void console_startup()
 {
     termio_init();
+    _shadow_forget_all();
+
+    // Replays draw nothing, and may run without a terminal.
+    if (keylog_replaying())
+    {
+        _headless_startup();
+        return;
+    }
 
 #ifdef CURSES_USE_KEYPAD
     // If hardening is enabled (default on recent distributions), glibc
@@ -449,6 +543,8 @@ void console_startup()
 #ifdef USE_TILE_WEB
     tiles.resize();
 #endif
+
+    keylog_record_size(get_number_of_cols(), get_number_of_lines());
 }
 
 void console_shutdown()
@@ -459,7 +555,7 @@ void console_shutdown()
     tcsetattr(0, TCSAFLUSH, &def_term);
 #ifdef CURSES_USE_KEYPAD
     // "if ();" to avoid undisableable spurious warning.
-    if (write(1, KPADCUR, strlen(KPADCUR))) {};
+    if (!keylog_replaying() && write(1, KPADCUR, strlen(KPADCUR))) {};
 #endif
 
 #ifdef USE_UNIX_SIGNALS
@@ -491,8 +587,12 @@ void putwch(ucs_t chr)
     wchar_t c = chr;
     if (!c)
         c = ' ';
+    int y, x, y2, x2;
+    getyx(stdscr, y, x);
     // TODO: recognize unsupported characters and try to transliterate
     addnwstr(&c, 1);
+    getyx(stdscr, y2, x2);
+    _shadow_forget(y, x, y2 == y ? x2 : COLS);
 
 #ifdef USE_TILE_WEB
     ucs_t buf[2];
@@ -502,7 +602,8 @@ void putwch(ucs_t chr)
 #endif
 }
 
-void puttext(int x1, int y1, const crawl_view_buffer &vbuf)
+// Write every cell, as puttext() did before it kept a shadow.
+static void _puttext_all(int x1, int y1, const crawl_view_buffer &vbuf)
 {
     const screen_cell_t *cell = vbuf;
     const coord_def size = vbuf.size();
@@ -515,9 +616,118 @@ void puttext(int x1, int y1, const crawl_view_buffer &vbuf)
             cell++;
         }
     }
+    pt_stats.frames++;
+    pt_stats.cells += size.x * size.y;
+    pt_stats.moves += size.y;
+    pt_stats.colours += size.x * size.y;
     update_screen();
 }
 
+static inline bool _shadow_matches(const shadow_cell &sc,
+                                   const screen_cell_t &cell)
+{
+    return sc.known && sc.glyph == cell.glyph && sc.colour == cell.colour;
+}
+
+/**
+ * Write a buffer of cells to the screen. Only the cells that differ from
+ * the shadow of the last buffer written at the same place are written,
+ * a run of them at a time, and the colour is only set when it changes.
+ */
+void puttext(int x1, int y1, const crawl_view_buffer &vbuf)
+{
+    if (!shadow_enabled)
+    {
+        _puttext_all(x1, y1, vbuf);
+        return;
+    }
+
+    const screen_cell_t *cells = vbuf;
+    const coord_def size = vbuf.size();
+
+    cgotoxy(x1, y1);
+    coord_def pos;
+    getyx(stdscr, pos.y, pos.x);
+    if (pos != shadow_pos || size != shadow_size)
+    {
+        shadow_pos = pos;
+        shadow_size = size;
+        shadow.assign(size.x * size.y, shadow_cell());
+    }
+
+    static vector<wchar_t> run;
+    run.resize(size.x + 1);
+#ifdef USE_TILE_WEB
+    static vector<ucs_t> ucs_run;
+    ucs_run.resize(size.x + 1);
+#endif
+
+    // The colour set so far; curses keeps it across cursor moves.
+    int colour = -1;
+    for (int y = 0; y < size.y; ++y)
+    {
+        const screen_cell_t *row = cells + y * size.x;
+        shadow_cell *srow = &shadow[y * size.x];
+        int x = 0;
+        while (x < size.x)
+        {
+            if (_shadow_matches(srow[x], row[x]))
+            {
+                ++x;
+                continue;
+            }
+
+            cgotoxy(x1 + x, y1 + y);
+            pt_stats.moves++;
+            // Write up to the next cell that is already right, in a string
+            // per colour.
+            while (x < size.x && !_shadow_matches(srow[x], row[x]))
+            {
+                if (row[x].colour != colour)
+                {
+                    colour = row[x].colour;
+                    textcolour(colour);
+                    pt_stats.colours++;
+                }
+
+                int len = 0;
+                for (; x < size.x && row[x].colour == colour
+                       && !_shadow_matches(srow[x], row[x]); ++x)
+                {
+                    const ucs_t glyph = row[x].glyph ? row[x].glyph : ' ';
+                    run[len] = glyph;
+#ifdef USE_TILE_WEB
+                    ucs_run[len] = glyph;
+#endif
+                    len++;
+                    srow[x].glyph = row[x].glyph;
+                    srow[x].colour = row[x].colour;
+                    srow[x].known = true;
+                }
+                addnwstr(&run[0], len);
+#ifdef USE_TILE_WEB
+                ucs_run[len] = 0;
+                tiles.put_ucs_string(&ucs_run[0]);
+#endif
+                pt_stats.cells += len;
+            }
+        }
+    }
+    pt_stats.frames++;
+    update_screen();
+}
+
+void puttext_set_shadow(bool enabled)
+{
+    shadow_enabled = enabled;
+    _shadow_forget_all();
+}
+
+puttext_stats &get_puttext_stats()
+{
+    return pt_stats;
+}
+
 // These next four are front functions so that we can reduce
 // the amount of curses special code that occurs outside this
 // this file.  This is good, since there are some issues with
@@ -536,6 +746,9 @@ void clear_to_end_of_line()
 {
     textcolour(LIGHTGREY);
     textbackground(BLACK);
+    int y, x;
+    getyx(stdscr, y, x);
+    _shadow_forget(y, x, COLS);
     clrtoeol();
 
 #ifdef USE_TILE_WEB
@@ -563,6 +776,7 @@ void clrscr()
     textcolour(LIGHTGREY);
     textbackground(BLACK);
     clear();
+    _shadow_forget_all();
 #ifdef DGAMELAUNCH
     printf("%s", DGL_CLEAR_SCREEN);
     fflush(stdout);
@@ -767,6 +981,8 @@ static inline void write_char_at(int y, int x, const cchar_t &ch)
 {
     move(y, x);
     add_wchnstr(&ch, 1);
+    // Wide characters cover the next cell too.
+    _shadow_forget(y, x, x + 2);
 }
 
 static void flip_colour(cchar_t &ch)
@@ -840,7 +1056,7 @@ void delay(unsigned int time)
 }
 
 /* This is Juho Snellman's modified kbhit, to work with macros */
-bool kbhit()
+static bool _kbhit()
 {
     if (pending)
         return true;
@@ -874,3 +1090,14 @@ bool kbhit()
     return result;
 #endif
 }
+
+bool kbhit()
+{
+    if (keylog_replaying())
+        return keylog_replay_kbhit();
+
+    const bool hit = _kbhit();
+    if (hit)
+        keylog_record_kbhit();
+    return hit;
+}
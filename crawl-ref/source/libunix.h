@@ -21,5 +21,18 @@ static inline constexpr bool is_tiles() { return false; }
 
 extern int unixcurses_get_vi_key(int keyin);
 
+// Counts of what puttext() asked of curses.
+struct puttext_stats
+{
+    uint64_t frames;
+    uint64_t cells;     // cells written
+    uint64_t moves;     // cursor moves
+    uint64_t colours;   // colour changes
+};
+
+bool console_startup_headless(FILE *out, int width, int height);
+void puttext_set_shadow(bool enabled);
+puttext_stats &get_puttext_stats();
+
 #endif
 #endif
@@ -34,6 +34,8 @@
  * filling a list of all relevant rays in one quadrant,
  * and filling data structures that allow calculating LOS
  * in a quadrant without checking each ray.
+ * The rays are cached in the data file cache, so usually
+ * only the first start-up of a version needs to cast them.
  *
  * The code provides functions for filling LOS information
  * around a given center efficiently, and for querying rays
@@ -46,12 +48,28 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <set>
 
 #include "areas.h"
 #include "coord.h"
 #include "coordit.h"
 #include "env.h"
+#include "files.h"
 #include "losglobal.h"
+#include "maps.h"
+#include "syscalls.h"
+#include "tags.h"
+#include "version.h"
+
+// The vectorised losight kernels need target attributes to compile
+// without enabling SSE2/AVX2 for the whole build.
+#if (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__clang__) \
+        || __GNUC__ > 4 || __GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+# define LOS_X86_KERNELS
+# include <immintrin.h>
+#endif
 
 // These determine what rays are cast in the precomputation,
 // and affect start-up time significantly.
@@ -68,14 +86,25 @@ struct los_ray;
 static vector<los_ray> fullrays;
 static vector<coord_def> ray_coords;
 
+// A set of minimal cellrays. This is wide enough for LOS_RADIUS 8,
+// which has about 260 minimal cellrays; only the first ray_words
+// words are used. Aligned for the vector kernels.
+#define LOS_MAX_CELLRAYS 1024
+struct alignas(32) cellray_set
+{
+    uint64_t words[LOS_MAX_CELLRAYS / 64];
+};
+
 // These store all unique minimal cellrays. For each i,
 // cellray i ends in cellray_ends[i] and passes through
-// thoses cells p that have blockrays(p)[i] set. In other
-// words, blockrays(p)[i] is set iff an opaque cell p blocks
+// thoses cells p that have bit i of blockrays(p) set. In other
+// words, that bit is set iff an opaque cell p blocks
 // the cellray with index i.
 static vector<coord_def> cellray_ends;
-typedef FixedArray<bit_vector*, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> blockrays_t;
+typedef FixedArray<cellray_set, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> blockrays_t;
 static blockrays_t blockrays;
+// Number of words of a cellray_set in use, a multiple of 4.
+static int ray_words = 0;
 
 // We also store the minimal cellrays by target position
 // for efficient retrieval by find_ray.
@@ -83,12 +112,6 @@ static blockrays_t blockrays;
 struct cellray;
 static FixedArray<vector<cellray>, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> min_cellrays;
 
-// Temporary arrays used in losight() to track which rays
-// are blocked or have seen a smoke cloud.
-// Allocated when doing the precomputations.
-static bit_vector *dead_rays     = nullptr;
-static bit_vector *smoke_rays    = nullptr;
-
 class quadrant_iterator : public rectangle_iterator
 {
 public:
@@ -99,18 +122,11 @@ public:
     }
 };
 
-void clear_rays_on_exit()
-{
-    delete dead_rays;
-    delete smoke_rays;
-    for (quadrant_iterator qi; qi; ++qi)
-        delete blockrays(*qi);
-}
-
 // Pre-squared LOS radius.
 int los_radius2 = LOS_RADIUS_SQ;
 
 static void _handle_los_change();
+static void _choose_los_kernel();
 
 void set_los_radius(int r)
 {
@@ -174,26 +190,6 @@ struct los_ray : public ray_def
     }
 };
 
-// Check if the passed rays have identical footprint.
-static bool _is_same_ray(los_ray ray, vector<coord_def> newray)
-{
-    if (ray.length != newray.size())
-        return false;
-    for (unsigned int i = 0; i < ray.length; i++)
-        if (ray[i] != newray[i])
-            return false;
-    return true;
-}
-
-// Check if the passed ray has already been created.
-static bool _is_duplicate_ray(vector<coord_def> newray)
-{
-    for (los_ray lray : fullrays)
-        if (_is_same_ray(lray, newray))
-            return true;
-    return false;
-}
-
 // A cellray given by fullray and index of end-point.
 struct cellray
 {
@@ -299,9 +295,8 @@ static compare_type _compare_cellrays(const cellray& a, const cellray& b)
 }
 
 // Determine all minimal cellrays.
-// They're stored globally by target in min_cellrays,
-// and returned as a list of indices into ray_coords.
-static vector<int> _find_minimal_cellrays()
+// They're stored globally by target in min_cellrays.
+static void _find_minimal_cellrays()
 {
     FixedArray<list<cellray>, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> minima;
     list<cellray>::iterator min_it;
@@ -344,29 +339,25 @@ static vector<int> _find_minimal_cellrays()
         }
     }
 
-    vector<int> result;
     for (quadrant_iterator qi; qi; ++qi)
     {
         list<cellray>& min = minima(*qi);
+        // Calculate imbalance and slope difference for sorting.
         for (min_it = min.begin(); min_it != min.end(); ++min_it)
-        {
-            // Calculate imbalance and slope difference for sorting.
             min_it->calc_params();
-            result.push_back(min_it->index());
-        }
         min.sort(_is_better);
         min_cellrays(*qi) = vector<cellray>(min.begin(), min.end());
     }
-    return result;
 }
 
-// Create and register the ray defined by the arguments.
-static void _register_ray(geom::ray r)
+// Create and register the ray defined by the arguments, unless a ray
+// with the same footprint has already been registered.
+static void _register_ray(geom::ray r, set<vector<coord_def>>& footprints)
 {
     los_ray ray = los_ray(r);
     vector<coord_def> coords = ray.footprint();
 
-    if (coords.empty() || _is_duplicate_ray(coords))
+    if (coords.empty() || !footprints.insert(coords).second)
         return;
 
     ray.start = ray_coords.size();
@@ -376,57 +367,34 @@ static void _register_ray(geom::ray r)
     fullrays.push_back(ray);
 }
 
+// Number the minimal cellrays and calculate, for each cell, which
+// of them it blocks.
 static void _create_blockrays()
 {
-    // First, we calculate blocking information for all cell rays.
-    // Cellrays are numbered according to the index of their end
-    // cell in ray_coords.
-    const int n_cellrays = ray_coords.size();
-    blockrays_t all_blockrays;
+    unsigned int n_min_rays = 0;
     for (quadrant_iterator qi; qi; ++qi)
-        all_blockrays(*qi) = new bit_vector(n_cellrays);
-
-    for (los_ray ray : fullrays)
-    {
-        for (unsigned int i = 0; i < ray.length; ++i)
-        {
-            // Every cell is contained in (thus blocks)
-            // all following cellrays.
-            for (unsigned int j = i + 1; j < ray.length; ++j)
-                all_blockrays(ray[i])->set(ray.start + j);
-        }
-    }
-
-    // We've built the basic blockray array; now compress it, keeping
-    // only the nonduplicated cellrays.
+        n_min_rays += min_cellrays(*qi).size();
 
-    // Determine minimal cellrays and store their indices in ray_coords.
-    vector<int> min_indices = _find_minimal_cellrays();
-    const int n_min_rays    = min_indices.size();
-    cellray_ends.resize(n_min_rays);
-    for (int i = 0; i < n_min_rays; ++i)
-        cellray_ends[i] = ray_coords[min_indices[i]];
+    ASSERT(n_min_rays <= LOS_MAX_CELLRAYS);
+    ray_words = (n_min_rays + 255) / 256 * 4;
 
-    // Compress blockrays accordingly.
+    cellray_ends.clear();
+    cellray_ends.reserve(n_min_rays);
     for (quadrant_iterator qi; qi; ++qi)
     {
-        blockrays(*qi) = new bit_vector(n_min_rays);
-        for (int i = 0; i < n_min_rays; ++i)
+        for (cellray c : min_cellrays(*qi))
         {
-            blockrays(*qi)->set(i, all_blockrays(*qi)
-                                   ->get(min_indices[i]));
+            // Every cell before the end blocks the cellray.
+            const unsigned int idx = cellray_ends.size();
+            for (unsigned int i = 0; i < c.end; ++i)
+                blockrays(c[i]).words[idx / 64] |= 1ULL << (idx % 64);
+            cellray_ends.push_back(c.target());
         }
     }
 
-    // We can throw away all_blockrays now.
-    for (quadrant_iterator qi; qi; ++qi)
-        delete all_blockrays(*qi);
-
-    dead_rays  = new bit_vector(n_min_rays);
-    smoke_rays = new bit_vector(n_min_rays);
-
-    dprf("Cellrays: %d Fullrays: %u Minimal cellrays: %u",
-          n_cellrays, (unsigned int)fullrays.size(), n_min_rays);
+    dprf("Cellrays: %u Fullrays: %u Minimal cellrays: %u",
+          (unsigned int)ray_coords.size(), (unsigned int)fullrays.size(),
+          n_min_rays);
 }
 
 static int _gcd(int x, int y)
@@ -447,21 +415,17 @@ static bool _complexity_lt(const pair<int,int>& lhs, const pair<int,int>& rhs)
     return lhs.first * lhs.second < rhs.first * rhs.second;
 }
 
-// Cast all rays
-static void raycast()
+// Cast all rays, creating all rays for first quadrant.
+// We have a considerable amount of overkill.
+static void _cast_rays()
 {
-    static bool done_raycast = false;
-    if (done_raycast)
-        return;
-
-    // Creating all rays for first quadrant
-    // We have a considerable amount of overkill.
-    done_raycast = true;
+    // The footprints registered so far, for finding duplicates.
+    set<vector<coord_def>> footprints;
 
     // register perpendiculars FIRST, to make them top choice
     // when selecting beams
-    _register_ray(geom::ray(0.5, 0.5, 0.0, 1.0));
-    _register_ray(geom::ray(0.5, 0.5, 1.0, 0.0));
+    _register_ray(geom::ray(0.5, 0.5, 0.0, 1.0), footprints);
+    _register_ray(geom::ray(0.5, 0.5, 1.0, 0.0), footprints);
 
     // For a slope of M = y/x, every x we move on the X axis means
     // that we move y on the y axis. We want to look at the resolution
@@ -490,11 +454,214 @@ static void raycast()
             double xstart = ((double)intercept) / (LOS_INTERCEPT_MULT*yangle);
             double ystart = 0.5;
 
-            _register_ray(geom::ray(xstart, ystart, xangle, yangle));
+            _register_ray(geom::ray(xstart, ystart, xangle, yangle),
+                          footprints);
             // also draw the identical ray in octant 2
-            _register_ray(geom::ray(ystart, xstart, yangle, xangle));
+            _register_ray(geom::ray(ystart, xstart, yangle, xangle),
+                          footprints);
         }
     }
+}
+
+// The precomputed rays are cached in the data file cache, next to
+// the compiled maps. Rays and cellrays are stored in the order they
+// were found, so find_ray() cycles through them just as it would
+// after casting them afresh.
+static string _ray_cache_file()
+{
+    return get_descache_path("los", ".cache");
+}
+
+static void _marshall_double(writer &th, double d)
+{
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    marshallUnsigned(th, bits);
+}
+
+static double _unmarshall_double(reader &th)
+{
+    const uint64_t bits = unmarshallUnsigned(th);
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+// The precomputation depends on the constants above and on the
+// ray geometry in ray.cc, so the cache is only valid for the same
+// version with the same constants.
+static void _marshall_ray_cache_header(writer &th)
+{
+    marshallString(th, Version::Long);
+    marshallByte(th, LOS_MAX_RANGE);
+    marshallShort(th, LOS_RADIUS_SQ);
+    marshallByte(th, LOS_MAX_ANGLE);
+    marshallByte(th, LOS_INTERCEPT_MULT);
+}
+
+static bool _ray_cache_header_ok(reader &th)
+{
+    return unmarshallString(th) == Version::Long
+           && unmarshallByte(th) == LOS_MAX_RANGE
+           && unmarshallShort(th) == LOS_RADIUS_SQ
+           && unmarshallByte(th) == LOS_MAX_ANGLE
+           && unmarshallByte(th) == LOS_INTERCEPT_MULT;
+}
+
+// Index of the given ray in fullrays.
+static int _fullray_index(const los_ray &ray)
+{
+    for (unsigned int i = 0; i < fullrays.size(); ++i)
+        if (fullrays[i].start == ray.start)
+            return i;
+    die("cellray without fullray");
+}
+
+static void _write_ray_cache()
+{
+    vector<unsigned char> buf;
+    writer th(&buf);
+    _marshall_ray_cache_header(th);
+
+    marshallInt(th, fullrays.size());
+    for (const los_ray &ray : fullrays)
+    {
+        _marshall_double(th, ray.r.start.x);
+        _marshall_double(th, ray.r.start.y);
+        _marshall_double(th, ray.r.dir.x);
+        _marshall_double(th, ray.r.dir.y);
+        marshallInt(th, ray.start);
+        marshallInt(th, ray.length);
+    }
+
+    marshallInt(th, ray_coords.size());
+    for (coord_def c : ray_coords)
+        marshallCoord(th, c);
+
+    for (quadrant_iterator qi; qi; ++qi)
+    {
+        marshallInt(th, min_cellrays(*qi).size());
+        for (const cellray &c : min_cellrays(*qi))
+        {
+            marshallInt(th, _fullray_index(c.ray));
+            marshallInt(th, c.end);
+            marshallInt(th, c.imbalance);
+            marshallBoolean(th, c.first_diag);
+        }
+    }
+
+    const string file = _ray_cache_file();
+    file_lock lock(file + ".lk", "wb", false);
+    if (FILE *fp = fopen_replace(file.c_str()))
+    {
+        if (fwrite(&buf[0], buf.size(), 1, fp) != 1)
+        {
+            fclose(fp);
+            unlink_u(file.c_str());
+            return;
+        }
+        fclose(fp);
+    }
+}
+
+static bool _read_ray_cache(reader &th)
+{
+    if (!_ray_cache_header_ok(th))
+        return false;
+
+    const unsigned int n_fullrays = unmarshallInt(th);
+    for (unsigned int i = 0; i < n_fullrays; ++i)
+    {
+        const double x0 = _unmarshall_double(th);
+        const double y0 = _unmarshall_double(th);
+        const double xd = _unmarshall_double(th);
+        const double yd = _unmarshall_double(th);
+        los_ray ray(geom::ray(x0, y0, xd, yd));
+        ray.start = unmarshallInt(th);
+        ray.length = unmarshallInt(th);
+        fullrays.push_back(ray);
+    }
+
+    const unsigned int n_coords = unmarshallInt(th);
+    for (unsigned int i = 0; i < n_coords; ++i)
+    {
+        const coord_def c = unmarshallCoord(th);
+        if (c.x < 0 || c.y < 0 || c.abs() > LOS_RADIUS_SQ)
+            return false;
+        ray_coords.push_back(c);
+    }
+
+    for (const los_ray &ray : fullrays)
+        if (ray.length == 0 || ray.start + ray.length > n_coords)
+            return false;
+
+    for (quadrant_iterator qi; qi; ++qi)
+    {
+        const unsigned int n_min = unmarshallInt(th);
+        for (unsigned int i = 0; i < n_min; ++i)
+        {
+            const unsigned int ray = unmarshallInt(th);
+            const unsigned int end = unmarshallInt(th);
+            if (ray >= n_fullrays || end >= fullrays[ray].length)
+                return false;
+            cellray c(fullrays[ray], end);
+            c.imbalance = unmarshallInt(th);
+            c.first_diag = unmarshallBoolean(th);
+            if (c.target() != *qi)
+                return false;
+            min_cellrays(*qi).push_back(c);
+        }
+    }
+    return true;
+}
+
+// Load the precomputed rays from the cache, if it's valid.
+static bool _load_ray_cache()
+{
+    const string file = _ray_cache_file();
+    file_lock lock(file + ".lk", "rb", false);
+    FILE *fp = fopen_u(file.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    bool ok;
+    try
+    {
+        reader th(fp, TAG_MINOR_VERSION);
+        th.set_safe_read(true);
+        ok = _read_ray_cache(th);
+    }
+    catch (short_read_exception &E)
+    {
+        ok = false;
+    }
+    fclose(fp);
+
+    if (!ok)
+    {
+        fullrays.clear();
+        ray_coords.clear();
+        for (quadrant_iterator qi; qi; ++qi)
+            min_cellrays(*qi).clear();
+    }
+    return ok;
+}
+
+static void raycast()
+{
+    static bool done_raycast = false;
+    if (done_raycast)
+        return;
+
+    done_raycast = true;
+    _choose_los_kernel();
+
+    if (!_load_ray_cache())
+    {
+        _cast_rays();
+        _find_minimal_cellrays();
+        _write_ray_cache();
+    }
 
     // Now create the appropriate blockrays array
     _create_blockrays();
@@ -645,6 +812,29 @@ bool find_ray(const coord_def& source, const coord_def& target,
     return true;
 }
 
+// The cells, relative to the origin, that the minimal cellrays to
+// target pass through: whether target is visible depends only on
+// their opacity. A target on an axis is seen from two quadrants.
+vector<coord_def> los_ray_cells(const coord_def& target)
+{
+    ASSERT(target.abs() <= LOS_RADIUS_SQ);
+
+    raycast();
+
+    const coord_def abs_target(abs(target.x), abs(target.y));
+    set<coord_def> cells;
+    for (int sx = -1; sx <= 1; sx += 2)
+        for (int sy = -1; sy <= 1; sy += 2)
+        {
+            if (sx * target.x < 0 || sy * target.y < 0)
+                continue;
+            for (cellray c : min_cellrays(abs_target))
+                for (unsigned int i = 0; i < c.end; ++i)
+                    cells.insert(coord_def(sx * c[i].x, sy * c[i].y));
+        }
+    return vector<coord_def>(cells.begin(), cells.end());
+}
+
 bool exists_ray(const coord_def& source, const coord_def& target,
                 const opacity_func& opc, int range)
 {
@@ -776,21 +966,183 @@ bool cell_see_cell_nocache(const coord_def& p1, const coord_def& p2)
 // proper, of the original path. We still store the original cellrays
 // fully for beam detection and such.
 // PERFORMANCE:
-// With reasonable values we have around 6000 cellrays, meaning
-// around 600Kb (75 KB) of data. This gets cut down to 700 cellrays
-// after removing duplicates. That means that we need to do
-// around 22*100*4 ~ 9,000 memory reads + writes per LOS call on a
-// 32-bit system. Not too bad.
+// With LOS_RADIUS 8 we have around 740 cellrays, cut down to 257
+// minimal cellrays, so each cell's blockrays fit in eight 64-bit
+// words. Uniting the blockrays of a quadrant is done with SSE2 or
+// AVX2 where the CPU has them; see los_kernel_type.
 // IMPROVEMENTS:
 // Smoke will now only block LOS after two cells of smoke. This is
 // done by updating with a second array.
 
-static void _losight_quadrant(los_grid& sh, const los_param& dat, int sx, int sy)
+// The opaque and half-opaque cells of one quadrant, as their blockrays.
+struct quadrant_blockers
 {
-    const unsigned int num_cellrays = cellray_ends.size();
+    const cellray_set *opaque[(LOS_MAX_RANGE+1) * (LOS_MAX_RANGE+1)];
+    const cellray_set *half[(LOS_MAX_RANGE+1) * (LOS_MAX_RANGE+1)];
+    int n_opaque;
+    int n_half;
+};
+
+// Find the cellrays that are blocked, by an opaque cell or by their
+// second half-opaque cell. This is the inner loop of losight, so there
+// are vectorised versions; they all work on ray_words at a time.
+typedef void (*dead_rays_func)(const quadrant_blockers &b, cellray_set &dead);
+
+static void _dead_rays_scalar(const quadrant_blockers &b, cellray_set &dead)
+{
+    for (int w = 0; w < ray_words; ++w)
+    {
+        uint64_t blocked = 0;
+        uint64_t smoke = 0;
+        for (int i = 0; i < b.n_opaque; ++i)
+            blocked |= b.opaque[i]->words[w];
+        for (int i = 0; i < b.n_half; ++i)
+        {
+            // Block rays which have already seen a cloud.
+            blocked |= smoke & b.half[i]->words[w];
+            smoke |= b.half[i]->words[w];
+        }
+        dead.words[w] = blocked;
+    }
+}
+
+#ifdef LOS_X86_KERNELS
+__attribute__((target("sse2")))
+static void _dead_rays_sse2(const quadrant_blockers &b, cellray_set &dead)
+{
+    for (int w = 0; w < ray_words; w += 2)
+    {
+        __m128i blocked = _mm_setzero_si128();
+        __m128i smoke = _mm_setzero_si128();
+        for (int i = 0; i < b.n_opaque; ++i)
+        {
+            blocked = _mm_or_si128(blocked, _mm_load_si128(
+                reinterpret_cast<const __m128i*>(&b.opaque[i]->words[w])));
+        }
+        for (int i = 0; i < b.n_half; ++i)
+        {
+            const __m128i half = _mm_load_si128(
+                reinterpret_cast<const __m128i*>(&b.half[i]->words[w]));
+            blocked = _mm_or_si128(blocked, _mm_and_si128(smoke, half));
+            smoke = _mm_or_si128(smoke, half);
+        }
+        _mm_store_si128(reinterpret_cast<__m128i*>(&dead.words[w]), blocked);
+    }
+}
+
+__attribute__((target("avx2")))
+static void _dead_rays_avx2(const quadrant_blockers &b, cellray_set &dead)
+{
+    for (int w = 0; w < ray_words; w += 4)
+    {
+        __m256i blocked = _mm256_setzero_si256();
+        __m256i smoke = _mm256_setzero_si256();
+        for (int i = 0; i < b.n_opaque; ++i)
+        {
+            blocked = _mm256_or_si256(blocked, _mm256_load_si256(
+                reinterpret_cast<const __m256i*>(&b.opaque[i]->words[w])));
+        }
+        for (int i = 0; i < b.n_half; ++i)
+        {
+            const __m256i half = _mm256_load_si256(
+                reinterpret_cast<const __m256i*>(&b.half[i]->words[w]));
+            blocked = _mm256_or_si256(blocked, _mm256_and_si256(smoke, half));
+            smoke = _mm256_or_si256(smoke, half);
+        }
+        _mm256_store_si256(reinterpret_cast<__m256i*>(&dead.words[w]),
+                           blocked);
+    }
+}
+#endif
+
+static const dead_rays_func dead_rays_funcs[] =
+{
+    _dead_rays_scalar,
+#ifdef LOS_X86_KERNELS
+    _dead_rays_sse2,
+    _dead_rays_avx2,
+#else
+    nullptr,
+    nullptr,
+#endif
+};
+COMPILE_CHECK(ARRAYSZ(dead_rays_funcs) == NUM_LOS_KERNELS);
 
-    dead_rays->reset();
-    smoke_rays->reset();
+static const char *los_kernel_names[] =
+{
+    "scalar", "sse2", "avx2",
+};
+COMPILE_CHECK(ARRAYSZ(los_kernel_names) == NUM_LOS_KERNELS);
+
+static los_kernel_type los_kernel = LOS_KERNEL_SCALAR;
+static dead_rays_func find_dead_rays = _dead_rays_scalar;
+
+bool los_kernel_supported(los_kernel_type kernel)
+{
+    switch (kernel)
+    {
+    case LOS_KERNEL_SCALAR:
+        return true;
+#ifdef LOS_X86_KERNELS
+    case LOS_KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case LOS_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+void set_los_kernel(los_kernel_type kernel)
+{
+    ASSERT(los_kernel_supported(kernel));
+    los_kernel = kernel;
+    find_dead_rays = dead_rays_funcs[kernel];
+}
+
+los_kernel_type get_los_kernel()
+{
+    return los_kernel;
+}
+
+const char *los_kernel_name(los_kernel_type kernel)
+{
+    ASSERT_RANGE(kernel, 0, NUM_LOS_KERNELS);
+    return los_kernel_names[kernel];
+}
+
+// Use the best kernel this CPU supports.
+static void _choose_los_kernel()
+{
+    for (int k = NUM_LOS_KERNELS - 1; k >= 0; --k)
+    {
+        if (los_kernel_supported(static_cast<los_kernel_type>(k)))
+        {
+            set_los_kernel(static_cast<los_kernel_type>(k));
+            break;
+        }
+    }
+    dprf("LOS kernel: %s", los_kernel_name(los_kernel));
+}
+
+static inline int _lowest_bit(uint64_t x)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(x);
+#else
+    int b = 0;
+    for (; !(x & 1); x >>= 1)
+        ++b;
+    return b;
+#endif
+}
+
+static void _losight_quadrant(los_grid& sh, const los_param& dat, int sx, int sy)
+{
+    quadrant_blockers blockers;
+    blockers.n_opaque = 0;
+    blockers.n_half = 0;
 
     for (quadrant_iterator qi; qi; ++qi)
     {
@@ -801,27 +1153,31 @@ static void _losight_quadrant(los_grid& sh, const los_param& dat, int sx, int sy
         switch (dat.opacity(p))
         {
         case OPC_OPAQUE:
-            // Block the appropriate rays.
-            *dead_rays |= *blockrays(*qi);
+            blockers.opaque[blockers.n_opaque++] = &blockrays(*qi);
             break;
         case OPC_HALF:
-            // Block rays which have already seen a cloud.
-            *dead_rays  |= (*smoke_rays & *blockrays(*qi));
-            *smoke_rays |= *blockrays(*qi);
+            blockers.half[blockers.n_half++] = &blockrays(*qi);
             break;
         default:
             break;
         }
     }
 
+    cellray_set dead_rays;
+    find_dead_rays(blockers, dead_rays);
+
     // Ray calculation done. Now work out which cells in this
     // quadrant are visible.
-    for (unsigned int rayidx = 0; rayidx < num_cellrays; ++rayidx)
+    const unsigned int num_cellrays = cellray_ends.size();
+    for (int w = 0; w < ray_words; ++w)
     {
-        // make the cells seen by this ray at this point visible
-        if (!dead_rays->get(rayidx))
+        // Make the cells seen by the rays that are alive visible.
+        for (uint64_t alive = ~dead_rays.words[w]; alive; alive &= alive - 1)
         {
-            // This ray is alive, thus the end cell is visible.
+            const unsigned int rayidx = w * 64 + _lowest_bit(alive);
+            if (rayidx >= num_cellrays)
+                break;
+
             const coord_def p = coord_def(sx * cellray_ends[rayidx].x,
                                           sy * cellray_ends[rayidx].y);
             if (dat.los_bounds(p))
@@ -38,10 +38,10 @@ int num_feats_between(const coord_def& source, const coord_def& target,
                       bool exclude_endpoints = true,
                       bool just_check = false);
 bool cell_see_cell_nocache(const coord_def& p1, const coord_def& p2);
+vector<coord_def> los_ray_cells(const coord_def& target);
 
 typedef SquareArray<bool, LOS_MAX_RANGE> los_grid;
 
-void clear_rays_on_exit();
 void losight(los_grid& sh, const coord_def& center,
              const opacity_func &opc = opc_default,
              const circle_def &bds = BDS_DEFAULT);
@@ -51,4 +51,19 @@ void los_monster_died(const monster* mon);
 void los_terrain_changed(const coord_def& p);
 void los_changed();
 opacity_type mons_opacity(const monster* mon, los_type how);
+
+// Implementations of the inner loop of losight(). The best one the CPU
+// supports is chosen automatically.
+enum los_kernel_type
+{
+    LOS_KERNEL_SCALAR,
+    LOS_KERNEL_SSE2,
+    LOS_KERNEL_AVX2,
+    NUM_LOS_KERNELS
+};
+
+bool los_kernel_supported(los_kernel_type kernel);
+void set_los_kernel(los_kernel_type kernel);
+los_kernel_type get_los_kernel();
+const char *los_kernel_name(los_kernel_type kernel);
 #endif
@@ -7,6 +7,8 @@
 
 #include "los_def.h"
 
+#include "turnprof.h"
+
 
 los_def::los_def()
     : show(0), opc(opc_default.clone()), bds(BDS_DEFAULT)
@@ -51,6 +53,7 @@ los_def::~los_def()
 
 void los_def::update()
 {
+    turn_phase_timer timer(TPHASE_LOS);
     losight(show, center, *opc, bds);
 }
 
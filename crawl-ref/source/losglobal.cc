@@ -2,9 +2,12 @@
 
 #include "losglobal.h"
 
+#include <set>
+
 #include "coord.h"
 #include "coordit.h"
 #include "libutil.h"
+#include "los.h"
 #include "los_def.h"
 
 #define LOS_KNOWN 4
@@ -17,6 +20,16 @@ typedef halflos_t globallos_t[GXM][GYM];
 
 static globallos_t globallos;
 
+// For each offset r in the right half-plane, the entries of the
+// halflos_t of a cell p (as indices into the flattened table) whose
+// visibility depends on the opacity of p + r.
+static vector<uint8_t> los_dependents[LOS_MAX_RANGE+1][2*LOS_MAX_RANGE+1];
+static bool los_dependents_known = false;
+
+#ifdef DEBUG_DIAGNOSTICS
+static globallos_stats los_stats;
+#endif
+
 static losfield_t* _lookup_globallos(const coord_def& p, const coord_def& q)
 {
     COMPILE_CHECK(LOS_KNOWN * 2 <= sizeof(losfield_t) * 8);
@@ -58,17 +71,65 @@ static void _save_los(los_def* los, los_type l)
         }
 }
 
-// Opacity at p has changed.
+// The visibility between p and q = p + d is stored with p, and may
+// have been calculated from either end, so it depends on the cells on
+// rays from p to q as well as on those on rays from q to p.
+static void _init_los_dependents()
+{
+    if (los_dependents_known)
+        return;
+    los_dependents_known = true;
+
+    COMPILE_CHECK(sizeof(halflos_t) <= 256);
+    for (int x = 0; x <= LOS_MAX_RANGE; ++x)
+        for (int y = -LOS_MAX_RANGE; y <= LOS_MAX_RANGE; ++y)
+        {
+            const coord_def d(x, y);
+            if (d < coord_def(0, 0) || d.origin()
+                || d.abs() > LOS_RADIUS_SQ)
+            {
+                continue;
+            }
+
+            set<coord_def> cells;
+            for (coord_def r : los_ray_cells(d))
+                cells.insert(r);
+            for (coord_def r : los_ray_cells(-d))
+                cells.insert(d + r);
+
+            const uint8_t index = (x + o_half_x) * (2*LOS_MAX_RANGE+1)
+                                  + y + o_half_y;
+            for (coord_def r : cells)
+                los_dependents[r.x][r.y + o_half_y].push_back(index);
+        }
+}
+
+// Opacity at p has changed. Forget the visibility between those pairs
+// of cells that have p on a ray between them.
 void invalidate_los_around(const coord_def& p)
 {
-    int x1 = max(p.x - LOS_MAX_RANGE, 0);
-    int y1 = max(p.y - LOS_MAX_RANGE, 0);
-    int x2 = min(p.x, GXM - 1);
-    int y2 = min(p.y + LOS_MAX_RANGE, GYM - 1);
-    for (int y = y1; y <= y2; y++)
-        for (int x = x1; x <= x2; x++)
-            if (sqr(p.x - x) + sqr(p.y - y) <= sqr(LOS_MAX_RANGE) + 1)
-                memset(globallos[x][y], 0, sizeof(halflos_t));
+    _init_los_dependents();
+#ifdef DEBUG_DIAGNOSTICS
+    los_stats.invalidations++;
+#endif
+
+    for (int x = 0; x <= LOS_MAX_RANGE; ++x)
+        for (int y = -LOS_MAX_RANGE; y <= LOS_MAX_RANGE; ++y)
+        {
+            const coord_def c = p - coord_def(x, y);
+            if (!map_bounds(c))
+                continue;
+
+            losfield_t *flags = &globallos[c.x][c.y][0][0];
+            for (uint8_t index : los_dependents[x][y + o_half_y])
+            {
+#ifdef DEBUG_DIAGNOSTICS
+                if (flags[index])
+                    los_stats.forgotten++;
+#endif
+                flags[index] = 0;
+            }
+        }
 }
 
 void invalidate_los()
@@ -125,9 +186,30 @@ bool cell_see_cell(const coord_def& p, const coord_def& q, los_type l)
         return false; // outside range
 
     if (!(*flags & (l << LOS_KNOWN)))
+    {
+#ifdef DEBUG_DIAGNOSTICS
+        los_stats.misses++;
+#endif
         _update_globallos_at(p, l);
+    }
+#ifdef DEBUG_DIAGNOSTICS
+    else
+        los_stats.hits++;
+#endif
 
     ASSERT(*flags & (l << LOS_KNOWN));
 
     return *flags & l;
 }
+
+#ifdef DEBUG_DIAGNOSTICS
+const globallos_stats &get_globallos_stats()
+{
+    return los_stats;
+}
+
+void reset_globallos_stats()
+{
+    los_stats = globallos_stats();
+}
+#endif
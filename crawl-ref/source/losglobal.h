@@ -6,4 +6,19 @@ void invalidate_los();
 
 bool cell_see_cell(const coord_def& p, const coord_def& q, los_type l);
 
+#ifdef DEBUG_DIAGNOSTICS
+struct globallos_stats
+{
+    uint64_t hits;          // cell_see_cell answered from the table
+    uint64_t misses;        // ... that needed a losight()
+    uint64_t invalidations; // calls to invalidate_los_around
+    uint64_t forgotten;     // known entries they cleared
+
+    globallos_stats() : hits(0), misses(0), invalidations(0), forgotten(0) {}
+};
+
+const globallos_stats &get_globallos_stats();
+void reset_globallos_stats();
+#endif
+
 #endif
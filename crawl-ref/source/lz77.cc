@@ -0,0 +1,200 @@
+/**
+ * @file
+ * @brief A small, fast LZ77 codec for save file chunks.
+ *
+ * The format is a sequence of (literals, match) pairs, in the style of LZ4:
+ *   token     1 byte: literal length in the high nibble, match length - 4
+ *             in the low one; 15 means "more length bytes follow"
+ *   [length]  extra literal length, 255 per byte until a smaller byte
+ *   literals
+ *   offset    2 bytes little-endian, 1..65535 back from the current output
+ *   [length]  extra match length, same encoding
+ * The last sequence has literals only, and no offset.  It trades about a
+ * third of zlib's ratio for an order of magnitude less CPU.
+**/
+
+#include "AppHdr.h"
+
+#include "lz77.h"
+
+#include <cstring>
+
+#define MIN_MATCH   4
+#define MAX_OFFSET  65535
+#define HASH_BITS   13
+// Matches may not start this close to the end, so the last sequence always
+// has some literals and the decoder never reads past its input.
+#define END_LITERALS 5
+
+static inline uint32_t _read32(const uint8_t *p)
+{
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static inline uint32_t _hash(uint32_t x)
+{
+    return (x * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static inline uint8_t *_put_length(uint8_t *op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+size_t lz77_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+size_t lz77_compress(const void *src, size_t len, void *dst)
+{
+    const uint8_t *const in = (const uint8_t*)src;
+    const uint8_t *const in_end = in + len;
+    uint8_t *op = (uint8_t*)dst;
+
+    const uint8_t *ip = in;
+    const uint8_t *anchor = in;
+
+    if (len > MIN_MATCH + END_LITERALS)
+    {
+        // Positions are stored plus one, so that 0 means "empty".
+        uint32_t table[1 << HASH_BITS];
+        memset(table, 0, sizeof(table));
+
+        const uint8_t *const match_limit = in_end - END_LITERALS;
+        const uint8_t *const scan_limit = match_limit - MIN_MATCH;
+        // Step faster through incompressible data.
+        unsigned misses = 0;
+
+        while (ip < scan_limit)
+        {
+            const uint32_t seq = _read32(ip);
+            const uint32_t h = _hash(seq);
+            const uint32_t cand = table[h];
+            table[h] = ip - in + 1;
+
+            const uint8_t *ref = in + cand - 1;
+            if (!cand || ip - ref > MAX_OFFSET || _read32(ref) != seq)
+            {
+                ip += 1 + (misses++ >> 5);
+                continue;
+            }
+            misses = 0;
+
+            // Extend backwards over literals we were about to emit.
+            while (ip > anchor && ref > in && ip[-1] == ref[-1])
+                --ip, --ref;
+
+            const uint8_t *mp = ip + MIN_MATCH;
+            const uint8_t *mr = ref + MIN_MATCH;
+            while (mp < match_limit && *mp == *mr)
+                ++mp, ++mr;
+
+            const size_t lit_len = ip - anchor;
+            const size_t match_len = mp - ip - MIN_MATCH;
+            const uint16_t offset = ip - ref;
+
+            uint8_t *token = op++;
+            *token = (lit_len >= 15 ? 15 : lit_len) << 4
+                     | (match_len >= 15 ? 15 : match_len);
+            if (lit_len >= 15)
+                op = _put_length(op, lit_len - 15);
+            memcpy(op, anchor, lit_len);
+            op += lit_len;
+            *op++ = offset & 0xff;
+            *op++ = offset >> 8;
+            if (match_len >= 15)
+                op = _put_length(op, match_len - 15);
+
+            ip = anchor = mp;
+            if (ip < scan_limit)
+                table[_hash(_read32(ip - 2))] = ip - 2 - in + 1;
+        }
+    }
+
+    // The trailing literals.
+    const size_t lit_len = in_end - anchor;
+    *op++ = (lit_len >= 15 ? 15 : lit_len) << 4;
+    if (lit_len >= 15)
+        op = _put_length(op, lit_len - 15);
+    memcpy(op, anchor, lit_len);
+    op += lit_len;
+
+    return op - (uint8_t*)dst;
+}
+
+static inline bool _get_length(const uint8_t *&ip, const uint8_t *in_end,
+                               size_t &len)
+{
+    uint8_t b;
+    do
+    {
+        if (ip >= in_end)
+            return false;
+        b = *ip++;
+        len += b;
+    }
+    while (b == 255);
+    return true;
+}
+
+bool lz77_decompress(const void *src, size_t len, void *dst, size_t dst_len)
+{
+    const uint8_t *ip = (const uint8_t*)src;
+    const uint8_t *const in_end = ip + len;
+    uint8_t *const out = (uint8_t*)dst;
+    uint8_t *op = out;
+    uint8_t *const out_end = out + dst_len;
+
+    while (ip < in_end)
+    {
+        const uint8_t token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && !_get_length(ip, in_end, lit_len))
+            return false;
+        if ((size_t)(in_end - ip) < lit_len
+            || (size_t)(out_end - op) < lit_len)
+        {
+            return false;
+        }
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        // The last sequence has no match.
+        if (ip == in_end)
+            break;
+
+        if (in_end - ip < 2)
+            return false;
+        const size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (!offset || offset > (size_t)(op - out))
+            return false;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && !_get_length(ip, in_end, match_len))
+            return false;
+        match_len += MIN_MATCH;
+        if ((size_t)(out_end - op) < match_len)
+            return false;
+
+        const uint8_t *ref = op - offset;
+        if (offset >= match_len)
+        {
+            memcpy(op, ref, match_len);
+            op += match_len;
+        }
+        else // overlapping copies are how runs get encoded, go bytewise
+            while (match_len--)
+                *op++ = *ref++;
+    }
+
+    return op == out_end;
+}
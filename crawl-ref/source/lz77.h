@@ -0,0 +1,17 @@
+/**
+ * @file
+ * @brief A small, fast LZ77 codec for save file chunks.
+**/
+
+#ifndef LZ77_H
+#define LZ77_H
+
+// The worst case size of compressing len bytes.
+size_t lz77_bound(size_t len);
+// Returns the compressed length; dst must have room for lz77_bound(len).
+size_t lz77_compress(const void *src, size_t len, void *dst);
+// Returns false if the input is malformed or doesn't decompress to exactly
+// dst_len bytes.
+bool lz77_decompress(const void *src, size_t len, void *dst, size_t dst_len);
+
+#endif
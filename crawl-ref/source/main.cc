@@ -146,6 +146,7 @@
 #include "transform.h"
 #include "traps.h"
 #include "travel.h"
+#include "turnprof.h"
 #include "uncancel.h"
 #include "version.h"
 #include "viewchar.h"
@@ -549,8 +550,26 @@ static void _show_commandline_options_help()
     puts("  -objstat [<levels>] run monster and item stats on the given range "
          "of levels");
     puts("      Defaults to entire dungeon; same level syntax as -mapstat.");
+    puts("  -bench-save         time marshalling of generated levels through "
+         "tags.cc");
+    puts("  -fuzz-save <dir>    fuzz the level reader with mutations of the "
+         "corpus in <dir>");
+    puts("      A file instead of a directory replays a single input.");
+    puts("  -bench <name>       run a benchmark on generated levels: los,");
+#if defined(USE_CURSES) && !defined(USE_TILE)
+    puts("      globallos, noise, clouds, puttext");
+#else
+    puts("      globallos, noise, clouds");
+#endif
+    puts("  -levelgen <jobs>    time generating dungeons in <jobs> processes, "
+         "by branch");
+    puts("      and map; -seed sets the first dungeon's seed");
     puts("  -iters <num>        For -mapstat and -objstat, set the number of "
-         "iterations");
+         "iterations;");
+    puts("      for -bench-save and -bench the number of levels, for "
+         "-levelgen the");
+    puts("      number of dungeons, and for -fuzz-save the mutations per "
+         "file");
 #endif
     puts("");
     puts("Miscellaneous options:");
@@ -559,6 +578,13 @@ static void _show_commandline_options_help()
     puts("  -gdb/-no-gdb     produce gdb backtrace when a crash happens (default:on)");
 #endif
     puts("  -list-combos     list playable species, jobs, and character combos.");
+    puts("  -profile-turns <file> write the time spent in each phase of each turn "
+         "to <file>");
+    puts("  -record-keys <file>   write the keys typed and the game's seed to "
+         "<file>");
+    puts("  -replay-keys <file>   replay a -record-keys log without drawing, "
+         "and time");
+    puts("      the handling of each key; use the options it was recorded with");
 
 #if defined(TARGET_OS_WINDOWS) && defined(USE_TILE_LOCAL)
     text_popup(help, L"Dungeon Crawl command line help");
@@ -759,7 +785,7 @@ static void _do_wizard_command(int wiz_command, bool silent_fail)
     case CONTROL('D'): wizard_edit_durations(); break;
 
     case 'e': wizard_set_hunger_state(); break;
-    // case 'E': break;
+    case 'E': wizard_turn_profile(); break;
     case CONTROL('E'): debug_dump_levgen(); break;
 
     case 'f': wizard_quick_fsim(); break;
@@ -2441,7 +2467,7 @@ static void _update_golubria_traps()
         env.level_state &= ~LSTATE_GOLUBRIA;
 }
 
-void world_reacts()
+static void _world_reacts()
 {
     // All markers should be activated at this point.
     ASSERT(!env.markers.need_activate());
@@ -2583,6 +2609,15 @@ void world_reacts()
     }
 }
 
+void world_reacts()
+{
+    {
+        turn_phase_timer timer(TPHASE_TURN);
+        _world_reacts();
+    }
+    turn_profile_end_turn();
+}
+
 static command_type _get_next_cmd()
 {
 #ifdef DGL_SIMPLE_MESSAGING
@@ -19,6 +19,7 @@ void set_terrain_mapped(const coord_def gc)
     map_cell* cell = &env.map_knowledge(gc);
     cell->flags &= (~MAP_CHANGED_FLAG);
     cell->flags |= MAP_MAGIC_MAPPED_FLAG;
+    view_mark_dirty(gc);
 #ifdef USE_TILE
     tiles.update_minimap(gc);
 #endif
@@ -64,6 +65,7 @@ void clear_map(bool clear_items, bool clear_mons)
         tile_reset_fg(p);
 #endif
     }
+    view_mark_all_dirty();
 }
 
 static void _automap_from(int x, int y, int mutated)
@@ -116,6 +118,7 @@ void set_terrain_seen(const coord_def pos)
 
     cell->flags &= (~MAP_CHANGED_FLAG);
     cell->flags |= MAP_SEEN_FLAG;
+    view_mark_dirty(pos);
 
 #ifdef USE_TILE
     tiles.update_minimap(pos);
@@ -10,16 +10,23 @@
 #include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #ifndef TARGET_COMPILER_VC
 #include <unistd.h>
 #endif
+#ifndef TARGET_OS_WINDOWS
+#include <sys/wait.h>
+#endif
 
 #include "branch.h"
 #include "coord.h"
 #include "coordit.h"
+#include "dbg-bench.h"
 #include "dbg-maps.h"
+#include "dbimage.h"
 #include "dungeon.h"
 #include "end.h"
 #include "endianness.h"
@@ -94,9 +101,17 @@ dgn_map_parameters::dgn_map_parameters(const string_vector &parameters)
 map_section_type vault_main(vault_placement &place, const map_def *vault,
                             bool check_place)
 {
-#ifdef DEBUG_DIAGNOSTICS
+#ifdef DEBUG_STATISTICS
     if (crawl_state.map_stat_gen)
+    {
         mapstat_report_map_try(*vault);
+
+        const uint64_t start = bench_now_ns();
+        const map_section_type orient =
+            _write_vault(const_cast<map_def&>(*vault), place, check_place);
+        mapstat_report_map_time(*vault, bench_now_ns() - start);
+        return orient;
+    }
 #endif
 
     // Return value of MAP_NONE forces dungeon.cc to regenerate the
@@ -164,7 +179,7 @@ static bool _resolve_map_lua(map_def &map)
     string err = map.run_lua(true);
     if (!err.empty())
     {
-#ifdef DEBUG_DIAGNOSTICS
+#ifdef DEBUG_STATISTICS
         if (crawl_state.map_stat_gen)
             mapstat_report_error(map, err);
 #endif
@@ -1256,6 +1271,36 @@ static bool _verify_map_full(const string &base, time_t mtime)
     return verify_file_version(base + ".dsc", mtime);
 }
 
+// Read the maps of a .des file's index, after its header.
+static void _read_map_index(const string &cache, reader &inf)
+{
+    const int nmaps = unmarshallShort(inf);
+    const int nexist = vdefs.size();
+    vdefs.resize(nexist + nmaps, map_def());
+    for (int i = 0; i < nmaps; ++i)
+    {
+        map_def &vdef(vdefs[nexist + i]);
+        vdef.read_index(inf);
+        vdef.description = unmarshallString(inf);
+        vdef.order = unmarshallInt(inf);
+
+        vdef.set_file(cache);
+
+        // Maps from different files, compiled separately.
+        map_load_info_t::const_iterator loaded =
+            lc_loaded_maps.find(vdef.name);
+        if (loaded != lc_loaded_maps.end())
+        {
+            end(1, false, "Map named '%s' already loaded at %s:%d",
+                vdef.name.c_str(), loaded->second.filename.c_str(),
+                loaded->second.lineno);
+        }
+
+        lc_loaded_maps[vdef.name] = vdef.place_loaded_from;
+        vdef.place_loaded_from.clear();
+    }
+}
+
 static bool _load_map_index(const string& cache, const string &base,
                             time_t mtime)
 {
@@ -1301,33 +1346,136 @@ static bool _load_map_index(const string& cache, const string &base,
         return false;
 #endif
 
-    const int nmaps = unmarshallShort(inf);
-    const int nexist = vdefs.size();
-    vdefs.resize(nexist + nmaps, map_def());
-    for (int i = 0; i < nmaps; ++i)
+    _read_map_index(cache, inf);
+    fclose(fp);
+
+    return true;
+}
+
+// The .idx and .lux caches of every .des file, merged into one image so
+// that a start with nothing to compile maps a single file rather than
+// opening a couple per .des. Each entry is a copy of the per-file cache,
+// header and all, keyed by cache name and extension; the per-file caches
+// (and the .dsc files the indices point into) remain the originals.
+static db_image map_index_image;
+// Whether some index was loaded from anywhere but the image.
+static bool map_index_image_stale = false;
+
+static string _map_index_image_path()
+{
+    return _des_cache_dir("maps.img");
+}
+
+static bool _map_cache_header_current(reader &inf, time_t mtime)
+{
+    const uint8_t major = unmarshallUByte(inf);
+    const uint8_t minor = unmarshallUByte(inf);
+    const int8_t word = unmarshallByte(inf);
+    const int64_t t = unmarshallSigned(inf);
+    return major == TAG_MAJOR_VERSION
+#if TAG_MAJOR_VERSION == 34
+           && minor >= TAG_MINOR_MAP_ORDER
+#endif
+           && minor <= TAG_MINOR_VERSION
+           && word == WORD_LEN
+           && t == mtime;
+}
+
+static bool _fetch_map_index_image(const string &key,
+                                   vector<unsigned char> &data)
+{
+    const char *value;
+    size_t size;
+    if (!map_index_image.fetch(key, value, size))
+        return false;
+    data.assign(value, value + size);
+    return true;
+}
+
+static bool _map_index_image_current(const string &cachename, time_t mtime)
+{
+    vector<unsigned char> idx;
+    if (!_fetch_map_index_image(cachename + ".idx", idx))
+        return false;
+
+    reader inf(idx, TAG_MINOR_VERSION);
+    return _map_cache_header_current(inf, mtime);
+}
+
+static bool _load_map_index_image(const string &cachename, time_t mtime)
+{
+    vector<unsigned char> idx, lux;
+    if (!_fetch_map_index_image(cachename + ".idx", idx))
+        return false;
+
+    reader inf(idx, TAG_MINOR_VERSION);
+    if (!_map_cache_header_current(inf, mtime))
+        return false;
+
+    if (_fetch_map_index_image(cachename + ".lux", lux))
     {
-        map_def &vdef(vdefs[nexist + i]);
-        vdef.read_index(inf);
-        vdef.description = unmarshallString(inf);
-        vdef.order = unmarshallInt(inf);
+        reader luxinf(lux, TAG_MINOR_VERSION);
+        if (!_map_cache_header_current(luxinf, mtime))
+            return false;
 
-        vdef.set_file(cache);
-        lc_loaded_maps[vdef.name] = vdef.place_loaded_from;
-        vdef.place_loaded_from.clear();
+        lc_global_prelude.read(luxinf);
+        global_preludes.push_back(lc_global_prelude);
     }
-    fclose(fp);
 
+    _read_map_index(cachename, inf);
     return true;
 }
 
+static bool _read_map_cache_file(const string &file, string &data)
+{
+    FILE *fp = fopen_u(file.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    data.clear();
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.append(buf, n);
+    const bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+// Write the image from the per-file caches. The caller holds maps.lk.
+static void _write_map_index_image(const set<string> &cachenames)
+{
+    db_image_writer image;
+    for (const string &cachename : cachenames)
+    {
+        const string descache_base = get_descache_path(cachename, "");
+        file_lock deslock(descache_base + ".lk", "rb", false);
+
+        string data;
+        if (!_read_map_cache_file(descache_base + ".idx", data))
+            continue;
+        image.add(cachename + ".idx", data);
+        if (_read_map_cache_file(descache_base + ".lux", data))
+            image.add(cachename + ".lux", data);
+    }
+
+    const string path = _map_index_image_path();
+    if (!image.write(path))
+        end(1, true, "Unable to write %s", path.c_str());
+}
+
 static bool _load_map_cache(const string &filename, const string &cachename)
 {
     _check_des_index_dir();
     const string descache_base = get_descache_path(cachename, "");
 
+    time_t mtime = file_modtime(filename);
+    if (_load_map_index_image(cachename, mtime))
+        return true;
+    map_index_image_stale = true;
+
     file_lock deslock(descache_base + ".lk", "rb", false);
 
-    time_t mtime = file_modtime(filename);
     string file_idx = descache_base + ".idx";
     string file_dsc = descache_base + ".dsc";
 
@@ -1460,11 +1608,178 @@ void read_map(const string &file)
     dlua.gc();
 }
 
+// The .des files loadmaps.lua loads, unless it has been replaced by an
+// installed list.
+static vector<string> _des_files()
+{
+    vector<string> files;
+    const string dir = datafile_path("dat/des", false, false, dir_exists);
+    if (dir.empty())
+        return files;
+
+    for (const string &file : get_dir_files_recursive(dir, ".des"))
+        files.push_back("des/" + file);
+    return files;
+}
+
+#ifndef TARGET_OS_WINDOWS
+static NORETURN void _des_worker(const vector<string> &files)
+{
+    crawl_state.forked_worker = true;
+
+    // Leave the terminal alone: a file that fails to compile here is
+    // compiled again by the parent, which reports the error.
+    const int null = open("/dev/null", O_WRONLY);
+    if (null != -1)
+    {
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+    }
+
+    for (const string &file : files)
+        read_map(file);
+    _Exit(0);
+}
+
+// Compile .des files in as many processes as there are cores, for the
+// parent to load from their caches.
+static void _compile_des_files(const vector<string> &files)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const int jobs = min<long>(cpus, files.size());
+    // One job may as well be compiled by the parent, in order.
+    if (jobs < 2)
+        return;
+
+    // Deal the files out biggest first, each to the job with least to do.
+    vector<pair<off_t, string>> sized;
+    for (const string &file : files)
+    {
+        struct stat st;
+        const string path = datafile_path(file, false);
+        sized.emplace_back(stat(path.c_str(), &st) ? 0 : st.st_size, file);
+    }
+    sort(sized.rbegin(), sized.rend());
+
+    vector<vector<string>> work(jobs);
+    vector<off_t> load(jobs, 0);
+    for (const auto &file : sized)
+    {
+        const int job = min_element(load.begin(), load.end()) - load.begin();
+        work[job].push_back(file.second);
+        load[job] += file.first;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    vector<pid_t> workers;
+    for (int job = 0; job < jobs; ++job)
+    {
+        // Whatever a worker that couldn't be forked would have done gets
+        // compiled by the parent.
+        const pid_t pid = fork();
+        if (pid == -1)
+            break;
+        if (!pid)
+            _des_worker(work[job]);
+        workers.push_back(pid);
+    }
+
+    for (pid_t pid : workers)
+        waitpid(pid, nullptr, 0);
+}
+#endif
+
+/**
+ * Bring the caches of all the .des files up to date, and merge them into
+ * the map index image, before loadmaps.lua loads them one by one.
+ *
+ * When nothing has changed, this only checks each .des file's time against
+ * the image. Otherwise the first process to notice compiles what's stale,
+ * in parallel, while any others starting at the same time wait for it
+ * rather than compiling the same files themselves.
+ */
+static void _update_des_caches()
+{
+    _check_des_index_dir();
+
+    vector<string> files;
+    set<string> cachenames;
+    auto current = [&]()
+    {
+        map_index_image.open(_map_index_image_path());
+        for (const string &file : files)
+        {
+            const string path = datafile_path(file, false);
+            if (!_map_index_image_current(get_cache_name(path),
+                                          file_modtime(path)))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    for (const string &file : _des_files())
+    {
+        const string path = datafile_path(file, false);
+        if (path.empty())
+            continue;
+        files.push_back(file);
+        cachenames.insert(get_cache_name(path));
+    }
+
+    if (current())
+        return;
+
+    file_lock lock(_des_cache_dir("maps.lk"), "wb");
+    if (current())
+        return;
+
+#ifndef TARGET_OS_WINDOWS
+    // The workers' output would go unseen.
+    if (!crawl_state.dump_maps)
+    {
+        vector<string> stale;
+        for (const string &file : files)
+        {
+            const string path = datafile_path(file, false);
+            const string descache_base =
+                get_descache_path(get_cache_name(path), "");
+            const time_t mtime = file_modtime(path);
+
+            file_lock deslock(descache_base + ".lk", "rb", false);
+            if (!_verify_map_index(descache_base, mtime)
+                || !_verify_map_full(descache_base, mtime))
+            {
+                stale.push_back(file);
+            }
+        }
+        _compile_des_files(stale);
+    }
+#endif
+
+    _write_map_index_image(cachenames);
+    map_index_image.open(_map_index_image_path());
+}
+
 void read_maps()
 {
+    _update_des_caches();
+    map_index_image_stale = false;
+
     if (dlua.execfile("dlua/loadmaps.lua", true, true, true))
         end(1, false, "Lua error: %s", dlua.error.c_str());
 
+    // Anything compiled or loaded separately (by a custom loadmaps.lua,
+    // or where there are no workers) goes in the image for next time.
+    if (map_index_image_stale)
+    {
+        file_lock lock(_des_cache_dir("maps.lk"), "wb");
+        _write_map_index_image(map_files_read);
+    }
+    map_index_image.close();
+
     lc_loaded_maps.clear();
 
     {
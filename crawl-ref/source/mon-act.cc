@@ -42,6 +42,7 @@
 #include "mon-cast.h"
 #include "mon-death.h"
 #include "mon-movetarget.h"
+#include "mon-pathfind.h"
 #include "mon-place.h"
 #include "mon-project.h"
 #include "mon-speak.h"
@@ -63,6 +64,7 @@
 #include "throw.h"
 #include "timed_effects.h"
 #include "traps.h"
+#include "turnprof.h"
 #include "viewchar.h"
 #include "view.h"
 
@@ -2914,7 +2916,7 @@ static void _clear_monster_flags()
     // monsters get their actions in the next round.
     // Also clear one-turn deep sleep flag.
     // XXX: MF_JUST_SLEPT only really works for player-cast hibernation.
-    for (int i = 0; i < MAX_MONSTERS; i++)
+    for (int i = 0; i < env.mons_used; i++)
         menv[i].flags &= ~MF_JUST_SUMMONED & ~MF_JUST_SLEPT;
 }
 
@@ -2943,6 +2945,11 @@ static void _update_monster_attitude(monster *mon)
 //---------------------------------------------------------------
 void handle_monsters(bool with_noise)
 {
+    turn_phase_timer timer(TPHASE_MONSTERS);
+
+    // Things will have moved since the fields were filled in.
+    clear_monster_flow_fields();
+
     for (monster_iterator mi; mi; ++mi)
     {
         _pre_monster_move(*mi);
@@ -256,6 +256,7 @@ bool try_pathfind(monster* mon)
     monster_pathfind mp;
     if (range > 0)
         mp.set_range(range);
+    mp.set_share_fields(true);
 
     if (mp.init_pathfind(mon, targpos))
     {
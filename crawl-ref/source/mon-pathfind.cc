@@ -8,6 +8,7 @@
 #include "los.h"
 #include "mon-movetarget.h"
 #include "mon-place.h"
+#include "player.h"
 #include "religion.h"
 #include "state.h"
 #include "terrain.h"
@@ -19,17 +20,180 @@
 // The pathfinding is an implementation of the A* algorithm. Beginning at the
 // monster position we check all neighbours of a given grid, estimate the
 // distance needed for any shortest path including this grid and push the
-// result into a hash. We can then easily access all points with the shortest
-// distance estimates and then check _their_ neighbours and so on.
+// result into a list of grids with that estimate. We can then easily access
+// all points with the shortest distance estimates and then check _their_
+// neighbours and so on.
 // The algorithm terminates once we reach the destination since - because
-// of the sorting of grids by shortest distance in the hash - there can be no
+// of the sorting of grids by shortest distance in the lists - there can be no
 // path between start and target that is shorter than the current one. There
 // could be other paths that have the same length but that has no real impact.
-// If the hash has been cleared and the start grid has not been encountered,
+// If the lists have been emptied and the start grid has not been encountered,
 // then there's no path that matches the requirements fed into monster_pathfind.
 // (These requirements are usually preference of habitat of a specific monster
 // or a limit of the distance between start and any grid on the path.)
 
+// Everything a search needs per grid. Searches are numbered, and a grid's
+// distance or passability is only valid if it was stored by the current
+// search, so the arrays never need to be cleared.
+struct pathfind_workspace
+{
+    unsigned int search;
+
+    // Distances from start, and where we came from on a shortest path.
+    FixedArray<unsigned int, GXM, GYM> dist_search;
+    FixedArray<int, GXM, GYM> dist;
+    FixedArray<int8_t, GXM, GYM> prev;
+
+    // Remembered results of traversable().
+    FixedArray<unsigned int, GXM, GYM> passable_search;
+    FixedArray<bool, GXM, GYM> passable;
+
+    // Grids to look at, by estimated total path length. A grid whose
+    // estimate improved is added again, and its old entry ignored.
+    vector<vector<coord_def>> open;
+    int open_used;
+
+    pathfind_workspace() : search(0), open_used(-1)
+    {
+        dist_search.init(0);
+        passable_search.init(0);
+    }
+
+    // Forgets everything from the previous search.
+    void new_search()
+    {
+        if (!++search)
+        {
+            dist_search.init(0);
+            passable_search.init(0);
+            search = 1;
+        }
+
+        for (int i = 0; i <= open_used; ++i)
+            open[i].clear();
+        open_used = -1;
+    }
+};
+
+// Searches can be nested, so there may be more than one of these in use.
+static vector<unique_ptr<pathfind_workspace>> _spare_workspaces;
+
+static pathfind_workspace *_get_workspace()
+{
+    if (_spare_workspaces.empty())
+        return new pathfind_workspace;
+
+    pathfind_workspace *ws = _spare_workspaces.back().release();
+    _spare_workspaces.pop_back();
+    return ws;
+}
+
+static void _return_workspace(pathfind_workspace *ws)
+{
+    _spare_workspaces.emplace_back(ws);
+}
+
+static const int8_t FLOW_UNKNOWN = 0;
+static const int8_t FLOW_BLOCKED = -1;
+static const int8_t FLOW_PASSABLE = -2;
+
+// Distances to one target, shared this turn by all monsters that chase it
+// and move alike (see _flow_field_for()). The field is filled outwards from
+// the target (Dijkstra's algorithm, with the costs of monster_pathfind),
+// but only as far as the monsters that asked so far needed it. A monster
+// checks that the path it follows suits it, and searches on its own if not.
+struct flow_field
+{
+    coord_def target;
+    branch_type branch;
+    int depth;
+    habitat_type habitat;
+    bool airborne;
+    bool doors;
+    bool friendly;
+
+    int requests;
+
+    // Cost of the way from each grid to the target, and the direction of
+    // the next step.
+    FixedArray<int, GXM, GYM> dist;
+    FixedArray<int8_t, GXM, GYM> next;
+    FixedArray<bool, GXM, GYM> settled;
+    // Cost of entering settled grids; FLOW_UNKNOWN for grids not looked at
+    // yet, FLOW_BLOCKED for those that can't be passed and FLOW_PASSABLE
+    // for those that can but aren't settled.
+    FixedArray<int8_t, GXM, GYM> cost;
+
+    // Grids to settle, by distance, as in pathfind_workspace::open.
+    vector<vector<coord_def>> open;
+    int open_min;
+
+    void reset()
+    {
+        dist.init(INFINITE_DISTANCE);
+        settled.init(false);
+        cost.init(FLOW_UNKNOWN);
+        for (vector<coord_def> &vec : open)
+            vec.clear();
+        open_min = 0;
+
+        dist(target) = 0;
+        if (open.empty())
+            open.resize(1);
+        open[0].push_back(target);
+    }
+};
+
+static const int MAX_FLOW_FIELDS = 8;
+static vector<unique_ptr<flow_field>> _flow_fields;
+static int _flow_fields_used = 0;
+
+// Called at the start of each monster turn and whenever terrain changes.
+void clear_monster_flow_fields()
+{
+    _flow_fields_used = 0;
+}
+
+// Finds the field for monsters moving like mon towards target, or starts
+// one. Returns nullptr if there are too many fields already.
+static flow_field *_flow_field_for(const monster* mon, const coord_def &target)
+{
+    const habitat_type habitat = mons_habitat(mon);
+    const bool airborne = mon->airborne();
+    const bool doors = mons_can_open_door(mon, mon->pos())
+                       || mons_can_eat_door(mon, mon->pos())
+                       || mons_can_destroy_door(mon, mon->pos());
+    const bool friendly = mon->friendly();
+
+    for (int i = 0; i < _flow_fields_used; ++i)
+    {
+        flow_field &field = *_flow_fields[i];
+        if (field.target == target && field.branch == you.where_are_you
+            && field.depth == you.depth && field.habitat == habitat
+            && field.airborne == airborne && field.doors == doors
+            && field.friendly == friendly)
+        {
+            return &field;
+        }
+    }
+
+    if (_flow_fields_used == MAX_FLOW_FIELDS)
+        return nullptr;
+    if (_flow_fields_used == (int) _flow_fields.size())
+        _flow_fields.emplace_back(new flow_field);
+
+    flow_field &field = *_flow_fields[_flow_fields_used++];
+    field.target   = target;
+    field.branch   = you.where_are_you;
+    field.depth    = you.depth;
+    field.habitat  = habitat;
+    field.airborne = airborne;
+    field.doors    = doors;
+    field.friendly = friendly;
+    field.requests = 0;
+    return &field;
+}
+
 int mons_tracking_range(const monster* mon)
 {
     int range = 0;
@@ -76,13 +240,16 @@ int mons_tracking_range(const monster* mon)
 //#define DEBUG_PATHFIND
 monster_pathfind::monster_pathfind()
     : mons(nullptr), start(), target(), pos(), allow_diagonals(true),
-      traverse_unmapped(false), range(0), min_length(0), max_length(0),
-      dist(), prev(), hash()
+      traverse_unmapped(false), traverse_in_sight(false), range(0),
+      min_length(0), max_length(0), share_fields(false), shared(),
+      cache_traversable(false), ws(nullptr)
 {
 }
 
 monster_pathfind::~monster_pathfind()
 {
+    if (ws)
+        _return_workspace(ws);
 }
 
 void monster_pathfind::set_range(int r)
@@ -91,9 +258,18 @@ void monster_pathfind::set_range(int r)
         range = r;
 }
 
+// Look for paths in the distance fields shared with other monsters chasing
+// the same target, if there are some. For monsters that aren't alone, this
+// is much cheaper than searching, but the path found may not be quite the
+// one the search would have.
+void monster_pathfind::set_share_fields(bool share)
+{
+    share_fields = share;
+}
+
 coord_def monster_pathfind::next_pos(const coord_def &c) const
 {
-    return c + Compass[prev[c.x][c.y]];
+    return c + Compass[ws->prev(c)];
 }
 
 // The main method in the monster_pathfind class.
@@ -112,6 +288,7 @@ bool monster_pathfind::init_pathfind(const monster* mon, coord_def dest,
                          && !crawl_state.game_is_zotdef()
                          && mon->friendly() &&  mon->is_summoned()
                          && you.see_cell_no_trans(mon->pos()));
+    shared.clear();
 
     // Easy enough. :P
     if (start == target)
@@ -122,6 +299,14 @@ bool monster_pathfind::init_pathfind(const monster* mon, coord_def dest,
         return true;
     }
 
+    if (share_fields && allow_diagonals && !traverse_unmapped
+        && !traverse_in_sight && shared_path())
+    {
+        return true;
+    }
+
+    // shared_path() moves pos about for the travel costs.
+    pos = start;
     return start_pathfind(msg);
 }
 
@@ -149,12 +334,16 @@ bool monster_pathfind::start_pathfind(bool msg)
     //       surrounded by shallow water or floor, or if a foe is hiding in
     //       a wall.
 
-    max_length = min_length = grid_distance(pos, target);
-    for (int i = 0; i < GXM; i++)
-        for (int j = 0; j < GYM; j++)
-            dist[i][j] = INFINITE_DISTANCE;
+    if (!ws)
+        ws = _get_workspace();
 
-    dist[pos.x][pos.y] = 0;
+    // Climbing monsters can pass some grids only from certain others.
+    cache_traversable = !mons || !mons->can_cling_to_walls();
+
+    ws->new_search();
+    max_length = min_length = grid_distance(pos, target);
+    ws->dist_search(pos) = ws->search;
+    ws->dist(pos) = 0;
 
     bool success = false;
     do
@@ -216,7 +405,7 @@ bool monster_pathfind::calc_path_to_neighbours()
         if (!in_bounds(npos))
             continue;
 
-        if (!traversable(npos) && npos != target)
+        if (!passable(npos) && npos != target)
             continue;
 
         // Ignore this grid if it takes us above the allowed distance
@@ -224,8 +413,8 @@ bool monster_pathfind::calc_path_to_neighbours()
         if (range && estimated_cost(npos) > range)
             continue;
 
-        distance = dist[pos.x][pos.y] + travel_cost(npos);
-        old_dist = dist[npos.x][npos.y];
+        distance = path_dist(pos) + travel_cost(npos);
+        old_dist = path_dist(npos);
 
         // Also bail out if this would make the path longer than twice the
         // allowed distance from the target. (This factor may need tuning.)
@@ -271,7 +460,8 @@ bool monster_pathfind::calc_path_to_neighbours()
             }
 
             // Update distance start->pos.
-            dist[npos.x][npos.y] = distance;
+            ws->dist_search(npos) = ws->search;
+            ws->dist(npos) = distance;
 
             // Set backtracking information.
             // Converts the Compass direction to its counterpart.
@@ -279,7 +469,7 @@ bool monster_pathfind::calc_path_to_neighbours()
             //      7  .  3   ==>   3  .  7       e.g. (3 + 4) % 8          = 7
             //      6  5  4         2  1  0            (7 + 4) % 8 = 11 % 8 = 3
 
-            prev[npos.x][npos.y] = (dir + 4) % 8;
+            ws->prev(npos) = (dir + 4) % 8;
 
             // Are we finished?
             if (npos == target)
@@ -295,18 +485,26 @@ bool monster_pathfind::calc_path_to_neighbours()
 }
 
 // Starting at known min_length (minimum total estimated path distance), check
-// the hash for existing vectors, then pick the last entry of the first vector
-// that matches. Update min_length, if necessary.
+// the open list for existing vectors, then pick the last entry of the first
+// vector that matches. Update min_length, if necessary.
 bool monster_pathfind::get_best_position()
 {
-    for (int i = min_length; i <= max_length; i++)
+    for (int i = min_length; i <= max_length && i <= ws->open_used; i++)
     {
-        if (!hash[i].empty())
+        vector<coord_def> &vec = ws->open[i];
+        // Skip entries for grids that have since been given a better
+        // estimate.
+        while (!vec.empty()
+               && path_dist(vec.back()) + estimated_cost(vec.back()) != i)
+        {
+            vec.pop_back();
+        }
+
+        if (!vec.empty())
         {
             if (i > min_length)
                 min_length = i;
 
-            vector<coord_def> &vec = hash[i];
             // Pick the last position pushed into the vector as it's most
             // likely to be close to the target.
             pos = vec[vec.size()-1];
@@ -335,6 +533,9 @@ vector<coord_def> monster_pathfind::backtrack()
 #ifdef DEBUG_PATHFIND
     mpr("Backtracking...");
 #endif
+    if (!shared.empty())
+        return shared;
+
     vector<coord_def> path;
     pos = target;
     path.push_back(pos);
@@ -345,7 +546,7 @@ vector<coord_def> monster_pathfind::backtrack()
     int dir;
     do
     {
-        dir = prev[pos.x][pos.y];
+        dir = ws->prev(pos);
         pos = pos + Compass[dir];
         ASSERT_IN_BOUNDS(pos);
 #ifdef DEBUG_PATHFIND
@@ -407,6 +608,147 @@ vector<coord_def> monster_pathfind::calc_waypoints()
     return waypoints;
 }
 
+int monster_pathfind::path_dist(const coord_def& p) const
+{
+    return ws->dist_search(p) == ws->search ? ws->dist(p) : INFINITE_DISTANCE;
+}
+
+// traversable(), remembered for the rest of the search where possible.
+bool monster_pathfind::passable(const coord_def& p)
+{
+    if (!cache_traversable)
+        return traversable(p);
+
+    if (ws->passable_search(p) != ws->search)
+    {
+        ws->passable_search(p) = ws->search;
+        ws->passable(p) = traversable(p);
+    }
+    return ws->passable(p);
+}
+
+// Takes the path from the shared distance field, if the monster isn't the
+// first to chase this target this turn, and checks that the monster could
+// have found it itself.
+bool monster_pathfind::shared_path()
+{
+    if (mons->can_cling_to_walls() || !in_bounds(target))
+        return false;
+
+    flow_field *field = _flow_field_for(mons, target);
+    // The first monster searches on its own; there may be no others.
+    if (!field || !field->requests++)
+        return false;
+    if (field->requests == 2)
+        field->reset();
+
+    // Find the neighbour with the shortest way on, filling in the field
+    // until none can be shorter.
+    int best = INFINITE_DISTANCE;
+    coord_def step;
+    do
+    {
+        for (int dir = 0; dir < 8; ++dir)
+        {
+            const coord_def n = start + Compass[dir];
+            if (!in_bounds(n) || !field->settled(n))
+                continue;
+
+            const int d = field->dist(n) + field->cost(n);
+            if (d < best)
+            {
+                best = d;
+                step = n;
+            }
+        }
+    }
+    while (best > field->open_min + 1 && extend_field(*field));
+
+    if (best == INFINITE_DISTANCE)
+        return false;
+
+    vector<coord_def> path;
+    path.push_back(start);
+    for (coord_def p = step; p != target; p += Compass[field->next(p)])
+        path.push_back(p);
+    path.push_back(target);
+
+    // The field was filled in by monsters moving alike, but they may not
+    // move exactly alike.
+    int total = 0;
+    for (unsigned int i = 1; i < path.size(); ++i)
+    {
+        if (path[i] != target && !traversable(path[i])
+            || range && estimated_cost(path[i]) > range)
+        {
+            return false;
+        }
+
+        pos = path[i - 1];
+        total += travel_cost(path[i]);
+        if (range && total > range * 2)
+            return false;
+    }
+
+    shared = path;
+    return true;
+}
+
+// Settles the grids of the field at the next distance, and returns false if
+// there are none left.
+bool monster_pathfind::extend_field(flow_field &field)
+{
+    while (field.open_min < (int) field.open.size()
+           && field.open[field.open_min].empty())
+    {
+        ++field.open_min;
+    }
+    if (field.open_min == (int) field.open.size())
+        return false;
+
+    // Not a reference: the open list may grow below.
+    const int current = field.open_min;
+    while (!field.open[current].empty())
+    {
+        const coord_def c = field.open[current].back();
+        field.open[current].pop_back();
+        if (field.settled(c) || field.dist(c) != current)
+            continue;
+
+        field.settled(c) = true;
+        pos = c;
+        field.cost(c) = travel_cost(c);
+
+        // The monster leaving a grid next to c for c pays for entering c.
+        const int d = field.dist(c) + field.cost(c);
+        for (int dir = 0; dir < 8; ++dir)
+        {
+            const coord_def n = c + Compass[dir];
+            if (!in_bounds(n) || field.settled(n)
+                || field.cost(n) == FLOW_BLOCKED || d >= field.dist(n))
+            {
+                continue;
+            }
+
+            if (field.cost(n) == FLOW_UNKNOWN)
+            {
+                field.cost(n) = traversable(n) ? FLOW_PASSABLE : FLOW_BLOCKED;
+                if (field.cost(n) == FLOW_BLOCKED)
+                    continue;
+            }
+
+            field.dist(n) = d;
+            field.next(n) = (dir + 4) % 8;
+            if (d >= (int) field.open.size())
+                field.open.resize(d + 1);
+            field.open[d].push_back(n);
+        }
+    }
+
+    ++field.open_min;
+    return true;
+}
+
 bool monster_pathfind::traversable(const coord_def& p)
 {
     if (!traverse_unmapped && grd(p) == DNGN_UNSEEN)
@@ -531,24 +873,16 @@ int monster_pathfind::estimated_cost(coord_def p)
 
 void monster_pathfind::add_new_pos(coord_def npos, int total)
 {
-    hash[total].push_back(npos);
+    if (total >= (int) ws->open.size())
+        ws->open.resize(total + 1);
+    if (total > ws->open_used)
+        ws->open_used = total;
+    ws->open[total].push_back(npos);
 }
 
 void monster_pathfind::update_pos(coord_def npos, int total)
 {
-    // Find hash position of old distance and delete it,
-    // then call_add_new_pos.
-    int old_total = dist[npos.x][npos.y] + estimated_cost(npos);
-
-    vector<coord_def> &vec = hash[old_total];
-    for (unsigned int i = 0; i < vec.size(); i++)
-    {
-        if (vec[i] == npos)
-        {
-            vec.erase(vec.begin() + i);
-            break;
-        }
-    }
-
+    // The old entry is skipped by get_best_position(), as its estimate no
+    // longer matches.
     add_new_pos(npos, total);
 }
@@ -2,17 +2,22 @@
 #define MON_PATHFIND_H
 
 class monster;
+struct pathfind_workspace;
+struct flow_field;
 
 int mons_tracking_range(const monster* mon);
+void clear_monster_flow_fields();
 
 class monster_pathfind
 {
 public:
     monster_pathfind();
     virtual ~monster_pathfind();
+    DISALLOW_COPY_AND_ASSIGN(monster_pathfind);
 
     // public methods
     void set_range(int r);
+    void set_share_fields(bool share);
     coord_def next_pos(const coord_def &p) const;
     bool init_pathfind(const monster* mon, coord_def dest,
                        bool diag = true, bool msg = false,
@@ -34,6 +39,10 @@ protected:
     void add_new_pos(coord_def pos, int total);
     void update_pos(coord_def pos, int total);
     bool get_best_position();
+    int  path_dist(const coord_def& p) const;
+    bool passable(const coord_def& p);
+    bool shared_path();
+    bool extend_field(flow_field &field);
 
     // The monster trying to find a path.
     const monster* mons;
@@ -60,12 +69,20 @@ protected:
     int min_length;
     int max_length;
 
-    // The array of distances from start to any already tried point.
-    int dist[GXM][GYM];
-    // An array to store where we came from on a given shortest path.
-    int prev[GXM][GYM];
+    // If true, monsters moving alike towards the same target this turn
+    // share one distance field instead of each searching on their own.
+    bool share_fields;
 
-    FixedVector<vector<coord_def>, GXM * GYM> hash;
+    // The path taken from a shared distance field, if one was.
+    vector<coord_def> shared;
+
+    // Whether traversable() doesn't depend on where we are coming from,
+    // so that its result can be remembered for each grid.
+    bool cache_traversable;
+
+    // Distances, backtracking information and the open list, borrowed
+    // from a pool so that they needn't be set up for every search.
+    pathfind_workspace *ws;
 };
 
 #endif
@@ -1191,6 +1191,7 @@ monster* get_free_monster()
         if (env.mons[i].type == MONS_NO_MONSTER)
         {
             env.mons[i].reset();
+            env.mons_used = max(env.mons_used, i + 1);
             return &env.mons[i];
         }
 
@@ -4731,6 +4731,7 @@ void reset_all_monsters()
         }
         menv[i].reset();
     }
+    env.mons_used = 0;
 
     env.mid_cache.clear();
 }
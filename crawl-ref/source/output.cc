@@ -1518,6 +1518,7 @@ void redraw_screen()
     update_turn_count();
     activate_notes(note_status);
 
+    view_mark_all_dirty();
     viewwindow();
 
     // Display the message window at the end because it places
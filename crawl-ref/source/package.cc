@@ -16,6 +16,16 @@ Notes:
 * Readers always get the last complete (but not necessarily committed) write
   (ie, READ_UNCOMMITTED) at the time they started; it is safe to continue
   reading even if the chunk has been changed since.
+* With BACKGROUND_SAVE, closing a writer or calling commit() only queues the
+  work; compression, block writes and the commit itself happen in a worker
+  thread, strictly in the order they were requested.  A crash loses whatever
+  is still queued, returning to the last commit the worker completed.  A
+  reader of a chunk with a pending write waits for that write to land;
+  other reads never wait for the worker's writes or syncs.
+* Chunks written with write_segmented() may be stored as a base plus a delta
+  chunk "<name>~delta" with just the segments that changed since.  Readers
+  get the patched contents; any other write or delete of the base drops the
+  delta.
 */
 
 #include "AppHdr.h"
@@ -26,6 +36,7 @@ Notes:
 #include <cstdlib>
 #include <cstring>
 #include <sstream>
+#include <unordered_map>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -33,8 +44,9 @@ Notes:
 
 #include "endianness.h"
 #include "errors.h"
-#include "syscalls.h"
 #include "libutil.h" // map_find
+#include "lz77.h"
+#include "syscalls.h"
 
 // debugging defines
 #undef  FSCK_VERBOSE
@@ -56,14 +68,50 @@ static plen_t htole(plen_t x)
 #define dprintf(...) do {} while (0)
 #endif
 
-#define PACKAGE_VERSION 1
+// 2: the codec byte
+// 3: delta chunks
+#define PACKAGE_VERSION 3
 #define PACKAGE_MAGIC   0x53534344 /* "DCSS" */
 
+#define ZB_SIZE  32768
+// uncompressed size of a LZ77 frame
+#define LZ_FRAME 65536
+
+#define DELTA_SUFFIX "~delta"
+#define DELTA_VERSION 1
+// Segmented chunks are rewritten in full after this many deltas, or when
+// more than half of them changed.
+#define DELTA_MAX_SAVES 32
+
+enum delta_op
+{
+    DELTA_COPY,         // offset and length in the base
+    DELTA_DATA,         // length, then the data itself
+};
+
+#ifdef BACKGROUND_SAVE
+// Counts its holder's holds on the (recursive) mutex, so that they can all
+// be let go of while waiting.
+class bg_guard
+{
+public:
+    bg_guard(mutex_t &m, int &h) : mtx(m), held(h) { mutex_lock(mtx); ++held; }
+    ~bg_guard() { --held; mutex_unlock(mtx); }
+private:
+    mutex_t &mtx;
+    int &held;
+};
+#define BG_LOCK(pkg) bg_guard _bg_lock((pkg)->bg_mutex, (pkg)->bg_held)
+#else
+#define BG_LOCK(pkg) do {} while (0)
+#endif
+
 struct file_header
 {
     uint32_t magic;
     uint8_t version;
-    char padding[3];
+    uint8_t codec;
+    char padding[2];
     plen_t start;
 };
 
@@ -73,17 +121,121 @@ struct block_header
     plen_t next;
 };
 
+static bool _is_delta(const string &name)
+{
+    return name.length() > strlen(DELTA_SUFFIX)
+           && !name.compare(name.length() - strlen(DELTA_SUFFIX),
+                            string::npos, DELTA_SUFFIX);
+}
+
+// FNV-1a; segments are matched by hash before comparing their bytes, so
+// 32 bits would find too many false matches.
+static uint64_t _hash(const void *data, size_t len,
+                      uint64_t hash = 0xcbf29ce484222325ULL)
+{
+    const uint8_t *d = (const uint8_t*)data;
+    for (size_t i = 0; i < len; ++i)
+        hash = (hash ^ d[i]) * 1099511628211ULL;
+    return hash;
+}
+
+static bool _same(const vector<char> &v, const char *data, plen_t len)
+{
+    return v.size() == len && (!len || !memcmp(&v[0], data, len));
+}
+
+template<typename T>
+static void _put(vector<char> &out, T x)
+{
+    out.insert(out.end(), (const char*)&x, (const char*)&x + sizeof(x));
+}
+
+template<typename T>
+static T _get(const vector<char> &in, plen_t &at)
+{
+    T x;
+    if (in.size() - at < sizeof(x))
+        corrupted("save file corrupted -- delta truncated");
+    memcpy(&x, &in[at], sizeof(x));
+    at += sizeof(x);
+    return x;
+}
+
 typedef map<string, plen_t> directory_t;
 typedef pair<plen_t, plen_t> bm_p;
 typedef map<plen_t, bm_p> bm_t;
 typedef map<plen_t, plen_t> fb_t;
 
+// Append a LZ77 frame: uncompressed and compressed length, then the data.
+// Incompressible data is stored as is, with both lengths equal.
+static void _lz_frame(const char *data, plen_t len, vector<char> &out)
+{
+    const size_t at = out.size();
+    plen_t head[2];
+    out.resize(at + sizeof(head) + lz77_bound(len));
+
+    char *frame = &out[at + sizeof(head)];
+    plen_t clen = lz77_compress(data, len, frame);
+    if (clen >= len)
+    {
+        memcpy(frame, data, len);
+        clen = len;
+    }
+    head[0] = htole(len);
+    head[1] = htole(clen);
+    memcpy(&out[at], head, sizeof(head));
+    out.resize(at + sizeof(head) + clen);
+}
+
+#ifdef BACKGROUND_SAVE
+// Compress a whole chunk at once; the result is the same as what a
+// chunk_writer would have written.
+static bool _compress_chunk(uint8_t codec, vector<char> &data)
+{
+    vector<char> out;
+    if (codec == SAVE_CODEC_LZ77)
+    {
+        for (size_t done = 0; done < data.size(); done += LZ_FRAME)
+        {
+            _lz_frame(&data[done], min<size_t>(LZ_FRAME, data.size() - done),
+                      out);
+        }
+    }
+    else
+    {
+#ifdef USE_ZLIB
+        uLongf zlen = compressBound(data.size());
+        out.resize(zlen);
+        if (compress2((Bytef*)&out[0], &zlen, (const Bytef*)data.data(),
+                      data.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+        {
+            return false;
+        }
+        out.resize(zlen);
+#else
+        return true;
+#endif
+    }
+    data.swap(out);
+    return true;
+}
+#endif
+
 package::package(const char* file, bool writeable, bool empty)
-  : n_users(0), dirty(false), aborted(false)
+  : codec(DEFAULT_SAVE_CODEC), n_users(0), dirty(false), aborted(false)
 #ifdef DO_FSYNC
     , tmp(false)
 #endif
+#ifdef BACKGROUND_SAVE
+    , bg_running(false), bg_quit(false), bg_busy(false)
+    , bg_file_len(0), bg_held(0)
+#endif
 {
+#ifdef BACKGROUND_SAVE
+    mutex_init(bg_mutex);
+    cond_init(bg_wake);
+    cond_init(bg_done);
+#endif
     dprintf("package: initializing file=\"%s\" rw=%d\n", file, writeable);
     ASSERT(writeable || !empty);
     filename = file;
@@ -123,14 +275,29 @@ package::package(const char* file, bool writeable, bool empty)
             throw;
         }
     }
+
+#ifdef BACKGROUND_SAVE
+    if (rw)
+        bg_start();
+#endif
 }
 
 package::package()
-  : rw(true), n_users(0), dirty(false), aborted(false)
+  : rw(true), codec(DEFAULT_SAVE_CODEC), n_users(0), dirty(false),
+    aborted(false)
 #ifdef DO_FSYNC
     , tmp(true)
 #endif
+#ifdef BACKGROUND_SAVE
+    , bg_running(false), bg_quit(false), bg_busy(false)
+    , bg_file_len(0), bg_held(0)
+#endif
 {
+#ifdef BACKGROUND_SAVE
+    mutex_init(bg_mutex);
+    cond_init(bg_wake);
+    cond_init(bg_done);
+#endif
     dprintf("package: initializing tmp file\n");
     filename = "[tmp]";
 
@@ -149,6 +316,10 @@ package::package()
 
     dirty = true;
     file_len = sizeof(file_header);
+
+#ifdef BACKGROUND_SAVE
+    bg_start();
+#endif
 }
 
 void package::load()
@@ -157,8 +328,8 @@ void package::load()
     ssize_t res = ::read(fd, &head, sizeof(file_header));
     if (res < 0)
         sysfail("error reading the save file (%s)", filename.c_str());
-    if (!res || !(head.magic || head.version || head.padding[0]
-                  || head.padding[1] || head.padding[2] || head.start))
+    if (!res || !(head.magic || head.version || head.codec
+                  || head.padding[0] || head.padding[1] || head.start))
     {
         corrupted("The save file (%s) is empty!", filename.c_str());
     }
@@ -174,6 +345,13 @@ void package::load()
     if (len == -1)
         sysfail("save file (%s) is not seekable", filename.c_str());
     file_len = len;
+    // version 1 had zeroed padding in place of the codec, ie zlib
+    codec = head.codec;
+    if (codec >= NUM_SAVE_CODECS)
+    {
+        corrupted("save file (%s) uses an unknown compression %u",
+                  filename.c_str(), codec);
+    }
     read_directory(htole(head.start), head.version);
 
     if (rw)
@@ -208,6 +386,15 @@ package::~package()
         // catching missing manual deletes.  The C++ exit handler is the
         // only place that can be legitimately call things in wrong order.
 
+#ifdef BACKGROUND_SAVE
+    if (bg_running)
+    {
+        bg_stop();
+        if (!aborted)
+            bg_check_error();
+    }
+#endif
+
     if (rw && !aborted)
     {
         commit();
@@ -222,12 +409,29 @@ package::~package()
             sysfail(rw ? "write error while saving"
                        : "can't close the save I've just read???");
         }
+#ifdef BACKGROUND_SAVE
+    cond_destroy(bg_done);
+    cond_destroy(bg_wake);
+    mutex_destroy(bg_mutex);
+#endif
     dprintf("package: closed\n");
 }
 
 void package::commit()
 {
     ASSERT(rw);
+#ifdef BACKGROUND_SAVE
+    if (bg_running)
+    {
+        bg_enqueue(BG_COMMIT, "");
+        return;
+    }
+#endif
+    do_commit();
+}
+
+void package::do_commit()
+{
     if (!dirty)
         return;
     ASSERT(!aborted);
@@ -239,6 +443,7 @@ void package::commit()
     file_header head;
     head.magic = htole(PACKAGE_MAGIC);
     head.version = PACKAGE_VERSION;
+    head.codec = codec;
     memset(&head.padding, 0, sizeof(head.padding));
     head.start = htole(write_directory());
 #ifdef DO_FSYNC
@@ -273,6 +478,49 @@ void package::seek(plen_t to)
         sysfail("failed to seek inside the save file");
 }
 
+// Read from the save file without the package lock.
+ssize_t package::read_at(plen_t at, void *buf, plen_t len)
+{
+#ifdef BACKGROUND_SAVE
+    // The worker thread may be seeking around to write other chunks.
+    ASSERT(!is_aborted());
+    return pread(fd, buf, len, at);
+#else
+    seek(at);
+    return ::read(fd, buf, len);
+#endif
+}
+
+// The directory that readers look chunks up in.  Needs bg_mutex.
+map<string, plen_t> &package::visible_directory()
+{
+#ifdef BACKGROUND_SAVE
+    if (bg_running)
+        return bg_directory;
+#endif
+    return directory;
+}
+
+plen_t package::get_size()
+{
+#ifdef BACKGROUND_SAVE
+    if (bg_running)
+    {
+        BG_LOCK(this);
+        return bg_file_len;
+    }
+#endif
+    return file_len;
+}
+
+// Whether the save was abandoned, by abort() or by the worker thread
+// failing.  For the main thread.
+bool package::is_aborted()
+{
+    BG_LOCK(this);
+    return aborted;
+}
+
 chunk_writer* package::writer(const string name)
 {
     return new chunk_writer(this, name);
@@ -280,9 +528,255 @@ chunk_writer* package::writer(const string name)
 
 chunk_reader* package::reader(const string name)
 {
-    if (plen_t *ch = map_find(directory, name))
-        return new chunk_reader(this, *ch);
-    return 0;
+    if (!has_chunk(name))
+        return 0;
+    return new chunk_reader(this, name);
+}
+
+/**
+ * Write a chunk that was serialized in one piece, incrementally.
+ *
+ * The data is split into segments at the given offsets.  If the chunk was
+ * last written by this function, segments that are unchanged since that
+ * full write are not written again: a delta chunk gets only the ones that
+ * differ, and nothing at all is written if the data is the same as last
+ * time.  A full rewrite happens every DELTA_MAX_SAVES deltas, or once over
+ * half of the data changed, and the first time after loading the save.
+ *
+ * Segments are matched by content, so they may move around; a segment that
+ * changes size only costs itself.  Only their lengths and hashes are kept
+ * in memory: the stored data is read back to compare against when the
+ * hashes say it's unchanged, and when making a delta.
+ */
+void package::write_segmented(const string name, const void *data,
+                              plen_t len, const vector<plen_t> &segments)
+{
+    ASSERT(!_is_delta(name));
+    const char *bytes = (const char*)data;
+
+    seg_base cur;
+    cur.len = len;
+    cur.hash = _hash(&len, sizeof(len));
+    cur.deltas = 0;
+    plen_t at = 0;
+    for (size_t i = 0; i <= segments.size(); ++i)
+    {
+        const plen_t end = i < segments.size() ? min(segments[i], len) : len;
+        if (end <= at)
+            continue;
+        const uint64_t hash = _hash(bytes + at, end - at);
+        cur.seg_len.push_back(end - at);
+        cur.seg_hash.push_back(hash);
+        cur.hash = _hash(&hash, sizeof(hash), cur.hash);
+        at = end;
+    }
+    cur.last_len = cur.len;
+    cur.last_hash = cur.hash;
+
+    seg_base *base = map_find(seg_bases, name);
+    if (base && has_chunk(name))
+    {
+        if (cur.len == base->last_len && cur.hash == base->last_hash)
+        {
+            vector<char> last;
+            {
+                chunk_reader rd(this, name);
+                rd.read_all(last);
+            }
+            if (_same(last, bytes, len))
+            {
+                dprintf("write_segmented(%s): unchanged\n", name.c_str());
+                return;
+            }
+        }
+
+        base->last_len = cur.len;
+        base->last_hash = cur.hash;
+        const bool same_hash = cur.len == base->len && cur.hash == base->hash;
+        vector<char> base_data;
+        if (same_hash || base->deltas < DELTA_MAX_SAVES)
+            read_base(name, base_data);
+
+        if (same_hash && _same(base_data, bytes, len))
+        {
+            dprintf("write_segmented(%s): back to base\n", name.c_str());
+            if (has_chunk(name + DELTA_SUFFIX))
+                delete_chunk(name + DELTA_SUFFIX);
+            return;
+        }
+
+        vector<char> delta;
+        if (base->deltas < DELTA_MAX_SAVES
+            && make_delta(*base, base_data, cur, bytes, delta))
+        {
+            dprintf("write_segmented(%s): delta of %u bytes\n", name.c_str(),
+                    (unsigned int)delta.size());
+            base->deltas++;
+            chunk_writer dw(this, name + DELTA_SUFFIX);
+            dw.write(&delta[0], delta.size());
+            return;
+        }
+    }
+
+    dprintf("write_segmented(%s): full\n", name.c_str());
+    {
+        // Drops the old delta once written.
+        chunk_writer w(this, name);
+        if (len)
+            w.write(data, len);
+    }
+    seg_bases[name] = move(cur);
+}
+
+// Read a segmented chunk's base as it is stored, without its delta.
+void package::read_base(const string &name, vector<char> &out)
+{
+#ifdef BACKGROUND_SAVE
+    bg_wait(name);
+#endif
+    plen_t start;
+    {
+        BG_LOCK(this);
+        start = visible_directory()[name];
+    }
+    chunk_reader rd(this, start);
+    out.clear();
+    rd.read_all(out);
+}
+
+// Encode cur as copies of the base's segments and new data.  Returns false
+// if most of it would be new, a full write is better then.
+bool package::make_delta(const seg_base &base, const vector<char> &base_data,
+                         const seg_base &cur, const char *data,
+                         vector<char> &delta)
+{
+    // hash -> offset in the base
+    unordered_map<uint64_t, plen_t> base_at;
+    plen_t at = 0;
+    for (size_t i = 0; i < base.seg_len.size(); ++i)
+    {
+        base_at.emplace(base.seg_hash[i], at);
+        at += base.seg_len[i];
+    }
+
+    struct op { delta_op type; plen_t off, len; };
+    vector<op> ops;
+    plen_t fresh = 0;
+    at = 0;
+    for (size_t i = 0; i < cur.seg_len.size(); ++i)
+    {
+        const plen_t len = cur.seg_len[i];
+        auto b = base_at.find(cur.seg_hash[i]);
+        plen_t off;
+        delta_op type;
+        if (b != base_at.end() && b->second + len <= base_data.size()
+            && !memcmp(&base_data[b->second], data + at, len))
+        {
+            type = DELTA_COPY, off = b->second;
+        }
+        else
+            type = DELTA_DATA, off = at, fresh += len;
+        at += len;
+
+        if (!ops.empty() && ops.back().type == type
+            && ops.back().off + ops.back().len == off)
+        {
+            ops.back().len += len;
+        }
+        else
+            ops.push_back({type, off, len});
+    }
+    if (fresh > cur.len / 2)
+        return false;
+
+    _put<uint8_t>(delta, DELTA_VERSION);
+    _put<plen_t>(delta, htole(base.deltas + 1));
+    _put<plen_t>(delta, htole(base.len));
+    _put<plen_t>(delta, htole(base.seg_len.size()));
+    for (size_t i = 0; i < base.seg_len.size(); ++i)
+    {
+        _put<plen_t>(delta, htole(base.seg_len[i]));
+        _put<uint64_t>(delta, htole64(base.seg_hash[i]));
+    }
+    _put<plen_t>(delta, htole(cur.len));
+    for (const op &o : ops)
+    {
+        _put<uint8_t>(delta, o.type);
+        _put<plen_t>(delta, htole(o.len));
+        if (o.type == DELTA_COPY)
+            _put<plen_t>(delta, htole(o.off));
+        else
+            delta.insert(delta.end(), data + o.off, data + o.off + o.len);
+    }
+    return true;
+}
+
+// Patch the base of a segmented chunk.  The base's layout stored in the
+// delta lets further writes continue making deltas against it.
+void package::apply_delta(const string &name, const vector<char> &base,
+                          const vector<char> &delta, vector<char> &out)
+{
+    plen_t at = 0;
+    if (_get<uint8_t>(delta, at) != DELTA_VERSION)
+        corrupted("save file corrupted -- unknown delta format");
+
+    seg_base layout;
+    layout.deltas = htole(_get<plen_t>(delta, at));
+    layout.len = htole(_get<plen_t>(delta, at));
+    if (layout.len != base.size())
+        corrupted("save file corrupted -- delta of \"%s\" has a wrong base",
+                  name.c_str());
+    layout.hash = _hash(&layout.len, sizeof(layout.len));
+    const plen_t nseg = htole(_get<plen_t>(delta, at));
+    plen_t off = 0;
+    for (plen_t i = 0; i < nseg; ++i)
+    {
+        const plen_t len = htole(_get<plen_t>(delta, at));
+        const uint64_t hash = htole64(_get<uint64_t>(delta, at));
+        if (len > base.size() - off || _hash(&base[off], len) != hash)
+        {
+            corrupted("save file corrupted -- delta of \"%s\" has a wrong "
+                      "base", name.c_str());
+        }
+        layout.seg_len.push_back(len);
+        layout.seg_hash.push_back(hash);
+        layout.hash = _hash(&hash, sizeof(hash), layout.hash);
+        off += len;
+    }
+
+    const plen_t out_len = htole(_get<plen_t>(delta, at));
+    out.clear();
+    out.reserve(out_len);
+    while (at < delta.size())
+    {
+        const uint8_t type = _get<uint8_t>(delta, at);
+        const plen_t len = htole(_get<plen_t>(delta, at));
+        if (type == DELTA_COPY)
+        {
+            off = htole(_get<plen_t>(delta, at));
+            if (off > base.size() || len > base.size() - off)
+                corrupted("save file corrupted -- invalid delta");
+            out.insert(out.end(), base.begin() + off, base.begin() + off + len);
+        }
+        else if (type == DELTA_DATA)
+        {
+            if (len > delta.size() - at)
+                corrupted("save file corrupted -- delta truncated");
+            out.insert(out.end(), delta.begin() + at, delta.begin() + at + len);
+            at += len;
+        }
+        else
+            corrupted("save file corrupted -- invalid delta");
+    }
+    if (out.size() != out_len)
+        corrupted("save file corrupted -- delta has a wrong length");
+
+    // We don't know the layout of what we've just read, so the next write
+    // can't be skipped -- but it can be a delta.
+    layout.last_len = 0;
+    layout.last_hash = 0;
+    if (!seg_bases.count(name))
+        seg_bases[name] = move(layout);
 }
 
 plen_t package::extend_block(plen_t at, plen_t size, plen_t by)
@@ -359,6 +853,10 @@ void package::finish_chunk(const string name, plen_t at)
     directory[name] = at;
     new_chunks.insert(at);
     dirty = true;
+
+    // The delta was against the old contents.
+    if (!name.empty() && !_is_delta(name))
+        remove_chunk(name + DELTA_SUFFIX);
 }
 
 void package::free_chunk(const string name)
@@ -377,14 +875,39 @@ void package::free_chunk(const string name)
 }
 
 void package::delete_chunk(const string name)
+{
+    seg_bases.erase(name);
+#ifdef BACKGROUND_SAVE
+    if (bg_running)
+    {
+        bg_enqueue(BG_DELETE, name);
+        return;
+    }
+#endif
+    remove_chunk(name);
+}
+
+void package::remove_chunk(const string name)
 {
     free_chunk(name);
     directory.erase(name);
+    if (!name.empty() && !_is_delta(name))
+    {
+        free_chunk(name + DELTA_SUFFIX);
+        directory.erase(name + DELTA_SUFFIX);
+    }
+}
+
+// Write an already compressed chunk.
+void package::store_chunk(const string name, const void *data, plen_t len)
+{
+    chunk_writer ch(this, name, false);
+    ch.raw_write(data, len);
 }
 
 plen_t package::write_directory()
 {
-    delete_chunk("");
+    remove_chunk("");
 
     stringstream dir;
     for (const auto &entry : directory)
@@ -421,11 +944,15 @@ void package::collect_blocks()
 
 void package::free_block_chain(plen_t at)
 {
-    if (reader_count.count(at))
     {
-        dprintf("deleting an in-use chain at %d\n", at);
-        unlinked_blocks.push_back(at);
-        return;
+        // Readers come and go on the main thread.
+        BG_LOCK(this);
+        if (reader_count.count(at))
+        {
+            dprintf("deleting an in-use chain at %d\n", at);
+            unlinked_blocks.push_back(at);
+            return;
+        }
     }
 
     dprintf("freeing an unlinked chain at %d\n", at);
@@ -534,6 +1061,8 @@ void package::read_directory(plen_t start, uint8_t version)
         }
         break;
     case 1:
+    case 2:
+    case 3:
         uint8_t name_len;
         plen_t bstart;
         while (plen_t res = rd.read(&name_len, sizeof(name_len)))
@@ -558,15 +1087,25 @@ void package::read_directory(plen_t start, uint8_t version)
 
 bool package::has_chunk(const string name)
 {
-    return !name.empty() && directory.count(name);
+    if (name.empty())
+        return false;
+#ifdef BACKGROUND_SAVE
+    BG_LOCK(this);
+    if (int pending = bg_pending(name))
+        return pending > 0;
+#endif
+    return visible_directory().count(name);
 }
 
 vector<string> package::list_chunks()
 {
+#ifdef BACKGROUND_SAVE
+    bg_wait("");
+#endif
     vector<string> list;
     list.reserve(directory.size());
     for (const auto &entry : directory)
-        if (!entry.first.empty())
+        if (!entry.first.empty() && !_is_delta(entry.first))
             list.push_back(entry.first);
 
     return list;
@@ -613,6 +1152,18 @@ void package::abort()
     // Disable any further operations, allow a shutdown.  All errors past
     // this point are ignored (assuming we already failed).  All writes since
     // the last commit() are lost.
+#ifdef BACKGROUND_SAVE
+    if (bg_running)
+    {
+        // We may be crashing with the lock already held.
+        BG_LOCK(this);
+        bg_queue.clear();
+        while (bg_busy)
+            bg_sleep(bg_done);
+        aborted = true;
+        return;
+    }
+#endif
     aborted = true;
 }
 
@@ -627,6 +1178,9 @@ void package::unlink()
 // the amount of free space not at the end of file
 plen_t package::get_slack()
 {
+#ifdef BACKGROUND_SAVE
+    bg_wait("");
+#endif
     load_traces();
 
     plen_t slack = 0;
@@ -637,6 +1191,9 @@ plen_t package::get_slack()
 
 plen_t package::get_chunk_fragmentation(const string name)
 {
+#ifdef BACKGROUND_SAVE
+    bg_wait("");
+#endif
     load_traces();
     ASSERT(directory.count(name)); // not has_chunk(), "" is valid
     plen_t frags = 0;
@@ -653,6 +1210,9 @@ plen_t package::get_chunk_fragmentation(const string name)
 
 plen_t package::get_chunk_compressed_length(const string name)
 {
+#ifdef BACKGROUND_SAVE
+    bg_wait("");
+#endif
     load_traces();
     ASSERT(directory.count(name)); // not has_chunk(), "" is valid
     plen_t len = 0;
@@ -667,11 +1227,208 @@ plen_t package::get_chunk_compressed_length(const string name)
     return len;
 }
 
+#ifdef BACKGROUND_SAVE
+void package::bg_start()
+{
+    bg_directory = directory;
+    bg_file_len = file_len;
+    if (thread_create_joinable(&bg_thread, bg_worker, this))
+    {
+        // if thread creation fails, save synchronously
+        dprintf("package: no worker thread, saving synchronously\n");
+        return;
+    }
+    bg_running = true;
+}
+
+void package::bg_stop()
+{
+    {
+        BG_LOCK(this);
+        bg_quit = true;
+        cond_wake(bg_wake);
+    }
+    thread_join(bg_thread);
+    bg_running = false;
+}
+
+void* package::bg_worker(void *arg)
+{
+    static_cast<package*>(arg)->bg_work();
+    return 0;
+}
+
+void package::bg_work()
+{
+    BG_LOCK(this);
+    while (true)
+    {
+        while (bg_queue.empty() && !bg_quit)
+            bg_sleep(bg_wake);
+        // The queue gets drained before quitting.
+        if (bg_queue.empty())
+            break;
+
+        bg_current = move(bg_queue.front());
+        bg_queue.pop_front();
+        bg_busy = true;
+
+        // Compress, write and sync without holding the lock, that's what
+        // we're here for.  The main thread leaves bg_current alone while
+        // bg_busy, and doesn't touch the directory or the blocks.
+        --bg_held;
+        mutex_unlock(bg_mutex);
+        exception_ptr err;
+        try
+        {
+            switch (bg_current.type)
+            {
+            case BG_WRITE:
+            {
+                vector<char> &data = bg_current.data;
+                if (!_compress_chunk(codec, data))
+                    fail("save file compression failed");
+                if (!aborted)
+                    store_chunk(bg_current.name, data.data(), data.size());
+                break;
+            }
+            case BG_DELETE:
+                if (!aborted)
+                    remove_chunk(bg_current.name);
+                break;
+            case BG_COMMIT:
+                if (!aborted)
+                    do_commit();
+                break;
+            }
+        }
+        catch (...)
+        {
+            err = current_exception();
+        }
+        mutex_lock(bg_mutex);
+        ++bg_held;
+
+        if (err)
+        {
+            // Report it to the main thread, and don't touch the file again:
+            // the save stays at the last successful commit.
+            bg_error = err;
+            bg_queue.clear();
+            aborted = true;
+        }
+        else
+        {
+            bg_directory = directory;
+            bg_file_len = file_len;
+        }
+
+        bg_current = bg_job();
+        bg_busy = false;
+        cond_wake(bg_done);
+    }
+}
+
+void package::bg_enqueue(bg_job_type type, const string &name,
+                         vector<char> *data)
+{
+    BG_LOCK(this);
+    bg_check_error();
+    ASSERT(!aborted);
+
+    bg_job job;
+    job.type = type;
+    job.name = name;
+    if (data)
+        job.data.swap(*data);
+    bg_queue.push_back(move(job));
+    cond_wake(bg_wake);
+}
+
+// Is there a queued or running operation on this chunk?  Returns 1 if the
+// chunk is going to be written, -1 if deleted, 0 if nothing is pending.
+// An empty name matches everything.  A write or delete of a segmented
+// chunk's base drops its delta, so counts as deleting the delta.
+// Needs bg_mutex.
+int package::bg_pending(const string &name)
+{
+    const string base = _is_delta(name)
+        ? name.substr(0, name.length() - strlen(DELTA_SUFFIX)) : "";
+    auto effect = [&](const bg_job &job) -> int
+    {
+        if (name.empty() || job.name == name)
+            return job.type == BG_DELETE ? -1 : 1;
+        if (!base.empty() && job.type != BG_COMMIT && job.name == base)
+            return -1;
+        return 0;
+    };
+
+    for (auto it = bg_queue.rbegin(); it != bg_queue.rend(); ++it)
+    {
+        if (it->type == BG_COMMIT && !name.empty())
+            continue;
+        if (int e = effect(*it))
+            return e;
+    }
+    if (bg_busy)
+        return effect(bg_current);
+    return 0;
+}
+
+// Wait on a condition with every hold on bg_mutex let go of: the mutex is
+// recursive, and a single cond_wait() would leave the outer holds in place,
+// keeping the worker from ever getting in to signal us.
+void package::bg_sleep(cond_t &cond)
+{
+    const int held = bg_held;
+    for (int i = 1; i < held; ++i)
+        mutex_unlock(bg_mutex);
+    bg_held = 0;
+    cond_wait(cond, bg_mutex);
+    bg_held = held;
+    for (int i = 1; i < held; ++i)
+        mutex_lock(bg_mutex);
+}
+
+// Wait until nothing is pending on the given chunk (or on any, for "").
+void package::bg_wait(const string &name)
+{
+    if (!bg_running)
+        return;
+
+    BG_LOCK(this);
+    while (bg_pending(name))
+        bg_sleep(bg_done);
+    bg_check_error();
+}
+
+void package::bg_check_error()
+{
+    if (!bg_error)
+        return;
+
+    exception_ptr err = bg_error;
+    bg_error = nullptr;
+    rethrow_exception(err);
+}
+#endif
+
 chunk_writer::chunk_writer(package *parent, const string _name)
-    : first_block(0), cur_block(0), block_len(0)
+    : chunk_writer(parent, _name, true)
+{
+    // The chunk is written in full now; write_segmented() sets up a new base
+    // if it's the one writing.  The directory is written by the worker
+    // thread, but it's not segmented.
+    if (!name.empty())
+        pkg->seg_bases.erase(name);
+}
+
+chunk_writer::chunk_writer(package *parent, const string _name,
+                           bool _compress)
+    : first_block(0), cur_block(0), block_len(0), compress(_compress)
 {
     ASSERT(parent);
-    ASSERT(!parent->aborted);
+    ASSERT(!parent->is_aborted());
 
     // If you need more, please change {read,write}_directory().
     ASSERT(MAX_CHUNK_NAME_LENGTH < 256);
@@ -679,8 +1436,26 @@ chunk_writer::chunk_writer(package *parent, const string _name)
 
     dprintf("chunk_writer(%s): starting\n", _name.c_str());
     pkg = parent;
-    pkg->n_users++;
     name = _name;
+    {
+        BG_LOCK(pkg);
+        pkg->n_users++;
+    }
+
+#ifdef BACKGROUND_SAVE
+    // The directory is written by the worker itself.
+    deferred = compress && pkg->bg_running && !name.empty();
+    if (deferred)
+        return;
+#endif
+
+    if (!compress)
+        return;
+    if (pkg->codec == SAVE_CODEC_LZ77)
+    {
+        lz_in.reserve(LZ_FRAME);
+        return;
+    }
 
 #ifdef USE_ZLIB
     zs.data_type = Z_BINARY;
@@ -689,7 +1464,6 @@ chunk_writer::chunk_writer(package *parent, const string _name)
     zs.opaque    = Z_NULL;
     if (deflateInit(&zs, Z_DEFAULT_COMPRESSION))
         fail("save file compression failed during init: %s", zs.msg);
-#define ZB_SIZE 32768
     zs.next_out  = z_buffer = (Bytef*)malloc(ZB_SIZE);
     zs.avail_out = ZB_SIZE;
 #endif
@@ -699,33 +1473,58 @@ chunk_writer::~chunk_writer()
 {
     dprintf("chunk_writer(%s): closing\n", name.c_str());
 
-    ASSERT(pkg->n_users > 0);
-    pkg->n_users--;
-    if (pkg->aborted)
+#ifdef BACKGROUND_SAVE
+    if (deferred)
+    {
+        {
+            BG_LOCK(pkg);
+            ASSERT(pkg->n_users > 0);
+            pkg->n_users--;
+        }
+        if (!pkg->is_aborted())
+            pkg->bg_enqueue(package::BG_WRITE, name, &pending);
+        return;
+    }
+#endif
+
+    {
+        BG_LOCK(pkg);
+        ASSERT(pkg->n_users > 0);
+        pkg->n_users--;
+    }
+    if (pkg->is_aborted())
     {
 #ifdef USE_ZLIB
         // ignore errors, they're not relevant anymore
-        deflateEnd(&zs);
-        free(z_buffer);
+        if (compress && pkg->codec == SAVE_CODEC_ZLIB)
+        {
+            deflateEnd(&zs);
+            free(z_buffer);
+        }
 #endif
         return;
     }
 
+    if (compress && pkg->codec == SAVE_CODEC_LZ77)
+        lz_flush(true);
 #ifdef USE_ZLIB
-    zs.avail_in = 0;
-    int res;
-    do
+    else if (compress)
     {
-        res = deflate(&zs, Z_FINISH);
-        if (res != Z_STREAM_END && res != Z_OK && res != Z_BUF_ERROR)
-            fail("save file compression failed: %s", zs.msg);
-        raw_write(z_buffer, zs.next_out - z_buffer);
-        zs.next_out = z_buffer;
-        zs.avail_out = ZB_SIZE;
-    } while (res != Z_STREAM_END);
-    if (deflateEnd(&zs) != Z_OK)
-        fail("save file compression failed during clean-up: %s", zs.msg);
-    free(z_buffer);
+        zs.avail_in = 0;
+        int res;
+        do
+        {
+            res = deflate(&zs, Z_FINISH);
+            if (res != Z_STREAM_END && res != Z_OK && res != Z_BUF_ERROR)
+                fail("save file compression failed: %s", zs.msg);
+            raw_write(z_buffer, zs.next_out - z_buffer);
+            zs.next_out = z_buffer;
+            zs.avail_out = ZB_SIZE;
+        } while (res != Z_STREAM_END);
+        if (deflateEnd(&zs) != Z_OK)
+            fail("save file compression failed during clean-up: %s", zs.msg);
+        free(z_buffer);
+    }
 #endif
     if (cur_block)
         finish_block(0);
@@ -774,7 +1573,25 @@ void chunk_writer::finish_block(plen_t next)
 void chunk_writer::write(const void *data, plen_t len)
 {
     ASSERT(data);
-    ASSERT(!pkg->aborted);
+    ASSERT(!pkg->is_aborted());
+
+#ifdef BACKGROUND_SAVE
+    if (deferred)
+    {
+        pending.insert(pending.end(), (const char*)data,
+                       (const char*)data + len);
+        return;
+    }
+#endif
+
+    ASSERT(compress);
+    if (pkg->codec == SAVE_CODEC_LZ77)
+    {
+        lz_in.insert(lz_in.end(), (const char*)data, (const char*)data + len);
+        if (lz_in.size() >= LZ_FRAME)
+            lz_flush(false);
+        return;
+    }
 
 #ifdef USE_ZLIB
     zs.next_in  = (Bytef*)data;
@@ -796,14 +1613,37 @@ void chunk_writer::write(const void *data, plen_t len)
 #endif
 }
 
+// Write out full frames, or everything if all is set.
+void chunk_writer::lz_flush(bool all)
+{
+    plen_t done = 0;
+    while (lz_in.size() - done >= LZ_FRAME || all && done < lz_in.size())
+    {
+        plen_t len = min<plen_t>(LZ_FRAME, lz_in.size() - done);
+        lz_out.clear();
+        _lz_frame(&lz_in[done], len, lz_out);
+        raw_write(&lz_out[0], lz_out.size());
+        done += len;
+    }
+    lz_in.erase(lz_in.begin(), lz_in.begin() + done);
+}
+
 void chunk_reader::init(plen_t start)
 {
-    ASSERT(!pkg->aborted);
-    pkg->n_users++;
-    pkg->reader_count[start]++;
+    ASSERT(!pkg->is_aborted());
+    {
+        BG_LOCK(pkg);
+        pkg->n_users++;
+        pkg->reader_count[start]++;
+    }
     first_block = next_block = start;
     block_left = 0;
 
+    lz_pos = 0;
+    spliced = false;
+    if (pkg->codec == SAVE_CODEC_LZ77)
+        return;
+
 #ifdef USE_ZLIB
     if (!start)
         corrupted("save file corrupted -- zlib header missing");
@@ -815,6 +1655,7 @@ void chunk_reader::init(plen_t start)
     zs.avail_in  = 0;
     if (inflateInit(&zs))
         fail("save file decompression failed during init: %s", zs.msg);
+    z_buffer = (Bytef*)malloc(ZB_SIZE);
     eof = false;
 #endif
 }
@@ -830,11 +1671,40 @@ chunk_reader::chunk_reader(package *parent, plen_t start)
 chunk_reader::chunk_reader(package *parent, const string _name)
 {
     ASSERT(parent);
-    if (!parent->has_chunk(_name))
-        corrupted("save file corrupted -- chunk \"%s\" missing", _name.c_str());
-    dprintf("chunk_reader(%s): starting\n", _name.c_str());
-    pkg = parent;
-    init(parent->directory[_name]);
+    const string delta_name = _name + DELTA_SUFFIX;
+#ifdef BACKGROUND_SAVE
+    parent->bg_wait(_name);
+    parent->bg_wait(delta_name);
+#endif
+    plen_t delta = 0;
+    {
+        BG_LOCK(parent);
+        if (!parent->has_chunk(_name))
+            corrupted("save file corrupted -- chunk \"%s\" missing", _name.c_str());
+        dprintf("chunk_reader(%s): starting\n", _name.c_str());
+        pkg = parent;
+        map<string, plen_t> &dir = parent->visible_directory();
+        init(dir[_name]);
+        if (!_is_delta(_name))
+            if (plen_t *d = map_find(dir, delta_name))
+                delta = *d;
+    }
+    if (delta)
+        splice_delta(_name, delta);
+}
+
+// Read the whole base, and serve it patched with the delta from memory.
+void chunk_reader::splice_delta(const string &name, plen_t delta_start)
+{
+    vector<char> base, delta;
+    read_all(base);
+    {
+        chunk_reader dr(pkg, delta_start);
+        dr.read_all(delta);
+    }
+    pkg->apply_delta(name, base, delta, lz_data);
+    lz_pos = 0;
+    spliced = true;
 }
 
 chunk_reader::~chunk_reader()
@@ -842,9 +1712,14 @@ chunk_reader::~chunk_reader()
     dprintf("chunk_reader: closing\n");
 
 #ifdef USE_ZLIB
-    if (inflateEnd(&zs) != Z_OK)
-        fail("save file decompression failed during clean-up: %s", zs.msg);
+    if (pkg->codec == SAVE_CODEC_ZLIB)
+    {
+        free(z_buffer);
+        if (inflateEnd(&zs) != Z_OK)
+            fail("save file decompression failed during clean-up: %s", zs.msg);
+    }
 #endif
+    BG_LOCK(pkg);
     ASSERT(pkg->reader_count[first_block] > 0);
     if (!--pkg->reader_count[first_block])
         pkg->reader_count.erase(first_block);
@@ -863,8 +1738,7 @@ plen_t chunk_reader::raw_read(void *data, plen_t len)
                 return (char*)buf - (char*)data;
 
             block_header bl;
-            pkg->seek(next_block);
-            ssize_t res = ::read(pkg->fd, &bl, sizeof(block_header));
+            ssize_t res = pkg->read_at(next_block, &bl, sizeof(block_header));
             if (res < 0)
                 sysfail("error reading the save file");
             if (res != sizeof(block_header))
@@ -877,13 +1751,11 @@ plen_t chunk_reader::raw_read(void *data, plen_t len)
             if (!block_left)
                 corrupted("save file corrupted -- empty block");
         }
-        else
-            pkg->seek(off);
 
         plen_t s = len;
         if (s > block_left)
             s = block_left;
-        ssize_t res = ::read(pkg->fd, buf, s);
+        ssize_t res = pkg->read_at(off, buf, s);
         if (res < 0)
             sysfail("error reading the save file");
         if ((plen_t)res != s)
@@ -901,9 +1773,12 @@ plen_t chunk_reader::raw_read(void *data, plen_t len)
 plen_t chunk_reader::read(void *data, plen_t len)
 {
     ASSERT(data);
-    if (pkg->aborted)
+    if (pkg->is_aborted())
         return 0;
 
+    if (spliced || pkg->codec == SAVE_CODEC_LZ77)
+        return lz_read(data, len);
+
 #ifdef USE_ZLIB
     if (!len)
         return 0;
@@ -917,7 +1792,7 @@ plen_t chunk_reader::read(void *data, plen_t len)
         if (!zs.avail_in)
         {
             zs.next_in  = z_buffer;
-            zs.avail_in = raw_read(z_buffer, sizeof(z_buffer));
+            zs.avail_in = raw_read(z_buffer, ZB_SIZE);
             if (!zs.avail_in)
                 corrupted("save file corrupted -- block truncated");
         }
@@ -936,6 +1811,54 @@ plen_t chunk_reader::read(void *data, plen_t len)
 #endif
 }
 
+plen_t chunk_reader::lz_read(void *data, plen_t len)
+{
+    char *buf = (char*)data;
+    while (len)
+    {
+        if (lz_pos == lz_data.size())
+        {
+            if (spliced)
+                break;
+            plen_t head[2];
+            plen_t res = raw_read(head, sizeof(head));
+            if (!res)
+                break;
+            if (res != sizeof(head))
+                corrupted("save file corrupted -- block truncated");
+
+            plen_t flen = htole(head[0]);
+            plen_t clen = htole(head[1]);
+            if (!flen || flen > LZ_FRAME || !clen || clen > flen)
+                corrupted("save file corrupted -- invalid frame");
+
+            lz_data.resize(flen);
+            lz_pos = 0;
+            if (clen == flen)
+            {
+                if (raw_read(&lz_data[0], flen) != flen)
+                    corrupted("save file corrupted -- block truncated");
+            }
+            else
+            {
+                lz_comp.resize(clen);
+                if (raw_read(&lz_comp[0], clen) != clen)
+                    corrupted("save file corrupted -- block truncated");
+                if (!lz77_decompress(&lz_comp[0], clen, &lz_data[0], flen))
+                    corrupted("save file decompression failed");
+            }
+        }
+
+        plen_t s = min<plen_t>(len, lz_data.size() - lz_pos);
+        memcpy(buf, &lz_data[lz_pos], s);
+        lz_pos += s;
+        buf += s;
+        len -= s;
+    }
+
+    return buf - (char*)data;
+}
+
 void chunk_reader::read_all(vector<char> &data)
 {
 #define SPACE 1024
@@ -9,6 +9,11 @@
 #ifdef USE_ZLIB
 #include <zlib.h>
 #endif
+#ifdef BACKGROUND_SAVE
+#include <deque>
+#include <exception>
+#include "threads.h"
+#endif
 
 #if !defined(DGAMELAUNCH) && !defined(__ANDROID__) && !defined(DEBUG_DIAGNOSTICS)
 #define DO_FSYNC
@@ -18,6 +23,22 @@
 
 typedef uint32_t plen_t;
 
+// How chunk contents are compressed, stored in the file header.  A package
+// keeps the codec it was created with, including the one in the directory.
+enum save_codec
+{
+    SAVE_CODEC_ZLIB,    // one deflate stream per chunk
+    SAVE_CODEC_LZ77,    // frames of fast LZ77, see lz77.cc
+    NUM_SAVE_CODECS,
+};
+
+// The codec of newly created saves.  Servers care more about CPU than disk.
+#ifdef DGAMELAUNCH
+#define DEFAULT_SAVE_CODEC SAVE_CODEC_LZ77
+#else
+#define DEFAULT_SAVE_CODEC SAVE_CODEC_ZLIB
+#endif
+
 class package;
 
 class chunk_writer
@@ -28,12 +49,21 @@ private:
     plen_t first_block;
     plen_t cur_block;
     plen_t block_len;
+    bool compress;
 #ifdef USE_ZLIB
     z_stream zs;
     Bytef *z_buffer;
 #endif
+    vector<char> lz_in, lz_out;
+#ifdef BACKGROUND_SAVE
+    // uncompressed data, handed to the worker thread on close
+    bool deferred;
+    vector<char> pending;
+#endif
+    chunk_writer(package *parent, const string _name, bool _compress);
     void raw_write(const void *data, plen_t len);
     void finish_block(plen_t next);
+    void lz_flush(bool all);
 public:
     chunk_writer(package *parent, const string _name);
     ~chunk_writer();
@@ -52,9 +82,16 @@ private:
 #ifdef USE_ZLIB
     bool eof;
     z_stream zs;
-    Bytef z_buffer[32768];
+    Bytef *z_buffer;
 #endif
+    // decompressed LZ77 frame, and how much of it was already read
+    vector<char> lz_data, lz_comp;
+    plen_t lz_pos;
+    // the whole chunk is in lz_data, patched with a delta
+    bool spliced;
     plen_t raw_read(void *data, plen_t len);
+    plen_t lz_read(void *data, plen_t len);
+    void splice_delta(const string &name, plen_t delta_start);
 public:
     chunk_reader(package *parent, const string _name);
     ~chunk_reader();
@@ -74,18 +111,22 @@ public:
     void commit();
     void delete_chunk(const string name);
     bool has_chunk(const string name);
+    void write_segmented(const string name, const void *data, plen_t len,
+                         const vector<plen_t> &segments);
     vector<string> list_chunks();
     void abort();
     void unlink();
 
     // statistics
     plen_t get_slack();
-    plen_t get_size() const { return file_len; };
+    plen_t get_size();
     plen_t get_chunk_fragmentation(const string name);
     plen_t get_chunk_compressed_length(const string name);
+    save_codec get_codec() const { return (save_codec)codec; };
 private:
     string filename;
     bool rw;
+    uint8_t codec;
     int fd;
     plen_t file_len;
     int n_users;
@@ -100,6 +141,74 @@ private:
     map<plen_t, pair<plen_t, plen_t> > block_map;
     set<plen_t> new_chunks;
     map<plen_t, uint32_t> reader_count;
+    // The full copy of a chunk stored with write_segmented(), which deltas
+    // are made against.  Only used by the main thread.
+    // Hashes only find candidates: nothing is skipped or copied from the
+    // base until its bytes, read back from the save, have been compared.
+    struct seg_base
+    {
+        plen_t len;
+        uint64_t hash;          // of all the segments
+        plen_t last_len;        // the latest write, full or delta
+        uint64_t last_hash;
+        int deltas;
+        vector<plen_t> seg_len;
+        vector<uint64_t> seg_hash;
+    };
+    map<string, seg_base> seg_bases;
+#ifdef BACKGROUND_SAVE
+    enum bg_job_type
+    {
+        BG_WRITE,
+        BG_DELETE,
+        BG_COMMIT,
+    };
+    struct bg_job
+    {
+        bg_job_type type;
+        string name;
+        vector<char> data;
+    };
+    // Everything below, n_users, reader_count and aborted are protected by
+    // bg_mutex.
+    // While the worker is running the rest of the package's state (the
+    // directory, the blocks, the file) is its own; the main thread finds
+    // chunks in bg_directory, which the worker updates after each job, and
+    // reads them with pread().
+    mutex_t bg_mutex;
+    cond_t bg_wake;     // signalled when a job is queued
+    cond_t bg_done;     // signalled when a job is finished
+    thread_t bg_thread;
+    bool bg_running;
+    bool bg_quit;
+    bool bg_busy;
+    bg_job bg_current;
+    deque<bg_job> bg_queue;
+    exception_ptr bg_error;
+    map<string, plen_t> bg_directory;
+    plen_t bg_file_len;     // file_len as of the last finished job
+    int bg_held;            // how many times the holder has bg_mutex
+    void bg_start();
+    void bg_stop();
+    void bg_work();
+    void bg_enqueue(bg_job_type type, const string &name,
+                    vector<char> *data = nullptr);
+    int bg_pending(const string &name);
+    void bg_wait(const string &name);
+    void bg_check_error();
+    void bg_sleep(cond_t &cond);
+    static void* bg_worker(void *arg);
+#endif
+    bool is_aborted();
+    void do_commit();
+    void remove_chunk(const string name);
+    void store_chunk(const string name, const void *data, plen_t len);
+    void read_base(const string &name, vector<char> &out);
+    bool make_delta(const seg_base &base, const vector<char> &base_data,
+                    const seg_base &cur, const char *data,
+                    vector<char> &delta);
+    void apply_delta(const string &name, const vector<char> &base,
+                     const vector<char> &delta, vector<char> &out);
     plen_t extend_block(plen_t at, plen_t size, plen_t by);
     plen_t alloc_block(plen_t &size);
     void finish_chunk(const string name, plen_t at);
@@ -109,6 +218,8 @@ private:
     void free_block_chain(plen_t at);
     void free_block(plen_t at, plen_t size);
     void seek(plen_t to);
+    ssize_t read_at(plen_t at, void *buf, plen_t len);
+    map<string, plen_t> &visible_directory();
     void fsck();
     void read_directory(plen_t start, uint8_t version);
     void trace_chunk(plen_t start);
@@ -37,6 +37,7 @@
 #include "stringutil.h"
 #include "terrain.h"
 #include "transform.h"
+#include "turnprof.h"
 #include "view.h"
 
 static noise_grid _noise_grid;
@@ -821,6 +822,8 @@ void yell(const actor* mon)
 
 void apply_noises()
 {
+    turn_phase_timer timer(TPHASE_NOISES);
+
     // [ds] This copying isn't awesome, but we cannot otherwise handle
     // the case where one set of noises wakes up monsters who then let
     // out yips of their own, modifying _noise_grid while it is in the
@@ -982,10 +985,8 @@ void blood_smell(int strength, const coord_def& where)
 
 // Currently noise attenuation depends solely on the feature in question.
 // Permarock walls are assumed to completely kill noise.
-static int _noise_attenuation_millis(const coord_def &pos)
+static int _feat_noise_attenuation_millis(dungeon_feature_type feat)
 {
-    const dungeon_feature_type feat = grd(pos);
-
     if (feat_is_permarock(feat))
         return NOISE_ATTENUATION_COMPLETE;
 
@@ -997,6 +998,31 @@ static int _noise_attenuation_millis(const coord_def &pos)
                                           1);
 }
 
+// Looked up once per feature, since noise asks for every grid it crosses.
+static int _noise_attenuation_millis(const coord_def &pos)
+{
+    static int attenuation[NUM_FEATURES];
+    static bool initialised = false;
+    if (!initialised)
+    {
+        for (int i = 0; i < NUM_FEATURES; ++i)
+        {
+            attenuation[i] = _feat_noise_attenuation_millis(
+                                 static_cast<dungeon_feature_type>(i));
+        }
+        initialised = true;
+    }
+    return attenuation[grd(pos)];
+}
+
+// Noise is propagated loudest first, in buckets of this width. A grid
+// can't make another in its own bucket louder, as every step attenuates
+// the noise by at least this much, so each grid is only done once.
+static int _noise_bucket(int noise_intensity_millis)
+{
+    return noise_intensity_millis / BASE_NOISE_ATTENUATION_MILLIS;
+}
+
 noise_cell::noise_cell()
     : neighbour_delta(0, 0), noise_id(-1), noise_intensity_millis(0),
       noise_travel_distance(0)
@@ -1077,65 +1103,75 @@ void noise_grid::propagate_noise()
     dprf(DIAG_NOISE, "noise_grid: %u noises to apply",
          (unsigned int)noises.size());
 #endif
-    vector<coord_def> noise_perimeter[2];
-    int circ_index = 0;
+    const FixedBitArray<GXM, GYM> *silence = silenced_grids();
 
-    for (int i = 0, size = noises.size(); i < size; ++i)
-        noise_perimeter[circ_index].push_back(noises[i].noise_source);
+    // Grids waiting for the noise, by _noise_bucket(). A grid may be in
+    // several buckets if it was made louder; only the loudest counts.
+    vector<vector<coord_def>> buckets;
+    FixedBitArray<GXM, GYM> done;
 
-    int travel_distance = 0;
-    while (!noise_perimeter[circ_index].empty())
+    for (const noise_t &noise : noises)
     {
-        const vector<coord_def> &perimeter(noise_perimeter[circ_index]);
-        vector<coord_def> &next_perimeter(noise_perimeter[!circ_index]);
-        ++travel_distance;
-        for (int i = 0, size = perimeter.size(); i < size; ++i)
+        const int b = _noise_bucket(cells(noise.noise_source)
+                                    .noise_intensity_millis);
+        if (b >= (int) buckets.size())
+            buckets.resize(b + 1);
+        buckets[b].push_back(noise.noise_source);
+    }
+
+    for (int b = buckets.size() - 1; b >= 0; --b)
+    {
+        while (!buckets[b].empty())
         {
-            const coord_def p(perimeter[i]);
+            const coord_def p(buckets[b].back());
+            buckets[b].pop_back();
+
             const noise_cell &cell(cells(p));
+            if (done(p) || cell.silent()
+                || _noise_bucket(cell.noise_intensity_millis) != b)
+            {
+                continue;
+            }
+            done.set(p);
+
+            apply_noise_effects(p,
+                                cell.noise_intensity_millis,
+                                noises[cell.noise_id],
+                                cell.noise_travel_distance);
+
+            const int attenuation = _noise_attenuation_millis(p);
+            // If the base noise attenuation kills the noise, go no farther:
+            if (!noise_is_audible(cell.noise_intensity_millis - attenuation))
+                continue;
 
-            if (!cell.silent())
+            // [ds] Not using adjacent iterator which has
+            // unnecessary overhead for the tight loop here.
+            for (int xi = -1; xi <= 1; ++xi)
             {
-                apply_noise_effects(p,
-                                    cell.noise_intensity_millis,
-                                    noises[cell.noise_id],
-                                    travel_distance - 1);
-
-                const int attenuation = _noise_attenuation_millis(p);
-                // If the base noise attenuation kills the noise, go no farther:
-                if (noise_is_audible(cell.noise_intensity_millis - attenuation))
+                for (int yi = -1; yi <= 1; ++yi)
                 {
-                    // [ds] Not using adjacent iterator which has
-                    // unnecessary overhead for the tight loop here.
-                    for (int xi = -1; xi <= 1; ++xi)
+                    const coord_def next_position(p.x + xi, p.y + yi);
+                    if (!(xi || yi) || !in_bounds(next_position)
+                        || done(next_position)
+                        || silence && silence->get(next_position))
                     {
-                        for (int yi = -1; yi <= 1; ++yi)
-                        {
-                            if (xi || yi)
-                            {
-                                const coord_def next_position(p.x + xi,
-                                                              p.y + yi);
-                                if (in_bounds(next_position)
-                                    && !silenced(next_position))
-                                {
-                                    if (propagate_noise_to_neighbour(
-                                            attenuation,
-                                            travel_distance,
-                                            cell, p,
-                                            next_position))
-                                    {
-                                        next_perimeter.push_back(next_position);
-                                    }
-                                }
-                            }
-                        }
+                        continue;
+                    }
+
+                    if (propagate_noise_to_neighbour(
+                            attenuation,
+                            cell.noise_travel_distance + 1,
+                            cell, p,
+                            next_position))
+                    {
+                        // Always a lower bucket than b.
+                        buckets[_noise_bucket(
+                            cells(next_position).noise_intensity_millis)]
+                            .push_back(next_position);
                     }
                 }
             }
         }
-
-        noise_perimeter[circ_index].clear();
-        circ_index = !circ_index;
     }
 
 #ifdef DEBUG_NOISE_PROPAGATION
@@ -1172,18 +1208,11 @@ bool noise_grid::propagate_noise_to_neighbour(int base_attenuation,
         : base_attenuation;
     const int attenuated_noise_intensity =
         cell.noise_intensity_millis - turn_attenuation;
-    if (noise_is_audible(attenuated_noise_intensity))
-    {
-        const int neighbour_old_distance = neighbour.noise_travel_distance;
-        if (neighbour.apply_noise(attenuated_noise_intensity,
-                                  cell.noise_id,
-                                  travel_distance,
-                                  next_pos - current_pos))
-            // Return true only if we hadn't already registered this
-            // cell as a neighbour (presumably with a lower volume).
-            return neighbour_old_distance != travel_distance;
-    }
-    return false;
+    return noise_is_audible(attenuated_noise_intensity)
+           && neighbour.apply_noise(attenuated_noise_intensity,
+                                    cell.noise_id,
+                                    travel_distance,
+                                    next_pos - current_pos);
 }
 
 void noise_grid::apply_noise_effects(const coord_def &pos,
@@ -14,8 +14,10 @@
 #include "coordit.h"
 #include "ctest.h"
 #include "database.h"
+#include "dbg-bench.h"
 #include "dbg-maps.h"
 #include "dbg-objstat.h"
+#include "dbg-save.h"
 #include "dungeon.h"
 #include "end.h"
 #include "exclude.h"
@@ -28,6 +30,7 @@
 #include "itemname.h"
 #include "itemprop.h"
 #include "items.h"
+#include "keylog.h"
 #include "libutil.h"
 #include "macro.h"
 #include "maps.h"
@@ -58,6 +61,7 @@
  #include "tilereg-crt.h"
 #endif
 #include "tileview.h"
+#include "turnprof.h"
 #include "viewchar.h"
 #include "view.h"
 #ifdef USE_TILE_LOCAL
@@ -154,11 +158,18 @@ static void _initialize()
     }
 #endif
 
+    keylog_init();
     if (Options.seed)
         seed_rng(Options.seed);
 
 #ifdef DEBUG_STATISTICS
-    if (crawl_state.map_stat_gen)
+    if (SysEnv.levelgen_jobs)
+    {
+        release_cli_signals();
+        levelgen_generate_stats(SysEnv.levelgen_jobs);
+        end(0, false);
+    }
+    else if (crawl_state.map_stat_gen)
     {
         release_cli_signals();
         mapstat_generate_stats();
@@ -170,8 +181,30 @@ static void _initialize()
         objstat_generate_stats();
         end(0, false);
     }
+    else if (crawl_state.save_bench)
+    {
+        release_cli_signals();
+        if (SysEnv.save_fuzz_corpus.empty())
+            savebench_generate_stats();
+        else
+            savebench_fuzz(SysEnv.save_fuzz_corpus);
+        end(0, false);
+    }
+    else if (!SysEnv.bench_name.empty())
+    {
+        release_cli_signals();
+        bench_run(SysEnv.bench_name);
+        end(0, false);
+    }
 #endif
 
+    if (!SysEnv.profile_turns_file.empty()
+        && !turn_profile_open_csv(SysEnv.profile_turns_file))
+    {
+        end(1, true, "Can't write the turn profile to %s",
+            SysEnv.profile_turns_file.c_str());
+    }
+
     if (!crawl_state.test_list)
     {
         if (!crawl_state.io_inited)
@@ -52,6 +52,7 @@ struct game_state
 
     bool map_stat_gen;      // Set if we're generating stats on maps.
     bool obj_stat_gen;      // Set if we're generating object stats.
+    bool save_bench;        // Set if we're benchmarking or fuzzing saves.
 
     game_type type;
     game_type last_type;
@@ -65,6 +66,8 @@ struct game_state
     bool test_list;         // Show available tests and exit.
     bool script;            // Set if we want to run a Lua script and exit.
     bool build_db;          // Set if we want to rebuild the db and exit.
+    bool forked_worker;     // Set in forked children, which must leave the
+                            // parent's terminal and files alone on exit.
     vector<string> tests_selected; // Tests to be run.
     vector<string> script_args;    // Arguments to scripts.
 
@@ -153,6 +153,7 @@ enum tag_minor_version
     TAG_MINOR_MAX_XL,              // Store max XL instead of hardcoding it
     TAG_MINOR_NO_RPOIS_MINUS,      // Remove rPois- artefacts
     TAG_MINOR_XP_PENANCE,          // Let gods other than Ash use xp penance
+    TAG_MINOR_STAIR_DISTANCE_KEY,  // Travel cache knows what stair distances came from
 #endif
     NUM_TAG_MINORS,
     TAG_MINOR_VERSION = NUM_TAG_MINORS - 1
@@ -34,6 +34,7 @@
 #include "art-enum.h"
 #include "branch.h"
 #include "butcher.h"
+#include "cloud.h"
 #include "colour.h"
 #include "coordit.h"
 #include "dbg-scan.h"
@@ -1015,7 +1016,18 @@ static dungeon_feature_type unmarshallFeatureType_Info(reader &th)
 }
 #endif
 
-#define CANARY     marshallUByte(th, 171)
+// Where the parts of the chunk being written start, for package's
+// write_segmented().
+static vector<plen_t> *save_segments = nullptr;
+
+static void _mark_segment(writer &th)
+{
+    if (save_segments)
+        save_segments->push_back(th.tell());
+}
+
+// Canaries separate unrelated data, so they also start a new segment.
+#define CANARY     do { marshallUByte(th, 171); _mark_segment(th); } while (0)
 #if TAG_MAJOR_VERSION == 34
 #define EAT_CANARY do if (th.getMinorVersion() >= TAG_MINOR_CANARIES    \
                           && unmarshallUByte(th) != 171)                \
@@ -1107,11 +1119,14 @@ static void _add_missing_branches()
 
 
 // Write a tagged chunk of data to the FILE*.
-// tagId specifies what to write.
-void tag_write(tag_type tagID, writer &outf)
+// tagId specifies what to write. If segments is given, the offsets in outf
+// where independently changing parts of the data start are appended to it.
+void tag_write(tag_type tagID, writer &outf, vector<plen_t> *segments)
 {
     vector<unsigned char> buf;
     writer th(&buf);
+    unwind_var<vector<plen_t>*> segs(save_segments, segments);
+    const size_t first_segment = segments ? segments->size() : 0;
     switch (tagID)
     {
     case TAG_CHR:
@@ -1151,6 +1166,14 @@ void tag_write(tag_type tagID, writer &outf)
     if (buf.empty())
         return;
 
+    if (segments)
+    {
+        // Offsets in buf so far, make them relative to outf.
+        const plen_t at = outf.tell() + sizeof(int32_t);
+        for (size_t i = first_segment; i < segments->size(); ++i)
+            (*segments)[i] += at;
+    }
+
     // Write tag header.
     marshallInt(outf, buf.size());
 
@@ -1187,6 +1210,44 @@ static void _shunt_monsters_out_of_walls()
     }
 }
 
+// Write a single section of a TAG_LEVEL chunk, without the size header or
+// the canaries between sections. Used by the save benchmarks.
+void tag_write_level_section(level_section sect, writer &th)
+{
+    switch (sect)
+    {
+    case LSECT_LEVEL:    tag_construct_level(th); break;
+    case LSECT_ITEMS:    tag_construct_level_items(th); break;
+    case LSECT_MONSTERS: tag_construct_level_monsters(th); break;
+    case LSECT_TILES:    tag_construct_level_tiles(th); break;
+    default:             die("unknown level section %d", sect);
+    }
+}
+
+// Read back a section written by tag_write_level_section(). Sections must be
+// read in order, as monsters refer to the items read before them.
+void tag_read_level_section(level_section sect, reader &th)
+{
+    switch (sect)
+    {
+    case LSECT_LEVEL:
+        tag_read_level(th);
+        break;
+    case LSECT_ITEMS:
+        tag_read_level_items(th);
+        link_items();
+        break;
+    case LSECT_MONSTERS:
+        tag_read_level_monsters(th);
+        break;
+    case LSECT_TILES:
+        tag_read_level_tiles(th);
+        break;
+    default:
+        die("unknown level section %d", sect);
+    }
+}
+
 // Read a piece of data from inf into memory, then run the appropriate reader.
 //
 // minorVersion is available for any sub-readers that need it
@@ -3617,12 +3678,18 @@ static void tag_construct_level(writer &th)
     CANARY;
 
     for (int count_x = 0; count_x < GXM; count_x++)
+    {
+        // Exploring or digging only touches a few bands of columns.
+        if (count_x % 8 == 0)
+            _mark_segment(th);
         for (int count_y = 0; count_y < GYM; count_y++)
         {
             marshallByte(th, grd[count_x][count_y]);
             marshallMapCell(th, env.map_knowledge[count_x][count_y]);
             marshallInt(th, env.pgrid[count_x][count_y]);
         }
+    }
+    _mark_segment(th);
 
     marshallBoolean(th, !!env.map_forgotten.get());
     if (env.map_forgotten.get())
@@ -4372,7 +4439,11 @@ static void tag_construct_level_items(writer &th)
     const int ni = _last_used_index(mitm, MAX_ITEMS);
     marshallShort(th, ni);
     for (int i = 0; i < ni; ++i)
+    {
+        if (i % 64 == 0)
+            _mark_segment(th);
         marshallItem(th, mitm[i]);
+    }
 }
 
 static void marshall_mon_enchant(writer &th, const mon_enchant &me)
@@ -4852,6 +4923,8 @@ static void tag_construct_level_monsters(writer &th)
     for (int i = 0; i < nm; i++)
     {
         monster& m(menv[i]);
+        if (i % 16 == 0)
+            _mark_segment(th);
 
 #if defined(DEBUG) || defined(DEBUG_MONS_SCAN)
         if (m.type != MONS_NO_MONSTER)
@@ -5036,6 +5109,7 @@ static void tag_read_level(reader &th)
     }
     for (int i = num_clouds; i < MAX_CLOUDS; i++)
         env.cloud[i].type = CLOUD_NONE;
+    reset_active_clouds();
 
     EAT_CANARY;
 
@@ -5646,6 +5720,7 @@ static void tag_read_level_monsters(reader &th)
     // how many monsters?
     count = unmarshallShort(th);
     ASSERT_RANGE(count, 0, MAX_MONSTERS + 1);
+    env.mons_used = max(env.mons_used, count);
 
     for (i = 0; i < count; i++)
     {
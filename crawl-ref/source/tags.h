@@ -167,7 +167,21 @@ static inline void unmarshallSigned(reader& th, T& v)
  * *********************************************************************** */
 
 void tag_read(reader &inf, tag_type tag_id);
-void tag_write(tag_type tagID, writer &outf);
+void tag_write(tag_type tagID, writer &outf,
+               vector<plen_t> *segments = nullptr);
+
+// The parts of a TAG_LEVEL chunk, in the order they are written.
+enum level_section
+{
+    LSECT_LEVEL,                        // grid, map knowledge, clouds, ...
+    LSECT_ITEMS,                        // traps and floor items
+    LSECT_MONSTERS,
+    LSECT_TILES,
+    NUM_LEVEL_SECTIONS
+};
+
+void tag_write_level_section(level_section sect, writer &th);
+void tag_read_level_section(level_section sect, reader &th);
 void tag_read_char(reader &th, uint8_t format, uint8_t major, uint8_t minor);
 
 /* ***********************************************************************
@@ -0,0 +1,13 @@
+-- Test that searching descriptions through their trigram index finds the
+-- same entries as scanning every description.
+
+local regexes = {
+  "orc", "orc priest", "\\<orc", "orc\\>", "\\`orc", "orc\\'",
+  "\\bfire", "fire\\b", "(ice )?dragon", "orc+ priest", "[a-z]+ of zot",
+  "ab?c", "x{2}y", "sword|axe", "^the ", "\\.$",
+}
+
+for _, re in ipairs(regexes) do
+  assert(debug.check_desc_search(re),
+         "indexed description search differs from a full scan for " .. re)
+end
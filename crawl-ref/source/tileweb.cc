@@ -45,6 +45,7 @@
 #include "tilepick-p.h"
 #include "tileview.h"
 #include "travel.h"
+#include "turnprof.h"
 #include "unicode.h"
 #include "unwind.h"
 #include "version.h"
@@ -88,11 +89,51 @@ struct JsonWrapper
     static class MalformedException { } malformed;
 };
 
+/*
+  Binary messages encode the same values as JSON ones, more compactly;
+  webserver/static/scripts/binary_message.js decodes them back into the
+  objects the JSON would give. A binary message is the marker byte, the
+  length of the rest as four big-endian bytes, and one encoded value.
+  Varints are little-endian base 128, seven bits to a byte.
+
+  Values: 0x00-0xdf are integers 0-223, and the other bytes are tokens.
+  Inside an object, a key takes the place of a value; 0x00-0xdf then
+  refer to the key defined with that index, which counts keys from zero
+  in the order they were first defined in the message.
+ */
+enum binary_token
+{
+    BIN_SMALL_INT_MAX = 0xdf,
+    BIN_INT,       // varint value
+    BIN_NEG_INT,   // varint of minus the value
+    BIN_FALSE,
+    BIN_TRUE,
+    BIN_NULL,
+    BIN_STRING,    // varint length, then UTF-8 bytes
+    BIN_OBJECT,    // keys and values up to BIN_END
+    BIN_ARRAY,     // values up to BIN_END
+    BIN_NEW_KEY,   // varint length, then UTF-8 bytes
+    BIN_KEY,       // varint index of a key defined earlier
+    BIN_END = 0xef,
+};
+
+// Neither a JSON object nor a server message ('*') can start with this.
+static const char BINARY_MESSAGE_MARKER = '\x02';
+static const unsigned int BINARY_HEADER_SIZE = 5;
+
+// How many bytes may wait for a receiver before its messages are dropped.
+static const size_t MAX_QUEUED_BYTES = 4 * 1024 * 1024;
+// How often to retry sending queued messages while waiting for input.
+static const int SEND_RETRY_USEC = 20 * 1000;
+// How long to keep trying to send queued messages when shutting down.
+static const int SHUTDOWN_SEND_MSEC = 2000;
+
 TilesFramework tiles;
 
 TilesFramework::TilesFramework()
     : m_crt_mode(CRT_NORMAL),
       m_controlled_from_web(false),
+      m_msg_binary(false),
       m_last_ui_state(UI_INIT),
       m_view_loaded(false),
       m_next_view_tl(0, 0),
@@ -114,8 +155,24 @@ TilesFramework::~TilesFramework()
 {
 }
 
+TilesFramework::Receiver::Receiver()
+    : binary(false), keyframes(false), queued_bytes(0), sent(0),
+      dropped(false)
+{
+}
+
 void TilesFramework::shutdown()
 {
+    // Give receivers a little time to take the last messages.
+    const unsigned int start = get_milliseconds();
+    _send_queues();
+    while (_have_queued_messages()
+           && get_milliseconds() - start < SHUTDOWN_SEND_MSEC)
+    {
+        usleep(SEND_RETRY_USEC);
+        _send_queues();
+    }
+
     close(m_sock);
     remove(m_sock_name.c_str());
 }
@@ -142,12 +199,6 @@ bool TilesFramework::initialise()
     // Need small maximum message size to avoid crashes in OS X
     m_max_msg_size = 2048;
 
-    struct timeval tv;
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-    if (setsockopt(m_sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0)
-        die("Can't set send timeout!");
-
     if (m_await_connection)
         _await_connection();
 
@@ -175,6 +226,9 @@ void TilesFramework::write_message(const char *format, ...)
     char buf[2048];
     int len;
 
+    if (m_msg_binary)
+        die("Webtiles JSON text in a binary message! (%s)", format);
+
     va_list argp;
     va_start(argp, format);
     if ((len = vsnprintf(buf, sizeof(buf), format, argp)) < 0)
@@ -188,59 +242,182 @@ void TilesFramework::write_message(const char *format, ...)
 
 void TilesFramework::finish_message()
 {
-    if (m_msg_buf.size() == 0)
+    if (m_msg_binary)
+    {
+        m_msg_binary = false;
+        m_binary_keys.clear();
+        m_binary_key_defs.clear();
+
+        // Erased as empty.
+        if (m_msg_buf.size() == BINARY_HEADER_SIZE)
+        {
+            m_msg_buf.clear();
+            return;
+        }
+
+        // Binary messages can contain newlines, so they carry their
+        // length instead of ending in one.
+        const uint32_t len = m_msg_buf.size() - BINARY_HEADER_SIZE;
+        for (int i = 0; i < 4; ++i)
+            m_msg_buf[1 + i] = (len >> (24 - 8 * i)) & 0xFF;
+    }
+    else if (m_msg_buf.size() == 0)
         return;
+    else
+        m_msg_buf.append("\n");
+
+    shared_ptr<const string> msg = make_shared<const string>(move(m_msg_buf));
+    m_msg_buf.clear();
+
+    for (Receiver &receiver : m_receivers)
+        _queue_message(receiver, msg);
+    _send_queues();
+}
 
-    m_msg_buf.append("\n");
-    const char* fragment_start = m_msg_buf.data();
-    const char* data_end = m_msg_buf.data() + m_msg_buf.size();
-    while (fragment_start < data_end)
+void TilesFramework::_queue_message(Receiver &receiver,
+                                    shared_ptr<const string> msg)
+{
+    // Everything gets sent again once it has caught up.
+    if (receiver.dropped)
     {
-        int fragment_size = data_end - fragment_start;
-        if (fragment_size > m_max_msg_size)
-            fragment_size = m_max_msg_size;
+        m_send_stats.dropped++;
+        return;
+    }
 
-        for (unsigned int i = 0; i < m_dest_addrs.size(); ++i)
+    if (receiver.queued_bytes + msg->size() > MAX_QUEUED_BYTES)
+    {
+        // Drop what we can. A message that is partly sent has to be
+        // finished, or the receiver couldn't tell where the next begins.
+        const size_t keep = receiver.sent ? 1 : 0;
+        m_send_stats.dropped += receiver.queue.size() - keep;
+        while (receiver.queue.size() > keep)
         {
-            int retries = 30;
-            ssize_t sent = 0;
-            while (sent < fragment_size)
-            {
-                ssize_t retval = sendto(m_sock, fragment_start + sent,
-                    fragment_size - sent, 0, (sockaddr*) &m_dest_addrs[i],
-                    sizeof(sockaddr_un));
-                if (retval <= 0)
-                {
-                    const char *errmsg = retval == 0 ? "No bytes sent"
-                                                     : strerror(errno);
-                    if (--retries <= 0)
-                        die("Socket write error: %s", errmsg);
+            receiver.queued_bytes -= receiver.queue.back()->size();
+            receiver.queue.pop_back();
+        }
+        receiver.dropped = true;
+        dprf("Webtiles receiver %s is lagging; dropped its messages.",
+             receiver.addr.sun_path);
+        return;
+    }
 
-                    if (retval == 0 || errno == ENOBUFS || errno == EWOULDBLOCK
-                        || errno == EINTR || errno == EAGAIN)
-                    {
-                        // Wait for half a second at first (up to five), then
-                        // try again.
-                        usleep(retries <= 10 ? 5000 * 1000 : 500 * 1000);
-                    }
-                    else if (errno == ECONNREFUSED || errno == ENOENT)
-                    {
-                        // the other side is dead
-                        m_dest_addrs.erase(m_dest_addrs.begin() + i);
-                        i--;
-                        break;
-                    }
-                    else
-                        die("Socket write error: %s", errmsg);
-                }
-                else
-                    sent += retval;
+    receiver.queue.push_back(msg);
+    receiver.queued_bytes += msg->size();
+    m_send_stats.messages++;
+    m_send_stats.bytes += msg->size();
+    m_send_stats.max_queued = max(m_send_stats.max_queued,
+                                  receiver.queued_bytes);
+}
+
+// Send as much of the receiver's queue as the socket takes without
+// blocking. Returns false if the receiver has gone away.
+bool TilesFramework::_send_queued(Receiver &receiver)
+{
+    while (!receiver.queue.empty())
+    {
+        const string &msg = *receiver.queue.front();
+        const size_t fragment_size = min(msg.size() - receiver.sent,
+                                         (size_t) m_max_msg_size);
+        ssize_t retval = sendto(m_sock, msg.data() + receiver.sent,
+                                fragment_size, MSG_DONTWAIT,
+                                (sockaddr*) &receiver.addr,
+                                sizeof(sockaddr_un));
+        if (retval <= 0)
+        {
+            if (retval == 0 || errno == ENOBUFS || errno == EWOULDBLOCK
+                || errno == EINTR || errno == EAGAIN)
+            {
+                // Try again later.
+                return true;
             }
+            else if (errno == ECONNREFUSED || errno == ENOENT)
+                return false; // the other side is dead
+            else
+                die("Socket write error: %s", strerror(errno));
         }
 
-        fragment_start += fragment_size;
+        receiver.sent += retval;
+        if (receiver.sent == msg.size())
+        {
+            receiver.queued_bytes -= msg.size();
+            receiver.queue.pop_front();
+            receiver.sent = 0;
+        }
     }
-    m_msg_buf.clear();
+    return true;
+}
+
+void TilesFramework::_send_queues()
+{
+    for (unsigned int i = 0; i < m_receivers.size(); ++i)
+    {
+        if (!_send_queued(m_receivers[i]))
+        {
+            m_receivers.erase(m_receivers.begin() + i);
+            i--;
+        }
+    }
+}
+
+bool TilesFramework::_have_queued_messages() const
+{
+    for (const Receiver &receiver : m_receivers)
+        if (!receiver.queue.empty())
+            return true;
+    return false;
+}
+
+// Send everything again if a receiver that lost messages has caught up.
+void TilesFramework::_resync_receivers()
+{
+    // Not in the middle of writing a message.
+    if (!m_msg_buf.empty() || !m_json_stack.empty())
+        return;
+
+    bool resync = false;
+    for (Receiver &receiver : m_receivers)
+    {
+        if (receiver.dropped && receiver.queue.empty())
+        {
+            receiver.dropped = false;
+            resync = true;
+        }
+    }
+    if (!resync)
+        return;
+
+    m_send_stats.resyncs++;
+    _send_keyframe(true);
+}
+
+/*
+  Send everything a new spectator needs as a keyframe. Webservers that
+  asked for them get markers around it, so that they can keep it with the
+  messages that follow and serve joining spectators from that, instead of
+  having us send everything again to all of them. A resync keyframe is
+  for everyone, since messages were lost; any other is only for those
+  still waiting for one. In that case everyone is brought up to date
+  first, since sending everything also sends what is still pending.
+ */
+void TilesFramework::_send_keyframe(bool resync)
+{
+    bool markers = !m_receivers.empty();
+    for (const Receiver &receiver : m_receivers)
+        markers = markers && receiver.keyframes;
+
+    if (markers && !resync)
+        redraw();
+
+    flush_messages();
+    if (markers)
+    {
+        send_message("*{\"msg\":\"keyframe\",\"resync\":%s}",
+                     resync ? "true" : "false");
+    }
+    _send_everything();
+    if (markers)
+        send_message("*{\"msg\":\"keyframe_end\"}");
+    flush_messages();
 }
 
 void TilesFramework::send_message(const char *format, ...)
@@ -248,6 +425,9 @@ void TilesFramework::send_message(const char *format, ...)
     char buf[2048];
     int len;
 
+    if (m_msg_binary)
+        die("Webtiles JSON text in a binary message! (%s)", format);
+
     va_list argp;
     va_start(argp, format);
     if ((len = vsnprintf(buf, sizeof(buf), format, argp)) >= (int)sizeof(buf)
@@ -272,7 +452,7 @@ void TilesFramework::flush_messages()
 
 void TilesFramework::_await_connection()
 {
-    while (m_dest_addrs.size() == 0)
+    while (m_receivers.size() == 0)
         _receive_control_message();
 }
 
@@ -319,7 +499,18 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
         JsonWrapper primary = json_find_member(obj.node, "primary");
         primary.check(JSON_BOOL);
 
-        m_dest_addrs.push_back(addr);
+        // Optional: webservers that can forward binary messages, or that
+        // keep keyframes for spectators, say so.
+        JsonWrapper binary = json_find_member(obj.node, "binary");
+        JsonWrapper keyframes = json_find_member(obj.node, "keyframes");
+
+        Receiver receiver;
+        receiver.addr = addr;
+        receiver.binary = binary.node && binary->tag == JSON_BOOL
+                          && binary->bool_;
+        receiver.keyframes = keyframes.node && keyframes->tag == JSON_BOOL
+                             && keyframes->bool_;
+        m_receivers.push_back(receiver);
         m_controlled_from_web = primary->bool_;
     }
     else if (msgtype == "key")
@@ -329,12 +520,8 @@ wint_t TilesFramework::_handle_control_message(sockaddr_un addr, string data)
 
         c = (int) keycode->number_;
     }
-    else if (msgtype == "spectator_joined")
-    {
-        flush_messages();
-        _send_everything();
-        flush_messages();
-    }
+    else if (msgtype == "spectator_joined" || msgtype == "keyframe")
+        _send_keyframe(false);
     else if (msgtype == "menu_scroll")
     {
         JsonWrapper first = json_find_member(obj.node, "first");
@@ -374,32 +561,49 @@ bool TilesFramework::await_input(wint_t& c, bool block)
     int result;
     fd_set fds;
     int maxfd = m_sock;
+    bool need_flush = block;
 
     while (true)
     {
+        // Once per wait: retrying the sends mustn't queue another flush
+        // for receivers that have stopped reading.
+        if (need_flush)
+        {
+            tiles.flush_messages();
+            need_flush = false;
+        }
+
+        bool retry_sends;
         do
         {
             FD_ZERO(&fds);
             FD_SET(STDIN_FILENO, &fds);
             FD_SET(m_sock, &fds);
 
+            _send_queues();
+            _resync_receivers();
+
+            // Datagram sockets look writable even when the receiver's
+            // queue is full, so just try again after a while.
+            retry_sends = block && _have_queued_messages();
+
+            timeval timeout;
+            timeout.tv_sec = 0;
+            timeout.tv_usec = retry_sends ? SEND_RETRY_USEC : 0;
+
             if (block)
             {
-                tiles.flush_messages();
-                result = select(maxfd + 1, &fds, nullptr, nullptr, nullptr);
+                result = select(maxfd + 1, &fds, nullptr, nullptr,
+                                retry_sends ? &timeout : nullptr);
             }
             else
-            {
-                timeval timeout;
-                timeout.tv_sec = 0;
-                timeout.tv_usec = 0;
-
                 result = select(maxfd + 1, &fds, nullptr, nullptr, &timeout);
-            }
         }
         while (result == -1 && errno == EINTR);
 
-        if (result == 0)
+        if (result == 0 && retry_sends)
+            continue;
+        else if (result == 0)
             return false;
         else if (result > 0)
         {
@@ -409,6 +613,8 @@ bool TilesFramework::await_input(wint_t& c, bool block)
 
                 if (c != 0)
                     return true;
+                // Whatever the control message sent starts a new wait.
+                need_flush = block;
             }
 
             if (FD_ISSET(STDIN_FILENO, &fds))
@@ -432,12 +638,25 @@ bool TilesFramework::await_input(wint_t& c, bool block)
 void TilesFramework::dump()
 {
     fprintf(stderr, "Webtiles message buffer: %s\n", m_msg_buf.c_str());
+    fprintf(stderr, "Webtiles send queues: %" PRIu64 " messages, %" PRIu64
+            " bytes queued; %" PRIu64 " dropped, %" PRIu64 " resyncs; "
+            "at most %u bytes waiting\n", m_send_stats.messages,
+            m_send_stats.bytes, m_send_stats.dropped, m_send_stats.resyncs,
+            (unsigned int) m_send_stats.max_queued);
+    for (const Receiver &receiver : m_receivers)
+    {
+        fprintf(stderr, "%s: %u messages, %u bytes waiting%s\n",
+                receiver.addr.sun_path, (unsigned int) receiver.queue.size(),
+                (unsigned int) receiver.queued_bytes,
+                receiver.dropped ? " (dropped)" : "");
+    }
     fprintf(stderr, "Webtiles JSON stack:\n");
     for (const JsonFrame &frame : m_json_stack)
     {
         fprintf(stderr, "start: %d end: %d type: %c\n",
                 frame.start, frame.prefix_end, frame.type);
     }
+    dump_turn_profile(stderr);
 }
 
 void TilesFramework::send_exit_reason(const string& type, const string& message)
@@ -664,6 +883,7 @@ void TilesFramework::_send_player(bool force_full)
 {
     player_info& c = m_current_player_info;
 
+    begin_binary_message();
     json_open_object();
     json_write_string("msg", "player");
     json_treat_as_empty();
@@ -902,6 +1122,14 @@ void TilesFramework::_send_item(item_info& current, const item_info& next,
     }
 }
 
+static void _send_doll_part(tileidx_t idx, int ymax)
+{
+    tiles.json_open_array();
+    tiles.json_write_int(idx);
+    tiles.json_write_int(ymax);
+    tiles.json_close_array();
+}
+
 static void _send_doll(const dolls_data &doll, bool submerged, bool ghost)
 {
     // Ordered from back to front.
@@ -976,8 +1204,7 @@ static void _send_doll(const dolls_data &doll, bool submerged, bool ghost)
             ymax = 18;
         }
 
-        tiles.json_write_comma();
-        tiles.write_message("[%u,%d]", (unsigned int) doll.parts[p], ymax);
+        _send_doll_part(doll.parts[p], ymax);
     }
     tiles.json_close_array();
 }
@@ -996,8 +1223,8 @@ static void _send_mcache(mcache_entry *entry, bool submerged,
             _send_doll(*doll, submerged, trans);
         else
         {
-            tiles.json_write_comma();
-            tiles.write_message("\"doll\":[]");
+            tiles.json_open_array("doll");
+            tiles.json_close_array();
         }
     }
 
@@ -1007,9 +1234,11 @@ static void _send_mcache(mcache_entry *entry, bool submerged,
     int draw_info_count = entry->info(&dinfo[0]);
     for (int i = 0; i < draw_info_count; i++)
     {
-        tiles.json_write_comma();
-        tiles.write_message("[%u,%d,%d]", (unsigned int) dinfo[i].idx,
-                            dinfo[i].ofs_x, dinfo[i].ofs_y);
+        tiles.json_open_array();
+        tiles.json_write_int(dinfo[i].idx);
+        tiles.json_write_int(dinfo[i].ofs_x);
+        tiles.json_write_int(dinfo[i].ofs_y);
+        tiles.json_close_array();
     }
 
     tiles.json_close_array();
@@ -1052,9 +1281,14 @@ static inline void _write_tileidx(tileidx_t t)
     const int lo = t & 0xFFFFFFFF;
     const int hi = t >> 32;
     if (hi == 0)
-        tiles.write_message("%d", lo);
+        tiles.json_write_int(lo);
     else
-        tiles.write_message("[%d,%d]", lo, hi);
+    {
+        tiles.json_open_array();
+        tiles.json_write_int(lo);
+        tiles.json_write_int(hi);
+        tiles.json_close_array();
+    }
 }
 
 void TilesFramework::_send_cell(const coord_def &gc,
@@ -1196,8 +1430,9 @@ void TilesFramework::_send_cell(const coord_def &gc,
                     _send_mcache(entry, in_water);
                 else
                 {
-                    json_write_comma();
-                    write_message("\"doll\":[[%d,%d]]", TILEP_MONS_UNKNOWN, TILE_Y);
+                    json_open_array("doll");
+                    _send_doll_part(TILEP_MONS_UNKNOWN, TILE_Y);
+                    json_close_array();
                 }
             }
         }
@@ -1241,8 +1476,9 @@ void TilesFramework::_send_cell(const coord_def &gc,
         {
             if (fg_changed)
             {
-                json_write_comma();
-                write_message("\"doll\":[[%u,%d]]", (unsigned int) fg_idx, TILE_Y);
+                json_open_array("doll");
+                _send_doll_part(fg_idx, TILE_Y);
+                json_close_array();
             }
         }
 
@@ -1316,6 +1552,7 @@ void TilesFramework::_send_map(bool force_full)
     force_full = force_full || m_need_full_map;
     m_need_full_map = false;
 
+    begin_binary_message();
     json_open_object();
     json_write_string("msg", "map");
     json_treat_as_empty();
@@ -1660,6 +1897,8 @@ void TilesFramework::redraw()
         return;
     }
 
+    _resync_receivers();
+
     if (m_last_ui_state != m_ui_state)
     {
         _send_ui_state(m_ui_state);
@@ -1908,6 +2147,70 @@ void TilesFramework::write_message_escaped(const string& s)
     }
 }
 
+void TilesFramework::begin_binary_message()
+{
+    ASSERT(m_msg_buf.empty());
+    ASSERT(!m_msg_binary);
+
+    if (m_receivers.empty())
+        return;
+    for (const Receiver &receiver : m_receivers)
+        if (!receiver.binary)
+            return;
+
+    m_msg_binary = true;
+    m_msg_buf.append(1, BINARY_MESSAGE_MARKER);
+    m_msg_buf.append(BINARY_HEADER_SIZE - 1, '\0'); // length, when known
+}
+
+void TilesFramework::_binary_write_varint(uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        m_msg_buf.append(1, (char) ((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    m_msg_buf.append(1, (char) value);
+}
+
+void TilesFramework::_binary_write_bytes(const string& s)
+{
+    _binary_write_varint(s.size());
+    m_msg_buf.append(s);
+}
+
+void TilesFramework::_binary_write_name(const string& name)
+{
+    auto it = m_binary_keys.find(name);
+    if (it == m_binary_keys.end())
+    {
+        const int index = m_binary_key_defs.size();
+        m_binary_keys[name] = index;
+        m_binary_key_defs.emplace_back(name, m_msg_buf.size());
+        m_msg_buf.append(1, (char) BIN_NEW_KEY);
+        _binary_write_bytes(name);
+    }
+    else if (it->second <= BIN_SMALL_INT_MAX)
+        m_msg_buf.append(1, (char) it->second);
+    else
+    {
+        m_msg_buf.append(1, (char) BIN_KEY);
+        _binary_write_varint(it->second);
+    }
+}
+
+// Erase the end of the message, and any key definitions in it.
+void TilesFramework::_binary_erase(int start)
+{
+    while (!m_binary_key_defs.empty()
+           && m_binary_key_defs.back().second >= start)
+    {
+        m_binary_keys.erase(m_binary_key_defs.back().first);
+        m_binary_key_defs.pop_back();
+    }
+    m_msg_buf.resize(start);
+}
+
 void TilesFramework::json_open(const string& name, char opener, char type)
 {
     m_json_stack.resize(m_json_stack.size() + 1);
@@ -1918,7 +2221,10 @@ void TilesFramework::json_open(const string& name, char opener, char type)
     if (!name.empty())
         json_write_name(name);
 
-    m_msg_buf.append(1, opener);
+    if (m_msg_binary)
+        m_msg_buf.append(1, (char) (opener == '{' ? BIN_OBJECT : BIN_ARRAY));
+    else
+        m_msg_buf.append(1, opener);
 
     fr.prefix_end = m_msg_buf.size();
     fr.type = type;
@@ -1953,7 +2259,14 @@ void TilesFramework::json_close(bool erase_if_empty, char type)
         die("json error: attempting to close wrong type");
 
     if (erase_if_empty && json_is_empty())
-        m_msg_buf.resize(m_json_stack.back().start);
+    {
+        if (m_msg_binary)
+            _binary_erase(m_json_stack.back().start);
+        else
+            m_msg_buf.resize(m_json_stack.back().start);
+    }
+    else if (m_msg_binary)
+        m_msg_buf.append(1, (char) BIN_END);
     else
         m_msg_buf.append(1, type);
 
@@ -1982,7 +2295,7 @@ void TilesFramework::json_close_array(bool erase_if_empty)
 
 void TilesFramework::json_write_comma()
 {
-    if (m_msg_buf.empty()) return;
+    if (m_msg_binary || m_msg_buf.empty()) return;
     char last = m_msg_buf[m_msg_buf.size() - 1];
     if (last == '{' || last == '[' || last == ',' || last == ':') return;
     write_message(",");
@@ -1990,6 +2303,12 @@ void TilesFramework::json_write_comma()
 
 void TilesFramework::json_write_name(const string& name)
 {
+    if (m_msg_binary)
+    {
+        _binary_write_name(name);
+        return;
+    }
+
     json_write_comma();
 
     write_message("\"");
@@ -1999,6 +2318,23 @@ void TilesFramework::json_write_name(const string& name)
 
 void TilesFramework::json_write_int(int value)
 {
+    if (m_msg_binary)
+    {
+        if (value >= 0 && value <= BIN_SMALL_INT_MAX)
+            m_msg_buf.append(1, (char) value);
+        else if (value >= 0)
+        {
+            m_msg_buf.append(1, (char) BIN_INT);
+            _binary_write_varint(value);
+        }
+        else
+        {
+            m_msg_buf.append(1, (char) BIN_NEG_INT);
+            _binary_write_varint(-(int64_t) value);
+        }
+        return;
+    }
+
     json_write_comma();
 
     write_message("%d", value);
@@ -2014,6 +2350,12 @@ void TilesFramework::json_write_int(const string& name, int value)
 
 void TilesFramework::json_write_bool(bool value)
 {
+    if (m_msg_binary)
+    {
+        m_msg_buf.append(1, (char) (value ? BIN_TRUE : BIN_FALSE));
+        return;
+    }
+
     json_write_comma();
 
     if (value)
@@ -2032,6 +2374,12 @@ void TilesFramework::json_write_bool(const string& name, bool value)
 
 void TilesFramework::json_write_null()
 {
+    if (m_msg_binary)
+    {
+        m_msg_buf.append(1, (char) BIN_NULL);
+        return;
+    }
+
     json_write_comma();
 
     write_message("null");
@@ -2047,6 +2395,13 @@ void TilesFramework::json_write_null(const string& name)
 
 void TilesFramework::json_write_string(const string& value)
 {
+    if (m_msg_binary)
+    {
+        m_msg_buf.append(1, (char) BIN_STRING);
+        _binary_write_bytes(value);
+        return;
+    }
+
     json_write_comma();
 
     write_message("\"");
@@ -7,7 +7,9 @@
 #define TILEWEB_H
 
 #include <bitset>
+#include <deque>
 #include <map>
+#include <memory>
 #include <sys/un.h>
 
 #include "map_knowledge.h"
@@ -80,6 +82,19 @@ struct player_info
     string unarmed_attack;
 };
 
+// Counters of the webtiles send queues, summed over receivers.
+struct webtiles_send_stats
+{
+    uint64_t messages;     // messages queued
+    uint64_t bytes;        // bytes queued
+    uint64_t dropped;      // messages dropped for lagging receivers
+    uint64_t resyncs;      // resends of everything after dropping
+    size_t max_queued;     // most bytes waiting for one receiver
+
+    webtiles_send_stats()
+        : messages(0), bytes(0), dropped(0), resyncs(0), max_queued(0) {}
+};
+
 class TilesFramework
 {
 public:
@@ -141,7 +156,8 @@ public:
     void send_message(PRINTF(1, ));
     void flush_messages();
 
-    bool has_receivers() { return !m_dest_addrs.empty(); }
+    bool has_receivers() { return !m_receivers.empty(); }
+    const webtiles_send_stats &send_stats() const { return m_send_stats; }
     bool is_controlled_from_web() { return m_controlled_from_web; }
 
     /* Webtiles can receive input both via stdin, and on the
@@ -186,6 +202,11 @@ public:
     void json_treat_as_nonempty();
     bool json_is_empty();
 
+    /* Encodes the next message in the compact binary format if every
+       receiver asked for it when attaching, and as JSON otherwise. The
+       json_* functions above write either; write_message() is JSON only. */
+    void begin_binary_message();
+
     string m_sock_name;
     bool m_await_connection;
 
@@ -203,7 +224,33 @@ protected:
     int m_sock;
     int m_max_msg_size;
     string m_msg_buf;
-    vector<sockaddr_un> m_dest_addrs;
+
+    /* Messages are queued for each receiver and sent without blocking,
+       so that a receiver that doesn't keep up can't stall the game.
+       When its queue is full, its unsent messages are dropped, and once
+       it has caught up everything is sent again. */
+    struct Receiver
+    {
+        Receiver();
+
+        sockaddr_un addr;
+        bool binary;    // accepts binary messages
+        bool keyframes; // understands keyframe markers
+
+        deque<shared_ptr<const string>> queue;
+        size_t queued_bytes;
+        size_t sent;  // bytes of the first message already sent
+        bool dropped; // needs everything resent once the queue is empty
+    };
+    vector<Receiver> m_receivers;
+    webtiles_send_stats m_send_stats;
+
+    void _queue_message(Receiver &receiver, shared_ptr<const string> msg);
+    bool _send_queued(Receiver &receiver);
+    void _send_queues();
+    bool _have_queued_messages() const;
+    void _resync_receivers();
+    void _send_keyframe(bool resync);
 
     bool m_controlled_from_web;
 
@@ -222,6 +269,17 @@ protected:
     void json_open(const string& name, char opener, char type);
     void json_close(bool erase_if_empty, char type);
 
+    // State of a message being written in the binary format.
+    bool m_msg_binary;
+    map<string, int> m_binary_keys;
+    // Keys in order of index, with the offset of their definition.
+    vector<pair<string, int>> m_binary_key_defs;
+
+    void _binary_write_varint(uint64_t value);
+    void _binary_write_bytes(const string& s);
+    void _binary_write_name(const string& name);
+    void _binary_erase(int start);
+
     struct MenuInfo
     {
         string tag;
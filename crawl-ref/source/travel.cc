@@ -35,6 +35,7 @@
 #include "food.h"
 #include "godabil.h"
 #include "godprayer.h"
+#include "hash.h"
 #include "hints.h"
 #include "itemname.h"
 #include "itemprop.h"
@@ -700,6 +701,41 @@ static void _set_target_square(const coord_def &target)
     you.running.pos = target;
 }
 
+// An explore flood, kept so that exploring again from the same square (after
+// an interruption, say, or once there's nothing left to explore) can reuse
+// it. Where explore goes depends on the whole flood, so it is only good while
+// none of the squares it looked at have changed at all.
+struct explore_flood_cache
+{
+    bool valid;
+    level_id level;
+    coord_def start;
+    run_mode_type runmode;
+    bool slime_wall_check;
+    bool need_for_greed;
+    int item_greed;
+    int wall_bias;
+
+    // Squares the flood looked at, and their explore_square_state() then;
+    // 0 for squares it didn't look at.
+    vector<coord_def> looked;
+    FixedArray<uint16_t, GXM, GYM> square;
+
+    // What the flood found.
+    coord_def unexplored_place, greedy_place;
+    int unexplored_dist, greedy_dist;
+    set<coord_def> unreachables;
+    travel_distance_grid_t point_distance;
+    bool moved_target;
+    coord_def target;
+
+    explore_flood_cache() : valid(false) { }
+};
+
+// One for each of _explore_find_target_square()'s floods: the plain one, and
+// the one trying to path through temporary obstructions.
+static explore_flood_cache _explore_floods[2];
+
 static void _explore_find_target_square()
 {
     bool fallback = false;
@@ -707,6 +743,7 @@ static void _explore_find_target_square()
 
     travel_pathfind tp;
     tp.set_floodseed(you.pos(), true);
+    tp.set_explore_cache(&_explore_floods[0]);
 
     coord_def whereto =
         tp.pathfind(static_cast<run_mode_type>(you.running.runmode));
@@ -717,6 +754,7 @@ static void _explore_find_target_square()
         fallback = true;
         travel_pathfind fallback_tp;
         fallback_tp.set_floodseed(you.pos(), true);
+        fallback_tp.set_explore_cache(&_explore_floods[1]);
         whereto = fallback_tp.pathfind(static_cast<run_mode_type>(you.running.runmode), true);
 
         if (whereto.distance_from(you.pos()) == 1
@@ -1152,6 +1190,61 @@ static void _fill_exclude_radius(const travel_exclude &exc)
 
 FixedVector<coord_def, GXM * GYM> travel_pathfind::circumference[2];
 
+// Unexplored squares beyond hostile terrain that path_flood() has already
+// looked for a place to see from, in this flood.
+static FixedBitArray<GXM, GYM> _unexplored_scanned;
+
+// A flood from a travel destination, kept so that the following steps
+// towards the same destination can reuse it. The flood only depends on
+// which squares it found safe and how long they take to cross, so it is
+// still good if none of the squares it looked at on its way to the player
+// have changed.
+struct travel_flood_cache
+{
+    bool valid;
+    level_id level;
+    coord_def start;
+    bool slime_wall_check;
+    int start_cost;
+
+    // Squares in the order their neighbours were flooded.
+    vector<coord_def> expanded;
+    // Where each square is in expanded, or -1.
+    FixedArray<int, GXM, GYM> expand_index;
+    // For each square the flood looked at, its traverse cost if it was
+    // safe, or -1; 0 for squares it didn't look at.
+    FixedArray<int8_t, GXM, GYM> square;
+
+    travel_flood_cache() : valid(false) { }
+};
+
+static travel_flood_cache _travel_flood;
+
+enum explore_square_bits
+{
+    ESQ_LOOKED        = 1 << 0,
+    ESQ_SAFE          = 1 << 1,
+    ESQ_SAFE_HOSTILE  = 1 << 2,
+    ESQ_SLOW          = 1 << 3,  // and 1 << 4: traverse cost - 1
+    ESQ_SEEN          = 1 << 5,
+    ESQ_WALL          = 1 << 6,
+    ESQ_GREED         = 1 << 7,
+    ESQ_RESEEDABLE    = 1 << 8,
+    ESQ_EXCLUDE_ROOT  = 1 << 9,
+    ESQ_EXCLUDED      = 1 << 10,
+    ESQ_SAFE_CLOUD    = 1 << 11,
+    // Greed checks never try to path through obstructions.
+    ESQ_GREED_SAFE    = 1 << 12,
+    ESQ_GREED_SAFE_HOSTILE = 1 << 13,
+};
+
+static int8_t _flood_square_state(const coord_def &c)
+{
+    if (!_is_travelsafe_square(c))
+        return -1;
+    return _feature_traverse_cost(env.map_knowledge(c).feat());
+}
+
 // already defined in header
 // const int travel_pathfind::UNFOUND_DIST;
 // const int travel_pathfind::INFINITE_DIST;
@@ -1164,7 +1257,9 @@ travel_pathfind::travel_pathfind()
       unexplored_place(), greedy_place(), unexplored_dist(0), greedy_dist(0),
       refdist(nullptr), reseed_points(), features(nullptr), unreachables(),
       point_distance(travel_point_distance), points(0), next_iter_points(0),
-      traveled_distance(0), circ_index(0)
+      traveled_distance(0), circ_index(0), try_fallback(false),
+      flood_cache(nullptr), record_flood(false), explore_cache(nullptr),
+      record_explore(false)
 {
 }
 
@@ -1213,6 +1308,16 @@ void travel_pathfind::set_distance_grid(travel_distance_grid_t grid)
     point_distance = grid;
 }
 
+void travel_pathfind::set_flood_cache(travel_flood_cache *cache)
+{
+    flood_cache = cache;
+}
+
+void travel_pathfind::set_explore_cache(explore_flood_cache *cache)
+{
+    explore_cache = cache;
+}
+
 void travel_pathfind::set_feature_vector(vector<coord_def> *feats)
 {
     features = feats;
@@ -1335,6 +1440,70 @@ coord_def travel_pathfind::pathfind(run_mode_type rmode, bool fallback_explore)
                                  !actor_slime_wall_immune(&you));
     unwind_slime_wall_precomputer slime_neighbours(g_Slime_Wall_Check);
 
+    // Only plain travel floods are kept: anything else looks at squares in
+    // ways the cache doesn't record.
+    record_flood = flood_cache && runmode == RMODE_TRAVEL && !floodout
+                   && !double_flood && !features && !annotate_map
+                   && !ignore_danger && !try_fallback;
+    if (record_flood)
+    {
+        if (reuse_flood())
+        {
+            record_flood = false;
+            return travel_move();
+        }
+
+        travel_flood_cache &cache(*flood_cache);
+        cache.valid = true;
+        cache.level = level_id::current();
+        cache.start = start;
+        cache.slime_wall_check = g_Slime_Wall_Check;
+        cache.start_cost = _feature_traverse_cost(
+                               env.map_knowledge(start).feat());
+        cache.expanded.clear();
+        cache.expand_index.init(-1);
+        cache.square.init(0);
+    }
+
+    // Likewise for explore, but only for the double flood
+    // _explore_find_target_square() makes.
+    record_explore = explore_cache && floodout && double_flood
+                     && (runmode == RMODE_EXPLORE
+                         || runmode == RMODE_EXPLORE_GREEDY)
+                     && !features && !annotate_map && !ignore_danger;
+    if (record_explore)
+    {
+        if (reuse_explore_flood())
+        {
+            record_explore = false;
+            return explore_target();
+        }
+
+        explore_flood_cache &cache(*explore_cache);
+        cache.valid = false;
+        cache.level = level_id::current();
+        cache.start = start;
+        cache.runmode = runmode;
+        cache.slime_wall_check = g_Slime_Wall_Check;
+        cache.need_for_greed = need_for_greed;
+        cache.item_greed = Options.explore_item_greed;
+        cache.wall_bias = Options.explore_wall_bias;
+        cache.looked.clear();
+        cache.square.init(0);
+        cache.target = you.running.pos;
+        explore_look(start);
+    }
+
+    const coord_def target = flood();
+    if (record_explore)
+        keep_explore_flood();
+    return target;
+}
+
+coord_def travel_pathfind::flood()
+{
+    _unexplored_scanned.reset();
+
     // How many points are we currently considering? We start off with just one
     // point, and spread outwards like a flood-filler.
     points = 1;
@@ -1442,6 +1611,148 @@ coord_def travel_pathfind::pathfind(run_mode_type rmode, bool fallback_explore)
                                    : explore_target();
 }
 
+// Find the move towards dest from the kept flood, if a new flood would find
+// the same one. A new flood would look at the same squares in the same
+// order until it reached the first flooded square next to dest, as long as
+// none of those squares has changed.
+bool travel_pathfind::reuse_flood()
+{
+    const travel_flood_cache &cache(*flood_cache);
+    if (!cache.valid
+        || cache.level != level_id::current()
+        || cache.start != start
+        || cache.slime_wall_check != g_Slime_Wall_Check
+        || cache.start_cost
+           != _feature_traverse_cost(env.map_knowledge(start).feat()))
+    {
+        return false;
+    }
+
+    int last = -1;
+    for (adjacent_iterator ai(dest); ai; ++ai)
+    {
+        const int index = in_bounds(*ai) ? cache.expand_index(*ai) : -1;
+        if (index >= 0 && (last < 0 || index < last))
+            last = index;
+    }
+    if (last < 0)
+        return false;
+
+    FixedBitArray<GXM, GYM> checked;
+    for (int i = 0; i <= last; ++i)
+    {
+        const coord_def c = cache.expanded[i];
+        for (adjacent_iterator ai(c); ai; ++ai)
+        {
+            const coord_def dc = *ai;
+            if (!in_bounds(dc) || dc == dest || checked(dc))
+                continue;
+            checked.set(dc);
+            if (!cache.square(dc) || cache.square(dc) != _flood_square_state(dc))
+                return false;
+        }
+    }
+
+    const coord_def c = cache.expanded[last];
+    if (_is_safe_move(c))
+        next_travel_move = c;
+    return true;
+}
+
+// Everything an explore flood looks at in a square.
+uint16_t travel_pathfind::explore_square_state(const coord_def &c) const
+{
+    const dungeon_feature_type feat = env.map_knowledge(c).feat();
+    uint16_t state = ESQ_LOOKED
+                     | (_feature_traverse_cost(feat) - 1) * ESQ_SLOW;
+    if (_is_travelsafe_square(c, false, false, try_fallback))
+        state |= ESQ_SAFE;
+    if (_is_travelsafe_square(c, true, false, try_fallback))
+        state |= ESQ_SAFE_HOSTILE;
+    if (try_fallback ? _is_travelsafe_square(c, false, false)
+                     : state & ESQ_SAFE)
+    {
+        state |= ESQ_GREED_SAFE;
+    }
+    if (try_fallback ? _is_travelsafe_square(c, true, false)
+                     : state & ESQ_SAFE_HOSTILE)
+    {
+        state |= ESQ_GREED_SAFE_HOSTILE;
+    }
+    if (env.map_knowledge(c).seen())
+        state |= ESQ_SEEN;
+    if (feat_is_wall(feat))
+        state |= ESQ_WALL;
+    if (in_bounds(c) && is_greed_inducing_square(c))
+        state |= ESQ_GREED;
+    if (in_bounds(c) && _is_reseedable(c, false))
+        state |= ESQ_RESEEDABLE;
+    if (in_bounds(c) && is_exclude_root(c))
+        state |= ESQ_EXCLUDE_ROOT;
+    if (in_bounds(c) && is_excluded(c))
+        state |= ESQ_EXCLUDED;
+    if (in_bounds(c) && _is_safe_cloud(c))
+        state |= ESQ_SAFE_CLOUD;
+    return state;
+}
+
+void travel_pathfind::explore_look(const coord_def &c)
+{
+    explore_flood_cache &cache(*explore_cache);
+    if (!cache.square(c))
+    {
+        cache.square(c) = explore_square_state(c);
+        cache.looked.push_back(c);
+    }
+}
+
+void travel_pathfind::keep_explore_flood()
+{
+    explore_flood_cache &cache(*explore_cache);
+    cache.valid = true;
+    cache.unexplored_place = unexplored_place;
+    cache.greedy_place = greedy_place;
+    cache.unexplored_dist = unexplored_dist;
+    cache.greedy_dist = greedy_dist;
+    cache.unreachables = unreachables;
+    memcpy(cache.point_distance, point_distance,
+           sizeof(travel_distance_grid_t));
+    cache.moved_target = cache.target != you.running.pos;
+    cache.target = you.running.pos;
+}
+
+// Repeat the kept explore flood, if nothing it looked at has changed.
+bool travel_pathfind::reuse_explore_flood()
+{
+    const explore_flood_cache &cache(*explore_cache);
+    if (!cache.valid
+        || cache.level != level_id::current()
+        || cache.start != start
+        || cache.runmode != runmode
+        || cache.slime_wall_check != g_Slime_Wall_Check
+        || cache.need_for_greed != need_for_greed
+        || cache.item_greed != Options.explore_item_greed
+        || cache.wall_bias != Options.explore_wall_bias)
+    {
+        return false;
+    }
+
+    for (const coord_def &c : cache.looked)
+        if (cache.square(c) != explore_square_state(c))
+            return false;
+
+    unexplored_place = cache.unexplored_place;
+    greedy_place = cache.greedy_place;
+    unexplored_dist = cache.unexplored_dist;
+    greedy_dist = cache.greedy_dist;
+    unreachables = cache.unreachables;
+    memcpy(point_distance, cache.point_distance,
+           sizeof(travel_distance_grid_t));
+    if (cache.moved_target)
+        _set_target_square(cache.target);
+    return true;
+}
+
 void travel_pathfind::get_features()
 {
     ASSERT(features);
@@ -1536,13 +1847,35 @@ bool travel_pathfind::path_flood(const coord_def &c, const coord_def &dc)
     if (!in_bounds(dc) || unreachables.count(dc))
         return false;
 
+    if (record_explore)
+        explore_look(dc);
+
     if (floodout
         && (runmode == RMODE_EXPLORE || runmode == RMODE_EXPLORE_GREEDY))
     {
         if (!env.map_knowledge(dc).seen())
         {
-            if (ignore_hostile && !player_in_branch(BRANCH_SHOALS))
+            if (ignore_hostile && !player_in_branch(BRANCH_SHOALS)
+                && _unexplored_scanned(dc))
+            {
+                // Looking again would find the same places, none of them
+                // better than the current target.
+                _set_target_square(unexplored_place);
+                if (unexplored_dist == 1)
+                    return true;
+            }
+            else if (ignore_hostile && !player_in_branch(BRANCH_SHOALS))
             {
+                _unexplored_scanned.set(dc);
+
+                // What this can see depends on squares the cache doesn't
+                // record.
+                if (record_explore)
+                {
+                    explore_cache->valid = false;
+                    record_explore = false;
+                }
+
                 // This point is unexplored but unreachable. Let's find a
                 // place from where we can see it.
                 for (radius_iterator ri(dc, LOS_DEFAULT, true); ri; ++ri)
@@ -1590,6 +1923,8 @@ bool travel_pathfind::path_flood(const coord_def &c, const coord_def &dc)
                     {
                         const coord_def ddc = dc + Compass[dir];
 
+                        if (record_explore)
+                            explore_look(ddc);
                         if (feat_is_wall(env.map_knowledge(ddc).feat()))
                             dist -= Options.explore_wall_bias;
                     }
@@ -1641,7 +1976,16 @@ bool travel_pathfind::path_flood(const coord_def &c, const coord_def &dc)
 
         return true;
     }
-    else if (!_is_travelsafe_square(dc, ignore_hostile, ignore_danger, try_fallback))
+
+    const bool safe = _is_travelsafe_square(dc, ignore_hostile, ignore_danger,
+                                            try_fallback);
+    if (record_flood)
+    {
+        flood_cache->square(dc) =
+            safe ? _feature_traverse_cost(env.map_knowledge(dc).feat()) : -1;
+    }
+
+    if (!safe)
     {
         // This point is not okay to travel on, but if this is a
         // trap, we'll want to put it on the feature vector anyway.
@@ -1751,6 +2095,12 @@ bool travel_pathfind::path_examine_point(const coord_def &c)
     if (point_traverse_delay(c))
         return false;
 
+    if (record_flood && flood_cache->expand_index(c) < 0)
+    {
+        flood_cache->expand_index(c) = flood_cache->expanded.size();
+        flood_cache->expanded.push_back(c);
+    }
+
     bool found_target = false;
 
     // For each point, we look at all surrounding points. Take them orthogonals
@@ -1779,6 +2129,7 @@ void find_travel_pos(const coord_def& youpos,
         tp.set_floodseed(youpos);
 
     tp.set_feature_vector(features);
+    tp.set_flood_cache(&_travel_flood);
 
     run_mode_type rmode = (move_x && move_y) ? RMODE_TRAVEL
                                              : RMODE_NOT_RUNNING;
@@ -2879,9 +3230,14 @@ static int _find_transtravel_stair(const level_id &cur,
 
 static bool _loadlev_populate_stair_distances(const level_pos &target)
 {
+    LevelInfo &li = travel_cache.get_level_info(target.id);
+    if (li.recall_target_distances(target.pos, curr_stairs))
+        return true;
+
     level_excursion excursion;
     excursion.go_to(target.id);
     _populate_stair_distances(target);
+    li.remember_target_distances(target.pos, curr_stairs);
     return true;
 }
 
@@ -3367,6 +3723,34 @@ void LevelInfo::update_excludes()
     excludes = curr_excludes;
 }
 
+// Hashes everything that stair distances on the current level depend on:
+// the travel safety and cost of every square, and where the stairs are.
+// The travel safety grid must have been precomputed.
+static uint32_t _stair_distance_key(const vector<stair_info> &stairs)
+{
+    ASSERT(_travel_safe_grid.get());
+
+    vector<uint8_t> data;
+    data.reserve(GXM * GYM + 2 * stairs.size());
+    for (rectangle_iterator ri(1); ri; ++ri)
+    {
+        const cell_travel_safety &ts((*_travel_safe_grid)(*ri));
+        const int cost =
+            _feature_traverse_cost(env.map_knowledge(*ri).feat());
+        data.push_back(ts.safe | ts.safe_if_ignoring_hostile_terrain << 1
+                       | cost << 2);
+    }
+    for (const stair_info &si : stairs)
+    {
+        data.push_back(si.position.x);
+        data.push_back(si.position.y);
+    }
+
+    // Zero means we don't know.
+    const uint32_t key = hash32(&data[0], data.size());
+    return key ? key : 1;
+}
+
 void LevelInfo::update()
 {
     // First, set excludes, so that stair distances will be correctly populated.
@@ -3386,11 +3770,67 @@ void LevelInfo::update()
     unwind_slime_wall_precomputer slime_wall_neighbours(
         !actor_slime_wall_immune(&you));
     precompute_travel_safety_grid travel_safety_calc;
-    update_stair_distances();
+
+    // Flooding from every stair is slow, and this is done every time the
+    // player changes levels, so skip it if nothing it depends on changed.
+    const uint32_t key = _stair_distance_key(stairs);
+    if (key != distance_key
+        || stair_distances.size() != stairs.size() * stairs.size())
+    {
+        update_stair_distances();
+        distance_key = key;
+    }
 
     update_daction_counters(this);
 }
 
+// Combines distance_key with what feat_is_traversable_now() and the slime
+// wall checks read of the player, which can change between trips (by
+// flying, say, or changing travel_avoid_terrain) without the level doing so.
+static uint32_t _target_distance_key(uint32_t distance_key)
+{
+    vector<uint8_t> data;
+    data.reserve(NUM_FEATURES + 8);
+    for (int i = 0; i < NUM_FEATURES; ++i)
+        data.push_back(forbidden_terrain[i]);
+    data.push_back(player_likes_water(true));
+    data.push_back(player_likes_lava(true));
+    data.push_back(you.permanent_flight());
+    data.push_back(player_can_open_doors());
+    data.push_back(actor_slime_wall_immune(&you));
+    for (int i = 0; i < 4; ++i)
+        data.push_back(distance_key >> (8 * i));
+
+    const uint32_t key = hash32(&data[0], data.size());
+    return key ? key : 1;
+}
+
+bool LevelInfo::recall_target_distances(const coord_def &target,
+                                        vector<stair_info> &dists) const
+{
+    if (!distance_key || target_key != _target_distance_key(distance_key)
+        || target_pos != target
+        || target_distances.size() != stairs.size())
+    {
+        return false;
+    }
+
+    dists = stairs;
+    for (int i = 0, count = dists.size(); i < count; ++i)
+        dists[i].distance = target_distances[i];
+    return true;
+}
+
+void LevelInfo::remember_target_distances(const coord_def &target,
+                                          const vector<stair_info> &dists)
+{
+    target_pos = target;
+    target_key = _target_distance_key(distance_key);
+    target_distances.clear();
+    for (const stair_info &si : dists)
+        target_distances.push_back(si.distance);
+}
+
 void LevelInfo::set_distance_between_stairs(int a, int b, int dist)
 {
     // Note dist == 0 is illegal because we can't have two stairs on
@@ -3486,7 +3926,9 @@ void LevelInfo::create_placeholder_stair(const coord_def &stair,
     placeholder.type        = stair_info::PLACEHOLDER;
     stairs.push_back(placeholder);
 
+    stair_distances.clear();
     resize_stair_distances();
+    distance_key = 0;
 }
 
 // If a stair leading out of or into a branch has a known destination, all
@@ -3570,7 +4012,7 @@ int LevelInfo::get_stair_index(const coord_def &pos) const
 
 void LevelInfo::correct_stair_list(const vector<coord_def> &s)
 {
-    stair_distances.clear();
+    bool changed = false;
 
     // Fix up the grid for the placeholder stair.
     for (int i = 0, sz = stairs.size(); i < sz; ++i)
@@ -3593,7 +4035,10 @@ void LevelInfo::correct_stair_list(const vector<coord_def> &s)
         }
 
         if (!found)
+        {
             stairs.erase(stairs.begin() + i);
+            changed = true;
+        }
     }
 
     // For each stair in 's', make sure we have a corresponding stair
@@ -3627,11 +4072,19 @@ void LevelInfo::correct_stair_list(const vector<coord_def> &s)
             // that can't be helped. That information will have to be filled
             // in whenever the player takes these stairs.
             stairs.push_back(si);
+            changed = true;
         }
         else
             stairs[found].type = stair_info::PHYSICAL;
     }
 
+    // The distances we have are still good if the stairs are the same;
+    // update() will decide whether they need recomputing.
+    if (changed)
+    {
+        stair_distances.clear();
+        distance_key = 0;
+    }
     resize_stair_distances();
 }
 
@@ -3708,6 +4161,7 @@ void LevelInfo::save(writer& outf) const
                 marshallShort(outf, stair_distances[i]);
         }
     }
+    marshallInt(outf, distance_key);
 
     marshallExcludes(outf, excludes);
 
@@ -3742,6 +4196,12 @@ void LevelInfo::load(reader& inf, int minorVersion)
         for (int i = stair_count * stair_count - 1; i >= 0; --i)
             stair_distances.push_back(unmarshallShort(inf));
     }
+#if TAG_MAJOR_VERSION == 34
+    if (minorVersion < TAG_MINOR_STAIR_DISTANCE_KEY)
+        distance_key = 0;
+    else
+#endif
+        distance_key = unmarshallInt(inf);
 
     unmarshallExcludes(inf, minorVersion, excludes);
 
@@ -4725,6 +5185,7 @@ void clear_travel_trail()
         tiles.update_minimap(c);
 #endif
     env.travel_trail.clear();
+    view_mark_all_dirty();
 }
 
 int travel_trail_index(const coord_def& gc)
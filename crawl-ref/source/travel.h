@@ -15,6 +15,8 @@
 
 class reader;
 class writer;
+struct explore_flood_cache;
+struct travel_flood_cache;
 
 enum run_check_type
 {
@@ -291,7 +293,8 @@ public:
 // Information on a level that interlevel travel needs.
 struct LevelInfo
 {
-    LevelInfo() : stairs(), excludes(), stair_distances(), id()
+    LevelInfo() : stairs(), excludes(), stair_distances(), distance_key(0),
+                  target_pos(), target_key(0), target_distances(), id()
     {
         daction_counters.init(0);
     }
@@ -326,6 +329,13 @@ struct LevelInfo
     void update();              // Update LevelInfo to be correct for the
                                 // current level.
 
+    // Fills in the distances of this level's stairs from target if they
+    // are known from an earlier trip there, and returns true if so.
+    bool recall_target_distances(const coord_def &target,
+                                 vector<stair_info> &dists) const;
+    void remember_target_distances(const coord_def &target,
+                                   const vector<stair_info> &dists);
+
     // Updates/creates a StairInfo for the stair at stairpos in grid coordinates
     void update_stair(const coord_def& stairpos, const level_pos &p,
                       bool guess = false);
@@ -358,6 +368,18 @@ private:
     exclude_set excludes;
 
     vector<short> stair_distances;  // Dist between stairs
+
+    // Hash of the travel safety and cost of every square and of the stair
+    // positions that stair_distances were computed from, or 0 if unknown.
+    uint32_t distance_key;
+
+    // Stair distances from the last interlevel travel target on this level,
+    // valid while target_key matches distance_key and the player's ability
+    // to cross terrain.
+    coord_def target_pos;
+    uint32_t target_key;
+    vector<short> target_distances;
+
     level_id id;
 
     friend class TravelCache;
@@ -495,6 +517,14 @@ public:
         ignore_danger = true;
     }
 
+    // Keep RMODE_TRAVEL floods in this cache, and reuse the last one
+    // instead of flooding again while nothing it looked at has changed.
+    void set_flood_cache(travel_flood_cache *cache);
+
+    // Likewise for double floods for explore, while nothing they looked at
+    // has changed.
+    void set_explore_cache(explore_flood_cache *cache);
+
 protected:
     bool is_greed_inducing_square(const coord_def &c) const;
     bool path_examine_point(const coord_def &c);
@@ -503,6 +533,12 @@ protected:
     bool square_slows_movement(const coord_def &c);
     void check_square_greed(const coord_def &c);
     void good_square(const coord_def &c);
+    bool reuse_flood();
+    coord_def flood();
+    uint16_t explore_square_state(const coord_def &c) const;
+    void explore_look(const coord_def &c);
+    void keep_explore_flood();
+    bool reuse_explore_flood();
 
 protected:
     static const int UNFOUND_DIST  = -30000;
@@ -588,6 +624,12 @@ protected:
     // Attempt to path through temporary obstructions (like sealed doors)
     // due to the possibility they are no longer obstructing us
     bool try_fallback;
+
+    // Where to keep travel floods, and whether this one is being kept.
+    travel_flood_cache *flood_cache;
+    bool record_flood;
+    explore_flood_cache *explore_cache;
+    bool record_explore;
 };
 
 extern TravelCache travel_cache;
@@ -0,0 +1,206 @@
+/**
+ * @file
+ * @brief Wall-clock profiling of the phases of a game turn.
+ *
+ * Phases are timed where they run rather than around their calls in
+ * world_reacts(), so that e.g. LOS updates are counted whoever asks for
+ * them. Phases nest (LOS is mostly updated from within the monster and
+ * view phases), so their times don't add up to that of the turn. A phase
+ * entered recursively is only timed at its outermost level.
+**/
+
+#include "AppHdr.h"
+
+#include "turnprof.h"
+
+#include <chrono>
+
+#include "message.h"
+#include "player.h"
+#include "prompt.h"
+#include "stringutil.h"
+#include "syscalls.h"
+
+bool turn_profiling = false;
+
+static const char *phase_names[] =
+{
+    "turn", "monsters", "clouds", "noises", "los", "viewwindow", "save",
+    "lua",
+};
+COMPILE_CHECK(ARRAYSZ(phase_names) == NUM_TURN_PHASES);
+
+struct turn_phase_stats
+{
+    uint64_t start_ns;
+    int depth;
+
+    // The turn in progress.
+    uint64_t turn_ns;
+    uint64_t turn_calls;
+
+    // All turns ended since the last reset.
+    uint64_t total_ns;
+    uint64_t total_calls;
+    uint64_t max_turn_ns;
+};
+
+static turn_phase_stats _phases[NUM_TURN_PHASES];
+static uint64_t _turns = 0;
+static FILE *_csv = nullptr;
+
+static uint64_t _now_ns()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void turn_profile_start_phase(turn_phase_type phase)
+{
+    turn_phase_stats &st = _phases[phase];
+    if (st.depth++ == 0)
+        st.start_ns = _now_ns();
+}
+
+void turn_profile_end_phase(turn_phase_type phase)
+{
+    turn_phase_stats &st = _phases[phase];
+    ASSERT(st.depth > 0);
+    if (--st.depth == 0)
+    {
+        st.turn_ns += _now_ns() - st.start_ns;
+        st.turn_calls++;
+    }
+}
+
+void set_turn_profiling(bool on)
+{
+    turn_profiling = on;
+}
+
+void reset_turn_profile()
+{
+    // Leave start_ns and depth alone: phases may be in progress.
+    for (turn_phase_stats &st : _phases)
+    {
+        st.turn_ns = st.turn_calls = 0;
+        st.total_ns = st.total_calls = st.max_turn_ns = 0;
+    }
+    _turns = 0;
+}
+
+void turn_profile_end_turn()
+{
+    if (!turn_profiling)
+        return;
+
+    _turns++;
+
+    if (_csv)
+    {
+        fprintf(_csv, "%d", you.num_turns);
+        for (const turn_phase_stats &st : _phases)
+        {
+            fprintf(_csv, ",%" PRIu64 ",%" PRIu64,
+                    st.turn_ns / 1000, st.turn_calls);
+        }
+        fputc('\n', _csv);
+    }
+
+    for (turn_phase_stats &st : _phases)
+    {
+        st.total_ns += st.turn_ns;
+        st.total_calls += st.turn_calls;
+        st.max_turn_ns = max(st.max_turn_ns, st.turn_ns);
+        st.turn_ns = st.turn_calls = 0;
+    }
+}
+
+/**
+ * Write a row per turn to the given file from now on, and start profiling.
+ *
+ * @return whether the file could be opened.
+ */
+bool turn_profile_open_csv(const string &filename)
+{
+    if (_csv)
+        fclose(_csv);
+    _csv = fopen_u(filename.c_str(), "w");
+    if (!_csv)
+        return false;
+
+    // Flush each row, so that a crash or kill doesn't lose the turns
+    // leading up to it.
+    setvbuf(_csv, nullptr, _IOLBF, BUFSIZ);
+
+    fprintf(_csv, "turn");
+    for (const char *name : phase_names)
+        fprintf(_csv, ",%s_us,%s_calls", name, name);
+    fputc('\n', _csv);
+
+    reset_turn_profile();
+    set_turn_profiling(true);
+    return true;
+}
+
+vector<string> turn_profile_summary()
+{
+    vector<string> lines;
+    if (!_turns)
+    {
+        lines.push_back("No turns profiled.");
+        return lines;
+    }
+
+    lines.push_back(make_stringf("Turn phases over %" PRIu64 " turns:",
+                                 _turns));
+    lines.push_back(make_stringf("%-10s %10s %10s %10s %10s", "phase",
+                                 "calls/turn", "ms/turn", "max ms",
+                                 "total s"));
+    for (int i = 0; i < NUM_TURN_PHASES; i++)
+    {
+        const turn_phase_stats &st = _phases[i];
+        lines.push_back(make_stringf("%-10s %10.2f %10.3f %10.3f %10.3f",
+                                     phase_names[i],
+                                     (double)st.total_calls / _turns,
+                                     st.total_ns / 1e6 / _turns,
+                                     st.max_turn_ns / 1e6,
+                                     st.total_ns / 1e9));
+    }
+    return lines;
+}
+
+void dump_turn_profile(FILE *file)
+{
+    if (!_turns)
+        return;
+
+    for (const string &line : turn_profile_summary())
+        fprintf(file, "%s\n", line.c_str());
+}
+
+#ifdef WIZARD
+void wizard_turn_profile()
+{
+    if (!turn_profiling)
+    {
+        reset_turn_profile();
+        set_turn_profiling(true);
+        mpr("Profiling turns; use this command again for the results.");
+        return;
+    }
+
+    for (const string &line : turn_profile_summary())
+        mprf(MSGCH_DIAGNOSTICS, "%s", line.c_str());
+
+    // -profile-turns keeps profiling for its file.
+    if (_csv)
+        return;
+
+    if (!yesno("Keep profiling turns?", true, 'n'))
+    {
+        set_turn_profiling(false);
+        mpr("Stopped profiling turns.");
+    }
+}
+#endif
@@ -0,0 +1,62 @@
+/**
+ * @file
+ * @brief Wall-clock profiling of the phases of a game turn.
+**/
+
+#ifndef TURNPROF_H
+#define TURNPROF_H
+
+enum turn_phase_type
+{
+    TPHASE_TURN,        // all of world_reacts()
+    TPHASE_MONSTERS,
+    TPHASE_CLOUDS,
+    TPHASE_NOISES,
+    TPHASE_LOS,
+    TPHASE_VIEWWINDOW,
+    TPHASE_SAVE,
+    TPHASE_LUA,
+    NUM_TURN_PHASES
+};
+
+extern bool turn_profiling;
+
+void turn_profile_start_phase(turn_phase_type phase);
+void turn_profile_end_phase(turn_phase_type phase);
+
+// Times the rest of the enclosing scope as the given phase. This costs a
+// single test of turn_profiling when profiling is off.
+class turn_phase_timer
+{
+public:
+    explicit turn_phase_timer(turn_phase_type p)
+        : phase(p), active(turn_profiling)
+    {
+        if (active)
+            turn_profile_start_phase(phase);
+    }
+    ~turn_phase_timer()
+    {
+        if (active)
+            turn_profile_end_phase(phase);
+    }
+private:
+    turn_phase_timer(const turn_phase_timer &) = delete;
+    turn_phase_timer &operator=(const turn_phase_timer &) = delete;
+
+    turn_phase_type phase;
+    bool active;
+};
+
+void set_turn_profiling(bool on);
+void reset_turn_profile();
+void turn_profile_end_turn();
+bool turn_profile_open_csv(const string &filename);
+vector<string> turn_profile_summary();
+void dump_turn_profile(FILE *file);
+
+#ifdef WIZARD
+void wizard_turn_profile();
+#endif
+
+#endif
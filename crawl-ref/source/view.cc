@@ -66,6 +66,7 @@
 #endif
 #include "traps.h"
 #include "travel.h"
+#include "turnprof.h"
 #include "unicode.h"
 #include "viewchar.h"
 #include "viewmap.h"
@@ -789,6 +790,8 @@ void view_update_at(const coord_def &pos)
     if (pos == you.pos())
         return;
 
+    view_mark_dirty(pos);
+
     show_update_at(pos);
 
 #ifndef USE_TILE_LOCAL
@@ -1270,6 +1273,147 @@ void run_animation(animation_type anim, use_animation_type type, bool cleanup)
     }
 }
 
+// A cell outside LOS bounds looks the same until what the player remembers
+// of it changes, so viewwindow() notes what each view cell was last drawn
+// from and leaves cells alone while that stays the same.
+struct drawn_cell
+{
+    bool valid;
+    coord_def gc;
+    uint32_t flags;
+    dungeon_feature_type feat;
+    colour_t feat_colour;
+    trap_type trap;
+#ifdef USE_TILE
+    tileidx_t fg;
+    tileidx_t bg;
+    tileidx_t cloud;
+#endif
+};
+
+static vector<drawn_cell> _drawn_cells;
+static level_id _drawn_level;
+static bool _drawn_all_dirty = true;
+static bool _drawn_specially = false;
+
+void view_mark_dirty(const coord_def &gc)
+{
+    const coord_def vp = grid2view(gc);
+    if (!crawl_view.in_viewport_v(vp))
+        return;
+
+    const unsigned int i = (vp.y - 1) * crawl_view.viewsz.x + vp.x - 1;
+    if (i < _drawn_cells.size())
+        _drawn_cells[i].valid = false;
+}
+
+void view_mark_all_dirty()
+{
+    _drawn_all_dirty = true;
+}
+
+// Whether the cell's glyph or tile might change from one refresh to the
+// next without the map knowledge changing: elemental colours and random
+// auras, and the colours of monsters, items and clouds, which aren't worth
+// following.
+static bool _cell_is_animated(const map_cell &mc)
+{
+    if (mc.monster() != MONS_NO_MONSTER || mc.item()
+        || mc.cloud() != CLOUD_NONE)
+    {
+        return true;
+    }
+
+    if (mc.flags & (MAP_SANCTUARY_2 | MAP_LIQUEFIED | MAP_DISJUNCT
+                    | MAP_ORB_HALOED | MAP_GOLDEN))
+    {
+        return true;
+    }
+#if TAG_MAJOR_VERSION == 34
+    if (mc.flags & MAP_HOT)
+        return true;
+#endif
+
+    const dungeon_feature_type feat = mc.feat();
+    if (feat == DNGN_SHALLOW_WATER && player_in_branch(BRANCH_SHOALS))
+        return true;
+
+    const feature_def &fdef = get_feature_def(feat);
+    return is_element_colour(mc.feat_colour())
+           || is_element_colour(fdef.colour())
+           || is_element_colour(fdef.em_colour())
+           || is_element_colour(fdef.seen_colour())
+           || is_element_colour(fdef.seen_em_colour());
+}
+
+static drawn_cell _drawn_cell_at(const coord_def &gc)
+{
+    drawn_cell dc = {};
+    dc.gc = gc;
+    dc.valid = !crawl_view.in_los_bounds_g(gc);
+    if (!dc.valid || !map_bounds(gc))
+        return dc;
+
+    const map_cell &mc = env.map_knowledge(gc);
+    dc.valid = !_cell_is_animated(mc);
+    dc.flags = mc.flags;
+    dc.feat = mc.feat();
+    dc.feat_colour = mc.feat_colour();
+    dc.trap = mc.trap();
+#ifdef USE_TILE
+    dc.fg = env.tile_bk_fg(gc);
+    dc.bg = env.tile_bk_bg(gc);
+    dc.cloud = env.tile_bk_cloud(gc);
+#endif
+    return dc;
+}
+
+static bool _same_drawn_cell(const drawn_cell &a, const drawn_cell &b)
+{
+    return a.valid && b.valid
+           && a.gc == b.gc
+           && a.flags == b.flags
+           && a.feat == b.feat
+           && a.feat_colour == b.feat_colour
+           && a.trap == b.trap
+#ifdef USE_TILE
+           && a.fg == b.fg
+           && a.bg == b.bg
+           && a.cloud == b.cloud
+#endif
+           ;
+}
+
+// Whether every cell must be drawn this time, because something that
+// colours the whole view is going on, or went on last time.
+static bool _must_draw_all_cells(const animation *a, int flash_colour)
+{
+    const bool special = a || flash_colour || you.flash_where
+                         || crawl_state.darken_range
+                         || crawl_state.flash_monsters
+                         || _show_terrain
+                         || !you.on_current_level
+#ifdef USE_TILE_LOCAL
+                         // Cells out of reach are greyed out anywhere.
+                         || you.beheld() || you.afraid()
+#endif
+                         ;
+
+    const unsigned int size = crawl_view.viewsz.x * crawl_view.viewsz.y;
+    const bool all = special || _drawn_specially || _drawn_all_dirty
+                     || _drawn_level != level_id::current()
+                     || _drawn_cells.size() != size;
+
+    if (all)
+    {
+        _drawn_cells.assign(size, drawn_cell());
+        _drawn_level = level_id::current();
+        _drawn_all_dirty = false;
+    }
+    _drawn_specially = special;
+    return all;
+}
+
 //---------------------------------------------------------------
 //
 // Draws the main window using the character set returned
@@ -1283,6 +1427,8 @@ void run_animation(animation_type anim, use_animation_type type, bool cleanup)
 //---------------------------------------------------------------
 void viewwindow(bool show_updates, bool tiles_only, animation *a)
 {
+    turn_phase_timer timer(TPHASE_VIEWWINDOW);
+
     // The player could be at (0,0) if we are called during level-gen; this can
     // happen via mpr -> interrupt_activity -> stop_delay -> runrest::stop
     if (you.duration[DUR_TIME_STEP] || you.pos().origin())
@@ -1340,21 +1486,27 @@ void viewwindow(bool show_updates, bool tiles_only, animation *a)
     if (flash_colour == BLACK)
         flash_colour = viewmap_flash_colour();
 
+    const bool draw_all = _must_draw_all_cells(a, flash_colour);
+    drawn_cell *drawn = _drawn_cells.data();
+
     const coord_def tl = coord_def(1, 1);
     const coord_def br = crawl_view.viewsz;
-    for (rectangle_iterator ri(tl, br); ri; ++ri)
+    for (rectangle_iterator ri(tl, br); ri; ++ri, ++cell, ++drawn)
     {
         // in grid coords
         const coord_def gc = a
             ? a->cell_cb(view2grid(*ri), flash_colour)
             : view2grid(*ri);
 
+        const drawn_cell now = _drawn_cell_at(gc);
+        if (!draw_all && _same_drawn_cell(*drawn, now))
+            continue;
+        *drawn = now;
+
         if (you.flash_where && you.flash_where->is_affected(gc) <= 0)
             draw_cell(cell, gc, anim_updates, 0);
         else
             draw_cell(cell, gc, anim_updates, flash_colour);
-
-        cell++;
     }
 
     you.last_view_update = you.num_turns;
@@ -25,6 +25,8 @@ string screenshot();
 int viewmap_flash_colour();
 bool view_update();
 void view_update_at(const coord_def &pos);
+void view_mark_dirty(const coord_def &gc);
+void view_mark_all_dirty();
 class targetter;
 
 static inline void scaled_delay(unsigned int ms)
@@ -5,6 +5,7 @@
 #include "end.h"
 #include "options.h"
 #include "state.h"
+#include "view.h"
 
 
 // ----------------------------------------------------------------------
@@ -304,6 +305,7 @@ void crawl_view_geometry::init_view()
 {
     viewhalfsz = viewsz / 2;
     vbuf.resize(viewsz);
+    view_mark_all_dirty();
     set_player_at(you.pos(), true);
 }
 
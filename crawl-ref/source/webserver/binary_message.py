@@ -0,0 +1,115 @@
+"""Decoder for crawl's binary game messages.
+
+Crawl sends these instead of some JSON messages when we ask for them on
+attaching; see the description of the format in tileweb.cc. The browser
+decodes them itself (static/scripts/binary_message.js), so this is only
+used for clients that can't take binary frames.
+"""
+
+import struct
+
+MARKER = "\x02"
+HEADER_SIZE = 5 # The marker and a big-endian length
+
+SMALL_INT_MAX = 0xdf
+INT, NEG_INT, FALSE, TRUE, NULL, STRING, OBJECT, ARRAY, NEW_KEY, KEY = \
+    range(0xe0, 0xea)
+END = 0xef
+
+def is_binary(msg):
+    return msg.startswith(MARKER)
+
+def message_length(data):
+    """Returns the full length of the binary message at the start of data,
+    or None if the header is incomplete."""
+    if len(data) < HEADER_SIZE:
+        return None
+    return HEADER_SIZE + struct.unpack(">I", data[1:HEADER_SIZE])[0]
+
+def strip_length(data):
+    """Turns a message as crawl sends it into one as clients get it."""
+    return MARKER + data[HEADER_SIZE:]
+
+class _Decoder(object):
+    def __init__(self, data):
+        self.data = data
+        self.pos = 1
+        self.keys = []
+
+    def byte(self):
+        b = ord(self.data[self.pos])
+        self.pos += 1
+        return b
+
+    def varint(self):
+        value = 0
+        shift = 0
+        while True:
+            b = self.byte()
+            value |= (b & 0x7f) << shift
+            shift += 7
+            if not b & 0x80:
+                return value
+
+    def string(self):
+        length = self.varint()
+        s = self.data[self.pos:self.pos + length]
+        if len(s) != length:
+            raise ValueError("Truncated binary message")
+        self.pos += length
+        return s.decode("utf-8")
+
+    def key(self, token):
+        if token == NEW_KEY:
+            key = self.string()
+            self.keys.append(key)
+            return key
+        elif token == KEY:
+            return self.keys[self.varint()]
+        elif token <= SMALL_INT_MAX:
+            return self.keys[token]
+        raise ValueError("Bad key in binary message: %d" % token)
+
+    def value(self):
+        token = self.byte()
+        if token <= SMALL_INT_MAX:
+            return token
+        elif token == INT:
+            return self.varint()
+        elif token == NEG_INT:
+            return -self.varint()
+        elif token == FALSE:
+            return False
+        elif token == TRUE:
+            return True
+        elif token == NULL:
+            return None
+        elif token == STRING:
+            return self.string()
+        elif token == OBJECT:
+            obj = {}
+            token = self.byte()
+            while token != END:
+                key = self.key(token)
+                obj[key] = self.value()
+                token = self.byte()
+            return obj
+        elif token == ARRAY:
+            arr = []
+            while ord(self.data[self.pos]) != END:
+                arr.append(self.value())
+            self.pos += 1
+            return arr
+        raise ValueError("Bad token in binary message: %d" % token)
+
+def decode(msg):
+    """Decodes a binary message, as clients get it, into the object the
+    equivalent JSON message would give."""
+    decoder = _Decoder(msg)
+    try:
+        value = decoder.value()
+    except IndexError:
+        raise ValueError("Truncated binary message")
+    if decoder.pos != len(msg):
+        raise ValueError("Trailing data in binary message")
+    return value
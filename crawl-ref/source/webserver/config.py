@@ -39,6 +39,16 @@ game_data_no_cache = True
 # Watch socket dirs for games not started by the server
 watch_socket_dirs = False
 
+# Ask crawl to send the map and player state in a compact binary encoding
+# instead of JSON. Crawl versions that don't know it send JSON anyway.
+binary_protocol = True
+
+# New spectators are sent the state from crawl's last keyframe and the
+# messages since, so that crawl doesn't have to send everything to all
+# watchers whenever someone joins. A new keyframe is asked for once this
+# many bytes of messages have been kept since the last one.
+keyframe_log_size = 1024 * 1024
+
 # Game configs
 # %n in paths and urls is replaced by the current username
 # morgue_url is for a publicly available URL to access morgue_path
@@ -7,7 +7,8 @@ import warnings
 from datetime import datetime, timedelta
 from tornado.escape import json_encode
 
-from config import server_socket_path
+from config import server_socket_path, binary_protocol
+import binary_message
 
 class WebtilesSocketConnection(object):
     def __init__(self, io_loop, socketpath, logger):
@@ -53,7 +54,9 @@ class WebtilesSocketConnection(object):
 
         msg = json_encode({
                 "msg": "attach",
-                "primary": primary
+                "primary": primary,
+                "binary": binary_protocol,
+                "keyframes": True
                 })
 
         self.open = True
@@ -73,16 +76,24 @@ class WebtilesSocketConnection(object):
         if self.msg_buffer is not None:
             data = self.msg_buffer + data
 
-        if data[-1] != "\n":
-            # All messages from crawl end with \n.
+        if binary_message.is_binary(data):
+            # Binary messages start with their length instead.
+            length = binary_message.message_length(data)
+            if length is None or len(data) < length:
+                self.msg_buffer = data
+                return
+            data = binary_message.strip_length(data)
+
+        elif data[-1] != "\n":
+            # All other messages from crawl end with \n.
             # If this one doesn't, it's fragmented.
             self.msg_buffer = data
+            return
 
-        else:
-            self.msg_buffer = None
+        self.msg_buffer = None
 
-            if self.message_callback:
-                self.message_callback(data)
+        if self.message_callback:
+            self.message_callback(data)
 
     def send_message(self, data):
         start = datetime.now()
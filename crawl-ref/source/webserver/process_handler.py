@@ -5,6 +5,7 @@ import hashlib
 import logging
 
 import config
+import binary_message
 
 from tornado.escape import json_decode, json_encode, xhtml_escape
 from tornado.ioloop import PeriodicCallback, IOLoop
@@ -137,8 +138,20 @@ class CrawlProcessHandlerBase(object):
             receiver.flush_messages()
 
     def write_to_all(self, msg, send):
-        for receiver in self._receivers:
-            receiver.write_message(msg, send)
+        self._write_to(self._receivers, msg, send)
+
+    def _write_to(self, receivers, msg, send):
+        # Decode binary messages only once for all the receivers that
+        # can't take them.
+        text = None
+        for receiver in receivers:
+            if (binary_message.is_binary(msg)
+                and not receiver.takes_binary_messages()):
+                if text is None:
+                    text = json_encode(binary_message.decode(msg))
+                receiver.write_message(text, send)
+            else:
+                receiver.write_message(msg, send)
 
     def send_to_all(self, msg, **data):
         for receiver in self._receivers:
@@ -368,6 +381,17 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
         self._purging_timer = None
         self._process_hup_timeout = None
 
+        # The last keyframe from crawl and the messages since, which are
+        # all a new spectator needs; see _on_socket_message.
+        self._keyframe = None
+        self._frame_log = []
+        self._frame_log_size = 0
+        self._new_keyframe = None
+        self._new_keyframe_resync = False
+        self._keyframes_supported = False
+        self._keyframe_requested = False
+        self._awaiting_keyframe = set()
+
     def start(self):
         self._purge_locks_and_start(True)
 
@@ -605,8 +629,65 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
     def add_watcher(self, watcher):
         super(CrawlProcessHandler, self).add_watcher(watcher)
 
+        if self._keyframe is not None and self._new_keyframe is None:
+            self._send_frame_log(watcher)
+        elif self.conn and self.conn.open:
+            self._awaiting_keyframe.add(watcher)
+            if self._keyframes_supported:
+                self._request_keyframe()
+            else:
+                # Crawl versions without keyframes send everything to
+                # everyone.
+                self.conn.send_message('{"msg":"spectator_joined"}')
+
+    def remove_watcher(self, watcher):
+        self._awaiting_keyframe.discard(watcher)
+        super(CrawlProcessHandler, self).remove_watcher(watcher)
+
+    def write_to_all(self, msg, send):
+        # Those waiting for a keyframe get everything at once when it
+        # comes.
+        receivers = self._receivers
+        if self._keyframes_supported and self._awaiting_keyframe:
+            receivers = receivers - self._awaiting_keyframe
+        self._write_to(receivers, msg, send)
+
+    def _request_keyframe(self):
+        if self._keyframe_requested or self._new_keyframe is not None:
+            return
         if self.conn and self.conn.open:
-            self.conn.send_message('{"msg":"spectator_joined"}')
+            self._keyframe_requested = True
+            self.conn.send_message('{"msg":"keyframe"}')
+
+    def _send_frame_log(self, watcher):
+        for msg in self._keyframe:
+            watcher.write_message(msg, False)
+        for msg in self._frame_log:
+            watcher.write_message(msg, False)
+        watcher.flush_messages()
+
+    def _log_frame(self, msg):
+        if self._keyframe is None:
+            return
+        self._frame_log.append(msg)
+        self._frame_log_size += len(msg)
+        if self._frame_log_size > config.keyframe_log_size:
+            if self.watcher_count() > 0:
+                self._request_keyframe()
+            else:
+                # Nobody is watching; ask again when someone joins.
+                self._keyframe = None
+                self._frame_log = []
+                self._frame_log_size = 0
+
+    def _end_keyframe(self):
+        self._keyframe = self._new_keyframe
+        self._new_keyframe = None
+        self._frame_log = []
+        self._frame_log_size = 0
+        for watcher in self._awaiting_keyframe:
+            self._send_frame_log(watcher)
+        self._awaiting_keyframe.clear()
 
     def handle_input(self, msg):
         obj = json_decode(msg)
@@ -689,6 +770,17 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
                         self.send_to_all("dump", url = url)
                     else:
                         self.exit_dump_url = url
+            elif msgobj["msg"] == "keyframe":
+                # Everything up to keyframe_end is the whole game state.
+                # Receivers that are up to date don't need it, unless
+                # crawl had to drop messages.
+                self._keyframes_supported = True
+                self._keyframe_requested = False
+                self._new_keyframe = []
+                self._new_keyframe_resync = msgobj.get("resync", False)
+            elif msgobj["msg"] == "keyframe_end":
+                if self._new_keyframe is not None:
+                    self._end_keyframe()
             elif msgobj["msg"] == "exit_reason":
                 self.exit_reason = msgobj["type"]
                 if "message" in msgobj:
@@ -708,6 +800,13 @@ class CrawlProcessHandler(CrawlProcessHandlerBase):
                 # want that to reset idle time.
                 self.note_activity()
 
+            if self._new_keyframe is not None:
+                self._new_keyframe.append(msg)
+                if not self._new_keyframe_resync:
+                    return
+            else:
+                self._log_frame(msg)
+
             self.write_to_all(msg, not self.queue_messages)
 
 
@@ -0,0 +1,163 @@
+define([], function () {
+    "use strict";
+
+    // Decoder for the binary game messages that crawl sends instead of
+    // JSON when the server asks for them; see the description of the
+    // format in tileweb.cc. The server forwards them with the marker
+    // byte but without the length.
+
+    var MARKER = 0x02;
+
+    var SMALL_INT_MAX = 0xdf;
+    var INT = 0xe0, NEG_INT = 0xe1, FALSE = 0xe2, TRUE = 0xe3, NULL = 0xe4,
+        STRING = 0xe5, OBJECT = 0xe6, ARRAY = 0xe7, NEW_KEY = 0xe8,
+        KEY = 0xe9, END = 0xef;
+
+    function is_binary_message(bytes)
+    {
+        return bytes.length > 0 && bytes[0] === MARKER;
+    }
+
+    function decode_utf8(bytes, start, end)
+    {
+        var s = "";
+        var i = start;
+        while (i < end)
+        {
+            var c = bytes[i++];
+            if (c >= 0xf0)
+            {
+                c = (c & 0x07) << 18 | (bytes[i] & 0x3f) << 12
+                    | (bytes[i + 1] & 0x3f) << 6 | bytes[i + 2] & 0x3f;
+                i += 3;
+            }
+            else if (c >= 0xe0)
+            {
+                c = (c & 0x0f) << 12 | (bytes[i] & 0x3f) << 6
+                    | bytes[i + 1] & 0x3f;
+                i += 2;
+            }
+            else if (c >= 0xc0)
+                c = (c & 0x1f) << 6 | bytes[i++] & 0x3f;
+
+            if (c >= 0x10000)
+            {
+                c -= 0x10000;
+                s += String.fromCharCode(0xd800 | c >> 10,
+                                         0xdc00 | c & 0x3ff);
+            }
+            else
+                s += String.fromCharCode(c);
+        }
+        return s;
+    }
+
+    function Decoder(bytes)
+    {
+        this.bytes = bytes;
+        this.pos = 1;
+        this.keys = [];
+    }
+
+    Decoder.prototype.byte = function ()
+    {
+        if (this.pos >= this.bytes.length)
+            throw new Error("Truncated binary message");
+        return this.bytes[this.pos++];
+    };
+
+    Decoder.prototype.varint = function ()
+    {
+        // No bitwise operators: values can exceed 32 bits.
+        var value = 0, scale = 1, b;
+        do
+        {
+            b = this.byte();
+            value += (b & 0x7f) * scale;
+            scale *= 128;
+        } while (b & 0x80);
+        return value;
+    };
+
+    Decoder.prototype.string = function ()
+    {
+        var len = this.varint();
+        var start = this.pos;
+        this.pos += len;
+        if (this.pos > this.bytes.length)
+            throw new Error("Truncated binary message");
+        return decode_utf8(this.bytes, start, this.pos);
+    };
+
+    Decoder.prototype.key = function (token)
+    {
+        if (token === NEW_KEY)
+        {
+            var key = this.string();
+            this.keys.push(key);
+            return key;
+        }
+        var index = token === KEY ? this.varint() : token;
+        if (token > SMALL_INT_MAX && token !== KEY
+            || index >= this.keys.length)
+        {
+            throw new Error("Bad key in binary message: " + token);
+        }
+        return this.keys[index];
+    };
+
+    Decoder.prototype.value = function ()
+    {
+        var token = this.byte();
+        if (token <= SMALL_INT_MAX)
+            return token;
+
+        switch (token)
+        {
+        case INT:
+            return this.varint();
+        case NEG_INT:
+            return -this.varint();
+        case FALSE:
+            return false;
+        case TRUE:
+            return true;
+        case NULL:
+            return null;
+        case STRING:
+            return this.string();
+        case OBJECT:
+            var obj = {};
+            while ((token = this.byte()) !== END)
+            {
+                var key = this.key(token);
+                obj[key] = this.value();
+            }
+            return obj;
+        case ARRAY:
+            var arr = [];
+            while (this.bytes[this.pos] !== END)
+                arr.push(this.value());
+            this.pos++;
+            return arr;
+        default:
+            throw new Error("Bad token in binary message: " + token);
+        }
+    };
+
+    // Decode a binary message (a Uint8Array starting with the marker)
+    // into the object the equivalent JSON message would give.
+    function decode(bytes)
+    {
+        var decoder = new Decoder(bytes);
+        var value = decoder.value();
+        if (decoder.pos !== bytes.length)
+            throw new Error("Trailing data in binary message");
+        return value;
+    }
+
+    return {
+        is_binary_message: is_binary_message,
+        decode: decode,
+    };
+});
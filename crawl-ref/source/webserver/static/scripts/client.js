@@ -1,7 +1,8 @@
 define(["exports", "jquery", "key_conversion", "chat", "comm",
-        "contrib/jquery.cookie", "contrib/jquery.tablesorter",
-        "contrib/jquery.waitforimages", "contrib/inflate"],
-function (exports, $, key_conversion, chat, comm) {
+        "binary_message", "contrib/jquery.cookie",
+        "contrib/jquery.tablesorter", "contrib/jquery.waitforimages",
+        "contrib/inflate"],
+function (exports, $, key_conversion, chat, comm, binary_message) {
 
     // Need to keep this global for backwards compatibility :(
     window.current_layer = "crt";
@@ -85,6 +86,41 @@ function (exports, $, key_conversion, chat, comm) {
         handle_message_backlog();
     }
 
+    function enqueue_binary_message(bytes)
+    {
+        var msg;
+        try
+        {
+            msg = binary_message.decode(bytes);
+        }
+        catch (e)
+        {
+            console.error("Binary message error:", e.message);
+            return;
+        }
+        if (window.log_messages)
+            console.log("Message: " + msg.msg, msg);
+        if (!comm.handle_message_immediately(msg))
+            message_queue.push(msg);
+        handle_message_backlog();
+    }
+
+    // Compressed frames are decoded asynchronously, but their messages
+    // must still be handled in the order they were sent.
+    var pending_frames = [];
+
+    function handle_pending_frames()
+    {
+        while (pending_frames.length && pending_frames[0].ready)
+        {
+            var frame = pending_frames.shift();
+            if (frame.binary)
+                enqueue_binary_message(frame.data);
+            else
+                enqueue_messages(frame.data);
+        }
+    }
+
     function handle_message_backlog()
     {
         while (message_queue.length
@@ -1263,17 +1299,43 @@ function (exports, $, key_conversion, chat, comm) {
                         console.error("Decompression error!");
                         var x = inflater.append(data);
                     }
+                    var frame = { ready: false };
+                    pending_frames.push(frame);
+                    if (binary_message.is_binary_message(decompressed[0]))
+                    {
+                        if (window.log_message_size)
+                        {
+                            console.log("Message size: "
+                                        + decompressed[0].length);
+                        }
+                        frame.binary = true;
+                        frame.data = decompressed[0];
+                        frame.ready = true;
+                        handle_pending_frames();
+                        return;
+                    }
                     decode_utf8(decompressed, function (s) {
                         if (window.log_messages === 2)
                             console.log("Message: " + s);
                         if (window.log_message_size)
                             console.log("Message size: " + s.length);
 
-                        enqueue_messages(s);
+                        frame.data = s;
+                        frame.ready = true;
+                        handle_pending_frames();
                     });
                     return;
                 }
 
+                if (msg.data instanceof ArrayBuffer)
+                {
+                    // Uncompressed binary message
+                    if (window.log_message_size)
+                        console.log("Message size: " + msg.data.byteLength);
+                    enqueue_binary_message(new Uint8Array(msg.data));
+                    return;
+                }
+
                 if (window.log_messages === 2)
                     console.log("Message: " + msg.data);
                 if (window.log_message_size)
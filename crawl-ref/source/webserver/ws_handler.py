@@ -14,6 +14,7 @@ import zlib
 
 import config
 import checkoutput
+import binary_message
 from userdb import *
 from util import *
 
@@ -566,9 +567,24 @@ class CrawlWebSocket(tornado.websocket.WebSocketHandler):
     def flush_messages(self):
         if self.client_closed or len(self.message_queue) == 0:
             return
-        msg = "{\"msgs\":[" + ",".join(self.message_queue) + "]}"
+        queue = self.message_queue
         self.message_queue = []
 
+        # Binary messages go in frames of their own, in order with
+        # batches of the JSON messages around them.
+        batch = []
+        for msg in queue:
+            if binary_message.is_binary(msg):
+                if batch:
+                    self._send_frame("{\"msgs\":[" + ",".join(batch) + "]}")
+                    batch = []
+                self._send_frame(msg, binary=True)
+            else:
+                batch.append(msg)
+        if batch:
+            self._send_frame("{\"msgs\":[" + ",".join(batch) + "]}")
+
+    def _send_frame(self, msg, binary=False):
         try:
             self.total_message_bytes += len(msg)
             if self.deflate:
@@ -582,7 +598,7 @@ class CrawlWebSocket(tornado.websocket.WebSocketHandler):
                 super(CrawlWebSocket, self).write_message(compressed, binary=True)
             else:
                 self.uncompressed_bytes_sent += len(msg)
-                super(CrawlWebSocket, self).write_message(msg)
+                super(CrawlWebSocket, self).write_message(msg, binary=binary)
         except:
             self.logger.warning("Exception trying to send message.", exc_info = True)
             if self.ws_connection != None:
@@ -590,10 +606,17 @@ class CrawlWebSocket(tornado.websocket.WebSocketHandler):
 
     def write_message(self, msg, send=True):
         if self.client_closed: return
+        if binary_message.is_binary(msg) and not self.takes_binary_messages():
+            msg = json_encode(binary_message.decode(msg))
         self.message_queue.append(utf8(msg))
         if send:
             self.flush_messages()
 
+    def takes_binary_messages(self):
+        # The client tells binary messages from compressed ones by
+        # whether it asked for compression.
+        return self.deflate or self.subprotocol == "no-compression"
+
     def send_message(self, msg, **data):
         """Sends a JSON message to the client."""
         data["msg"] = msg